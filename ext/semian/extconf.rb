@@ -18,10 +18,12 @@ abort 'openssl is missing. please install openssl.' unless find_library('crypto'
 
 have_header 'sys/ipc.h'
 have_header 'sys/sem.h'
+have_header 'sys/shm.h'
 have_header 'sys/types.h'
 
 have_func 'rb_thread_blocking_region'
 have_func 'rb_thread_call_without_gvl'
+have_func 'rb_fiber_scheduler_current', 'ruby/fiber/scheduler.h'
 
 $CFLAGS = "-D_GNU_SOURCE -Werror -Wall "
 if ENV.key?('DEBUG')
@@ -0,0 +1,56 @@
+#include "histogram.h"
+
+#include <math.h>
+
+static int
+bucket_for_value(uint64_t value_us);
+
+void
+record_histogram_value(semian_histogram_t *histogram, uint64_t value_us)
+{
+  __atomic_add_fetch(&histogram->counts[bucket_for_value(value_us)], 1, __ATOMIC_RELAXED);
+}
+
+void
+record_histogram_interval(semian_histogram_t *histogram, struct timespec *begin, struct timespec *end)
+{
+  int64_t elapsed_ns = (end->tv_sec - begin->tv_sec) * 1000000000LL + (end->tv_nsec - begin->tv_nsec);
+  record_histogram_value(histogram, elapsed_ns > 0 ? elapsed_ns / 1000 : 0);
+}
+
+VALUE
+histogram_to_hash(semian_histogram_t *histogram)
+{
+  VALUE hash = rb_hash_new();
+  uint64_t count;
+  int i;
+
+  for (i = 0; i < SEMIAN_HISTOGRAM_BUCKETS; i++) {
+    count = __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+    if (count == 0) {
+      continue;
+    }
+
+    if (i == SEMIAN_HISTOGRAM_BUCKETS - 1) {
+      rb_hash_aset(hash, DBL2NUM(HUGE_VAL), ULL2NUM(count));
+    } else {
+      rb_hash_aset(hash, ULL2NUM(1ULL << i), ULL2NUM(count));
+    }
+  }
+
+  return hash;
+}
+
+static int
+bucket_for_value(uint64_t value_us)
+{
+  int bucket;
+
+  if (value_us == 0) {
+    return 0;
+  }
+
+  // Bucket i counts values in [2^(i-1), 2^i)
+  bucket = 64 - __builtin_clzll(value_us);
+  return bucket < SEMIAN_HISTOGRAM_BUCKETS - 1 ? bucket : SEMIAN_HISTOGRAM_BUCKETS - 1;
+}
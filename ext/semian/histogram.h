@@ -0,0 +1,32 @@
+/*
+For semian's native histograms
+
+Fixed-size histograms of microsecond durations with logarithmic buckets. The
+first bucket counts durations under a microsecond, and every following bucket
+is twice as wide as the previous one, the last one counting everything longer.
+That keeps the relative error under 2x across the whole range, in a few
+hundred bytes.
+
+Recording is a relaxed atomic increment, so it never takes a lock and is safe
+without the GVL. Readers may see a sample in one bucket before the total is
+updated, which is harmless for periodic scraping.
+*/
+#ifndef SEMIAN_HISTOGRAM_H
+#define SEMIAN_HISTOGRAM_H
+
+#include "types.h"
+
+// Record a duration, in microseconds
+void
+record_histogram_value(semian_histogram_t *histogram, uint64_t value_us);
+
+// Record the duration between two timestamps from CLOCK_MONOTONIC
+void
+record_histogram_interval(semian_histogram_t *histogram, struct timespec *begin, struct timespec *end);
+
+// Build a hash of the upper bound of every non-empty bucket, in microseconds, to its count.
+// The last bucket has no upper bound, and is keyed by Float::INFINITY.
+VALUE
+histogram_to_hash(semian_histogram_t *histogram);
+
+#endif // SEMIAN_HISTOGRAM_H
@@ -0,0 +1,215 @@
+#include "integer.h"
+
+static const rb_data_type_t
+semian_local_integer_type;
+
+static const rb_data_type_t
+semian_integer_type;
+
+static semian_integer_t *
+get_local_integer(VALUE self);
+
+static VALUE
+semian_integer_alloc(VALUE klass);
+
+static semian_shm_integer_t *
+get_integer(VALUE self);
+
+static VALUE
+semian_sysv_integer_alloc(VALUE klass);
+
+void
+init_integer()
+{
+  VALUE cSemian, cThreadSafe, cSysV, cThreadSafeInteger, cInteger;
+
+  cSemian = rb_const_get(rb_cObject, rb_intern("Semian"));
+  cThreadSafe = rb_const_get(cSemian, rb_intern("ThreadSafe"));
+  cSysV = rb_const_get(cSemian, rb_intern("SysV"));
+  cThreadSafeInteger = rb_const_get(cThreadSafe, rb_intern("Integer"));
+  cInteger = rb_const_get(cSysV, rb_intern("Integer"));
+
+  // Replaces the Mutex based implementation
+  rb_define_alloc_func(cThreadSafeInteger, semian_integer_alloc);
+  rb_define_method(cThreadSafeInteger, "initialize", semian_integer_initialize, -1);
+  rb_define_method(cThreadSafeInteger, "value", semian_integer_get_value, 0);
+  rb_define_method(cThreadSafeInteger, "value=", semian_integer_set_value, 1);
+  rb_define_method(cThreadSafeInteger, "increment", semian_integer_increment, -1);
+  rb_define_method(cThreadSafeInteger, "reset", semian_integer_reset, 0);
+  rb_define_method(cThreadSafeInteger, "destroy", semian_integer_reset, 0);
+
+  rb_define_alloc_func(cInteger, semian_sysv_integer_alloc);
+  rb_define_method(cInteger, "initialize_shared_memory", semian_sysv_integer_initialize, 2);
+  rb_define_method(cInteger, "value", semian_sysv_integer_get_value, 0);
+  rb_define_method(cInteger, "value=", semian_sysv_integer_set_value, 1);
+  rb_define_method(cInteger, "increment", semian_sysv_integer_increment, -1);
+  rb_define_method(cInteger, "reset", semian_sysv_integer_reset, 0);
+  rb_define_method(cInteger, "destroy", semian_sysv_integer_destroy, 0);
+}
+
+VALUE
+semian_integer_initialize(int argc, VALUE *argv, VALUE self)
+{
+  VALUE opts;
+
+  // Ignores the keywords the SysV integer needs
+  rb_scan_args(argc, argv, ":", &opts);
+  __atomic_store_n(&get_local_integer(self)->value, 0, __ATOMIC_RELEASE);
+
+  return self;
+}
+
+VALUE
+semian_integer_get_value(VALUE self)
+{
+  return LL2NUM(__atomic_load_n(&get_local_integer(self)->value, __ATOMIC_ACQUIRE));
+}
+
+VALUE
+semian_integer_set_value(VALUE self, VALUE value)
+{
+  __atomic_store_n(&get_local_integer(self)->value, NUM2LL(value), __ATOMIC_RELEASE);
+  return value;
+}
+
+VALUE
+semian_integer_increment(int argc, VALUE *argv, VALUE self)
+{
+  VALUE value;
+
+  rb_scan_args(argc, argv, "01", &value);
+  if (NIL_P(value)) {
+    value = INT2FIX(1);
+  }
+
+  return LL2NUM(__atomic_add_fetch(&get_local_integer(self)->value, NUM2LL(value), __ATOMIC_ACQ_REL));
+}
+
+VALUE
+semian_integer_reset(VALUE self)
+{
+  return semian_integer_set_value(self, INT2FIX(0));
+}
+
+VALUE
+semian_sysv_integer_initialize(VALUE self, VALUE name, VALUE permissions)
+{
+  semian_shm_object_t *obj;
+  char suffix[64];
+
+  Check_Type(name, T_STRING);
+  Check_Type(permissions, T_FIXNUM);
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_integer_type, obj);
+
+  // Segments are zero-filled when created, which is the initial value
+  snprintf(suffix, sizeof(suffix), "_SHM_INTEGER_%zu", sizeof(semian_shm_integer_t));
+  attach_shared_memory_object(obj, StringValueCStr(name), suffix, sizeof(semian_shm_integer_t), FIX2LONG(permissions), NULL, NULL);
+
+  return self;
+}
+
+VALUE
+semian_sysv_integer_get_value(VALUE self)
+{
+  semian_shm_integer_t *integer = get_integer(self);
+  return LL2NUM(__atomic_load_n(&integer->value, __ATOMIC_ACQUIRE));
+}
+
+VALUE
+semian_sysv_integer_set_value(VALUE self, VALUE value)
+{
+  semian_shm_integer_t *integer = get_integer(self);
+  __atomic_store_n(&integer->value, NUM2LL(value), __ATOMIC_RELEASE);
+  return value;
+}
+
+VALUE
+semian_sysv_integer_increment(int argc, VALUE *argv, VALUE self)
+{
+  semian_shm_integer_t *integer = get_integer(self);
+  VALUE value;
+
+  rb_scan_args(argc, argv, "01", &value);
+  if (NIL_P(value)) {
+    value = INT2FIX(1);
+  }
+
+  return LL2NUM(__atomic_add_fetch(&integer->value, NUM2LL(value), __ATOMIC_ACQ_REL));
+}
+
+VALUE
+semian_sysv_integer_reset(VALUE self)
+{
+  return semian_sysv_integer_set_value(self, INT2FIX(0));
+}
+
+VALUE
+semian_sysv_integer_destroy(VALUE self)
+{
+  semian_shm_object_t *obj;
+  VALUE value = semian_sysv_integer_reset(self);
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_integer_type, obj);
+  destroy_shared_memory(obj->shm_id);
+
+  return value;
+}
+
+static VALUE
+semian_integer_alloc(VALUE klass)
+{
+  semian_integer_t *integer;
+  return TypedData_Make_Struct(klass, semian_integer_t, &semian_local_integer_type, integer);
+}
+
+static semian_integer_t *
+get_local_integer(VALUE self)
+{
+  semian_integer_t *integer;
+  TypedData_Get_Struct(self, semian_integer_t, &semian_local_integer_type, integer);
+  return integer;
+}
+
+static VALUE
+semian_sysv_integer_alloc(VALUE klass)
+{
+  semian_shm_object_t *obj;
+  VALUE self = TypedData_Make_Struct(klass, semian_shm_object_t, &semian_integer_type, obj);
+  obj->shm_id = -1;
+  return self;
+}
+
+static semian_shm_integer_t *
+get_integer(VALUE self)
+{
+  semian_shm_object_t *obj;
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_integer_type, obj);
+  if (obj->shm == NULL) {
+    rb_raise(eInternal, "integer is not attached to shared memory");
+  }
+  return (semian_shm_integer_t *) obj->shm;
+}
+
+static const rb_data_type_t
+semian_local_integer_type = {
+  "semian_local_integer",
+  {
+    NULL,
+    RUBY_TYPED_DEFAULT_FREE,
+    NULL
+  },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static const rb_data_type_t
+semian_integer_type = {
+  "semian_integer",
+  {
+    NULL,
+    semian_shm_object_free,
+    semian_shm_object_memsize
+  },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
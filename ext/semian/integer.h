@@ -0,0 +1,95 @@
+/*
+For semian's native integers
+
+Implements Semian::SysV::Integer, an integer kept in shared memory so that it
+is shared by every process on the host using the same circuit breaker.
+
+Also implements Semian::ThreadSafe::Integer with atomic operations, instead of
+a Mutex around every update.
+*/
+#ifndef SEMIAN_INTEGER_H
+#define SEMIAN_INTEGER_H
+
+#include "shared_memory.h"
+
+// Defines the native methods of the integer classes
+void
+init_integer();
+
+/*
+ * call-seq:
+ *    Semian::ThreadSafe::Integer.new(**) -> integer
+ *
+ * Creates an integer with a value of 0.
+ */
+VALUE
+semian_integer_initialize(int argc, VALUE *argv, VALUE self);
+
+// Semian::ThreadSafe::Integer versions of the SysV methods below
+VALUE
+semian_integer_get_value(VALUE self);
+
+VALUE
+semian_integer_set_value(VALUE self, VALUE value);
+
+VALUE
+semian_integer_increment(int argc, VALUE *argv, VALUE self);
+
+VALUE
+semian_integer_reset(VALUE self);
+
+/*
+ * call-seq:
+ *    integer.initialize_shared_memory(name, permissions) -> integer
+ *
+ * Attaches the integer to the shared memory segment for name, creating it if needed.
+ */
+VALUE
+semian_sysv_integer_initialize(VALUE self, VALUE name, VALUE permissions);
+
+/*
+ * call-seq:
+ *    integer.value -> value
+ *
+ * Returns the current value.
+ */
+VALUE
+semian_sysv_integer_get_value(VALUE self);
+
+/*
+ * call-seq:
+ *    integer.value = value -> value
+ *
+ * Sets the current value.
+ */
+VALUE
+semian_sysv_integer_set_value(VALUE self, VALUE value);
+
+/*
+ * call-seq:
+ *    integer.increment(value = 1) -> value
+ *
+ * Atomically adds to the value, returning the result.
+ */
+VALUE
+semian_sysv_integer_increment(int argc, VALUE *argv, VALUE self);
+
+/*
+ * call-seq:
+ *    integer.reset -> 0
+ *
+ * Resets the value to 0.
+ */
+VALUE
+semian_sysv_integer_reset(VALUE self);
+
+/*
+ * call-seq:
+ *    integer.destroy -> 0
+ *
+ * Resets the value and marks its shared memory segment for removal.
+ */
+VALUE
+semian_sysv_integer_destroy(VALUE self);
+
+#endif // SEMIAN_INTEGER_H
@@ -0,0 +1,421 @@
+#include "request_window.h"
+
+static ID id_buckets;
+
+static const rb_data_type_t
+semian_local_request_window_type;
+
+static const rb_data_type_t
+semian_request_window_type;
+
+static semian_request_window_t *
+get_local_request_window(VALUE self);
+
+static void
+record_request(semian_request_bucket_t *buckets, long size, int64_t now, int error);
+
+static void
+count_requests(semian_request_bucket_t *buckets, long size, int64_t now, int64_t *requests, int64_t *errors);
+
+static VALUE
+semian_request_window_alloc(VALUE klass);
+
+static void
+semian_request_window_free(void *ptr);
+
+static size_t
+semian_request_window_memsize(const void *ptr);
+
+static void
+initialize_request_window(void *shm, void *arg);
+
+static semian_shm_request_window_t *
+get_request_window(VALUE self);
+
+static void
+lock_request_window(semian_shm_request_window_t *window);
+
+static void
+unlock_request_window(semian_shm_request_window_t *window);
+
+static VALUE
+semian_sysv_request_window_alloc(VALUE klass);
+
+void
+init_request_window()
+{
+  VALUE cSemian, cSimple, cThreadSafe, cSysV, cSimpleRequestWindow, cThreadSafeRequestWindow, cRequestWindow;
+
+  cSemian = rb_const_get(rb_cObject, rb_intern("Semian"));
+  cSimple = rb_const_get(cSemian, rb_intern("Simple"));
+  cThreadSafe = rb_const_get(cSemian, rb_intern("ThreadSafe"));
+  cSysV = rb_const_get(cSemian, rb_intern("SysV"));
+  cSimpleRequestWindow = rb_const_get(cSimple, rb_intern("RequestWindow"));
+  cThreadSafeRequestWindow = rb_const_get(cThreadSafe, rb_intern("RequestWindow"));
+  cRequestWindow = rb_const_get(cSysV, rb_intern("RequestWindow"));
+
+  // Replaces the Array based implementation, ThreadSafe::RequestWindow inherits the methods.
+  // Subclasses that already exist don't inherit a new allocator, so it is set on both.
+  rb_define_alloc_func(cSimpleRequestWindow, semian_request_window_alloc);
+  rb_define_alloc_func(cThreadSafeRequestWindow, semian_request_window_alloc);
+  rb_define_method(cSimpleRequestWindow, "initialize", semian_request_window_initialize, -1);
+  rb_define_method(cSimpleRequestWindow, "buckets", semian_request_window_buckets, 0);
+  rb_define_method(cSimpleRequestWindow, "record_success", semian_request_window_record_success, 1);
+  rb_define_method(cSimpleRequestWindow, "record_error", semian_request_window_record_error, 1);
+  rb_define_method(cSimpleRequestWindow, "requests", semian_request_window_requests, 1);
+  rb_define_method(cSimpleRequestWindow, "errors", semian_request_window_errors, 1);
+  rb_define_method(cSimpleRequestWindow, "clear", semian_request_window_clear, 0);
+  rb_define_method(cSimpleRequestWindow, "destroy", semian_request_window_clear, 0);
+
+  // Replaces the Mutex based ThreadSafe methods, the native methods run without switching threads
+  rb_define_method(cThreadSafeRequestWindow, "initialize", semian_request_window_initialize, -1);
+  rb_define_method(cThreadSafeRequestWindow, "record_success", semian_request_window_record_success, 1);
+  rb_define_method(cThreadSafeRequestWindow, "record_error", semian_request_window_record_error, 1);
+  rb_define_method(cThreadSafeRequestWindow, "requests", semian_request_window_requests, 1);
+  rb_define_method(cThreadSafeRequestWindow, "errors", semian_request_window_errors, 1);
+  rb_define_method(cThreadSafeRequestWindow, "clear", semian_request_window_clear, 0);
+  rb_define_method(cThreadSafeRequestWindow, "destroy", semian_request_window_clear, 0);
+
+  rb_define_alloc_func(cRequestWindow, semian_sysv_request_window_alloc);
+  rb_define_method(cRequestWindow, "initialize_shared_memory", semian_sysv_request_window_initialize, 3);
+  rb_define_method(cRequestWindow, "buckets", semian_sysv_request_window_buckets, 0);
+  rb_define_method(cRequestWindow, "record_success", semian_sysv_request_window_record_success, 1);
+  rb_define_method(cRequestWindow, "record_error", semian_sysv_request_window_record_error, 1);
+  rb_define_method(cRequestWindow, "requests", semian_sysv_request_window_requests, 1);
+  rb_define_method(cRequestWindow, "errors", semian_sysv_request_window_errors, 1);
+  rb_define_method(cRequestWindow, "clear", semian_sysv_request_window_clear, 0);
+  rb_define_method(cRequestWindow, "destroy", semian_sysv_request_window_destroy, 0);
+
+  id_buckets = rb_intern("buckets");
+}
+
+VALUE
+semian_request_window_initialize(int argc, VALUE *argv, VALUE self)
+{
+  semian_request_window_t *window;
+  VALUE opts, buckets;
+  long c_buckets;
+
+  // Accepts buckets:, and ignores the other keywords the SysV window needs
+  rb_scan_args(argc, argv, ":", &opts);
+  rb_get_kwargs(opts, &id_buckets, 1, -1, &buckets);
+  c_buckets = NUM2LONG(buckets);
+  if (c_buckets <= 0) {
+    rb_raise(rb_eArgError, "buckets must be positive");
+  }
+
+  TypedData_Get_Struct(self, semian_request_window_t, &semian_local_request_window_type, window);
+  xfree(window->buckets);
+  window->buckets = ZALLOC_N(semian_request_bucket_t, c_buckets);
+  window->size = c_buckets;
+
+  return self;
+}
+
+VALUE
+semian_request_window_buckets(VALUE self)
+{
+  return LONG2NUM(get_local_request_window(self)->size);
+}
+
+VALUE
+semian_request_window_record_success(VALUE self, VALUE now)
+{
+  semian_request_window_t *window = get_local_request_window(self);
+  record_request(window->buckets, window->size, NUM2LL(now), 0);
+  return self;
+}
+
+VALUE
+semian_request_window_record_error(VALUE self, VALUE now)
+{
+  semian_request_window_t *window = get_local_request_window(self);
+  record_request(window->buckets, window->size, NUM2LL(now), 1);
+  return self;
+}
+
+VALUE
+semian_request_window_requests(VALUE self, VALUE now)
+{
+  semian_request_window_t *window = get_local_request_window(self);
+  int64_t requests, errors;
+
+  count_requests(window->buckets, window->size, NUM2LL(now), &requests, &errors);
+  return LL2NUM(requests);
+}
+
+VALUE
+semian_request_window_errors(VALUE self, VALUE now)
+{
+  semian_request_window_t *window = get_local_request_window(self);
+  int64_t requests, errors;
+
+  count_requests(window->buckets, window->size, NUM2LL(now), &requests, &errors);
+  return LL2NUM(errors);
+}
+
+VALUE
+semian_request_window_clear(VALUE self)
+{
+  semian_request_window_t *window = get_local_request_window(self);
+  MEMZERO(window->buckets, semian_request_bucket_t, window->size);
+  return self;
+}
+
+VALUE
+semian_sysv_request_window_initialize(VALUE self, VALUE name, VALUE buckets, VALUE permissions)
+{
+  semian_shm_object_t *obj;
+  char suffix[64];
+  int32_t c_buckets;
+  size_t size;
+
+  Check_Type(name, T_STRING);
+  Check_Type(permissions, T_FIXNUM);
+  c_buckets = NUM2INT(buckets);
+  if (c_buckets <= 0) {
+    rb_raise(rb_eArgError, "buckets must be positive");
+  }
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_request_window_type, obj);
+
+  // The bucket count is part of the key, so windows of different lengths never share a segment
+  size = sizeof(semian_shm_request_window_t) + sizeof(semian_request_bucket_t) * c_buckets;
+  snprintf(suffix, sizeof(suffix), "_SHM_REQUEST_WINDOW_%d_%zu", c_buckets, sizeof(semian_shm_request_window_t));
+  attach_shared_memory_object(obj, StringValueCStr(name), suffix, size, FIX2LONG(permissions), initialize_request_window, &c_buckets);
+
+  return self;
+}
+
+VALUE
+semian_sysv_request_window_buckets(VALUE self)
+{
+  return INT2NUM(get_request_window(self)->size);
+}
+
+VALUE
+semian_sysv_request_window_record_success(VALUE self, VALUE now)
+{
+  semian_shm_request_window_t *window = get_request_window(self);
+  // Converted before locking, raising with the lock held would leave it locked
+  int64_t c_now = NUM2LL(now);
+
+  lock_request_window(window);
+  record_request(window->buckets, window->size, c_now, 0);
+  unlock_request_window(window);
+
+  return self;
+}
+
+VALUE
+semian_sysv_request_window_record_error(VALUE self, VALUE now)
+{
+  semian_shm_request_window_t *window = get_request_window(self);
+  int64_t c_now = NUM2LL(now);
+
+  lock_request_window(window);
+  record_request(window->buckets, window->size, c_now, 1);
+  unlock_request_window(window);
+
+  return self;
+}
+
+VALUE
+semian_sysv_request_window_requests(VALUE self, VALUE now)
+{
+  semian_shm_request_window_t *window = get_request_window(self);
+  int64_t c_now = NUM2LL(now);
+  int64_t requests, errors;
+
+  lock_request_window(window);
+  count_requests(window->buckets, window->size, c_now, &requests, &errors);
+  unlock_request_window(window);
+
+  return LL2NUM(requests);
+}
+
+VALUE
+semian_sysv_request_window_errors(VALUE self, VALUE now)
+{
+  semian_shm_request_window_t *window = get_request_window(self);
+  int64_t c_now = NUM2LL(now);
+  int64_t requests, errors;
+
+  lock_request_window(window);
+  count_requests(window->buckets, window->size, c_now, &requests, &errors);
+  unlock_request_window(window);
+
+  return LL2NUM(errors);
+}
+
+VALUE
+semian_sysv_request_window_clear(VALUE self)
+{
+  semian_shm_request_window_t *window = get_request_window(self);
+
+  lock_request_window(window);
+  memset(window->buckets, 0, sizeof(semian_request_bucket_t) * window->size);
+  unlock_request_window(window);
+
+  return self;
+}
+
+VALUE
+semian_sysv_request_window_destroy(VALUE self)
+{
+  semian_shm_object_t *obj;
+  VALUE value = semian_sysv_request_window_clear(self);
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_request_window_type, obj);
+  destroy_shared_memory(obj->shm_id);
+
+  return value;
+}
+
+static semian_request_window_t *
+get_local_request_window(VALUE self)
+{
+  semian_request_window_t *window;
+
+  TypedData_Get_Struct(self, semian_request_window_t, &semian_local_request_window_type, window);
+  if (window->buckets == NULL) {
+    rb_raise(eInternal, "request window is not initialized");
+  }
+  return window;
+}
+
+// Each second has its bucket, which is reset the first time it's used in a new cycle of the window
+static void
+record_request(semian_request_bucket_t *buckets, long size, int64_t now, int error)
+{
+  int64_t second = now / 1000 + 1;
+  semian_request_bucket_t *bucket = &buckets[second % size];
+
+  if (bucket->second != second) {
+    bucket->second = second;
+    bucket->successes = 0;
+    bucket->errors = 0;
+  }
+  if (error) {
+    bucket->errors++;
+  } else {
+    bucket->successes++;
+  }
+}
+
+static void
+count_requests(semian_request_bucket_t *buckets, long size, int64_t now, int64_t *requests, int64_t *errors)
+{
+  int64_t second = now / 1000 + 1;
+  long i;
+
+  *requests = 0;
+  *errors = 0;
+  for (i = 0; i < size; i++) {
+    // Skips empty buckets, and buckets left over from an earlier cycle
+    if (buckets[i].second > second - size && buckets[i].second <= second) {
+      *requests += buckets[i].successes + buckets[i].errors;
+      *errors += buckets[i].errors;
+    }
+  }
+}
+
+static VALUE
+semian_request_window_alloc(VALUE klass)
+{
+  semian_request_window_t *window;
+  return TypedData_Make_Struct(klass, semian_request_window_t, &semian_local_request_window_type, window);
+}
+
+static void
+semian_request_window_free(void *ptr)
+{
+  semian_request_window_t *window = (semian_request_window_t *) ptr;
+  xfree(window->buckets);
+  xfree(window);
+}
+
+static size_t
+semian_request_window_memsize(const void *ptr)
+{
+  const semian_request_window_t *window = (const semian_request_window_t *) ptr;
+  return sizeof(semian_request_window_t) + sizeof(semian_request_bucket_t) * window->size;
+}
+
+static void
+initialize_request_window(void *shm, void *arg)
+{
+  semian_shm_request_window_t *window = (semian_shm_request_window_t *) shm;
+  pthread_mutexattr_t attr;
+
+  window->size = *(int32_t *) arg;
+
+  // The lock is shared by every process, and must be recoverable if one dies while holding it
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&window->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+static semian_shm_request_window_t *
+get_request_window(VALUE self)
+{
+  semian_shm_object_t *obj;
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_request_window_type, obj);
+  if (obj->shm == NULL) {
+    rb_raise(eInternal, "request window is not attached to shared memory");
+  }
+  return (semian_shm_request_window_t *) obj->shm;
+}
+
+static void
+lock_request_window(semian_shm_request_window_t *window)
+{
+  int ret = pthread_mutex_lock(&window->lock);
+
+  if (ret == EOWNERDEAD) {
+    // The previous owner died in a critical section, at worst leaving a bucket with a stale count
+    pthread_mutex_consistent(&window->lock);
+  } else if (ret != 0) {
+    raise_semian_syscall_error("pthread_mutex_lock()", ret);
+  }
+}
+
+static void
+unlock_request_window(semian_shm_request_window_t *window)
+{
+  pthread_mutex_unlock(&window->lock);
+}
+
+static VALUE
+semian_sysv_request_window_alloc(VALUE klass)
+{
+  semian_shm_object_t *obj;
+  VALUE self = TypedData_Make_Struct(klass, semian_shm_object_t, &semian_request_window_type, obj);
+  obj->shm_id = -1;
+  return self;
+}
+
+static const rb_data_type_t
+semian_local_request_window_type = {
+  "semian_local_request_window",
+  {
+    NULL,
+    semian_request_window_free,
+    semian_request_window_memsize
+  },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static const rb_data_type_t
+semian_request_window_type = {
+  "semian_request_window",
+  {
+    NULL,
+    semian_shm_object_free,
+    semian_shm_object_memsize
+  },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
@@ -0,0 +1,123 @@
+/*
+For semian's native request windows
+
+Implements Semian::Simple::RequestWindow, which counts the successful and
+failed requests of the last few seconds in a fixed array of per-second
+buckets, local to the process. Recording a request only touches the bucket
+of the current second, so it never allocates. The ThreadSafe window inherits
+the native methods, which don't switch threads.
+
+Also implements Semian::SysV::RequestWindow, the same buckets kept in shared
+memory so that they are shared by every process on the host using the same
+circuit breaker.
+*/
+#ifndef SEMIAN_REQUEST_WINDOW_H
+#define SEMIAN_REQUEST_WINDOW_H
+
+#include "shared_memory.h"
+
+// Defines the native methods of the request window classes
+void
+init_request_window();
+
+/*
+ * call-seq:
+ *    Semian::Simple::RequestWindow.new(buckets:) -> request_window
+ *
+ * Creates an empty window counting the requests of the last buckets seconds.
+ */
+VALUE
+semian_request_window_initialize(int argc, VALUE *argv, VALUE self);
+
+// Semian::Simple::RequestWindow versions of the SysV methods below
+VALUE
+semian_request_window_buckets(VALUE self);
+
+VALUE
+semian_request_window_record_success(VALUE self, VALUE now);
+
+VALUE
+semian_request_window_record_error(VALUE self, VALUE now);
+
+VALUE
+semian_request_window_requests(VALUE self, VALUE now);
+
+VALUE
+semian_request_window_errors(VALUE self, VALUE now);
+
+VALUE
+semian_request_window_clear(VALUE self);
+
+/*
+ * call-seq:
+ *    request_window.initialize_shared_memory(name, buckets, permissions) -> request_window
+ *
+ * Attaches the request window to the shared memory segment for name, creating it if needed.
+ */
+VALUE
+semian_sysv_request_window_initialize(VALUE self, VALUE name, VALUE buckets, VALUE permissions);
+
+/*
+ * call-seq:
+ *    request_window.buckets -> buckets
+ *
+ * Returns the number of seconds counted by the window.
+ */
+VALUE
+semian_sysv_request_window_buckets(VALUE self);
+
+/*
+ * call-seq:
+ *    request_window.record_success(now) -> request_window
+ *
+ * Counts a successful request at now, in milliseconds of the monotonic clock.
+ */
+VALUE
+semian_sysv_request_window_record_success(VALUE self, VALUE now);
+
+/*
+ * call-seq:
+ *    request_window.record_error(now) -> request_window
+ *
+ * Counts a failed request at now, in milliseconds of the monotonic clock.
+ */
+VALUE
+semian_sysv_request_window_record_error(VALUE self, VALUE now);
+
+/*
+ * call-seq:
+ *    request_window.requests(now) -> count
+ *
+ * Returns the number of requests, successful or not, counted in the window ending at now.
+ */
+VALUE
+semian_sysv_request_window_requests(VALUE self, VALUE now);
+
+/*
+ * call-seq:
+ *    request_window.errors(now) -> count
+ *
+ * Returns the number of failed requests counted in the window ending at now.
+ */
+VALUE
+semian_sysv_request_window_errors(VALUE self, VALUE now);
+
+/*
+ * call-seq:
+ *    request_window.clear -> request_window
+ *
+ * Forgets every request counted so far.
+ */
+VALUE
+semian_sysv_request_window_clear(VALUE self);
+
+/*
+ * call-seq:
+ *    request_window.destroy -> request_window
+ *
+ * Clears the window and marks its shared memory segment for removal.
+ */
+VALUE
+semian_sysv_request_window_destroy(VALUE self);
+
+#endif // SEMIAN_REQUEST_WINDOW_H
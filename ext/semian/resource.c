@@ -1,12 +1,87 @@
 #include "resource.h"
+#include "histogram.h"
+#include "resource_pool.h"
+#include "shm_tickets.h"
+#include "stats.h"
+#include "tickets.h"
+
+#include <limits.h>
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+#include <ruby/fiber/scheduler.h>
+#endif
+
+// Weight of a new sample in the moving average of expected waits, as a right shift: 1/8
+#define EXPECTED_WAIT_SHIFT 3
+
+// Bounds of the sleeps between attempts to take a ticket when waiting under a fiber scheduler
+#define SCHEDULER_POLL_MIN_NS 100000L /* 100us */
+#define SCHEDULER_POLL_MAX_NS 10000000L /* 10ms */
 
 // Ruby variables
 ID id_wait_time;
 ID id_timeout;
+ID id_ticket_backend;
+ID id_sysv;
+ID id_shm;
+ID id_resource_pool;
+ID id_resource_pool_capacity;
+ID id_adaptive_tickets;
+ID id_reserved_tickets;
+ID id_priority;
+ID id_fifo;
+ID id_max_queue;
+ID id_scope;
+ID id_scope_tickets;
+ID id_deadline;
+ID id_early_fail;
+ID id_stats;
+ID id_preload;
+ID id_sha1;
+ID id_fnv1a;
+ID id_high;
+ID id_low;
+ID id_milliseconds;
+ID id_nanoseconds;
+ID id_seconds;
+VALUE cLease;
 int system_max_semaphore_count;
+int system_max_semaphores_per_set;
+
+// Unit of the wait times yielded by acquire, one of id_milliseconds, id_nanoseconds or id_seconds
+static ID wait_time_unit;
 
 static VALUE
-cleanup_semian_resource_acquire(VALUE self);
+cleanup_semian_resource_acquire(VALUE p);
+
+static int
+try_acquire_ticket(semian_resource_t *res);
+
+static void
+acquire_ticket(semian_resource_t *res);
+
+static void
+acquire_ticket_or_fail_early(semian_resource_t *self_res, semian_resource_t *res);
+
+static int
+expects_wait_past_timeout(semian_resource_t *self_res, semian_resource_t *res);
+
+static void
+record_expected_wait(semian_resource_t *self_res, semian_resource_t *res);
+
+static void
+apply_deadline_arg(semian_resource_t *res, VALUE deadline);
+
+static void
+attach_lease_shm_tickets(semian_lease_t *lease);
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+static VALUE
+sleep_with_fiber_scheduler(VALUE p);
+
+static void
+acquire_with_fiber_scheduler(semian_resource_t *res, VALUE scheduler);
+#endif
 
 static void
 check_tickets_xor_quota_arg(VALUE tickets, VALUE quota);
@@ -26,54 +101,375 @@ char *check_id_arg(VALUE id);
 static double
 check_default_timeout_arg(VALUE default_timeout);
 
+static int
+check_ticket_backend_arg(VALUE options);
+
+static const char *
+check_resource_pool_arg(VALUE options, int *capacity);
+
+static int
+check_ticket_bound_arg(VALUE bound, const char *name);
+
+static int
+check_reserved_tickets_arg(VALUE options);
+
+static int
+check_priority_arg(VALUE priority, int reserved_tickets);
+
+static int
+check_max_queue_arg(VALUE options);
+
+static int
+check_scope_tickets_arg(VALUE options, semian_resource_t *res, int *scope_tickets);
+
+static int
+check_scope_ticket_arg(VALUE scope, VALUE tickets, VALUE arg);
+
+static unsigned short
+scope_semaphore(semian_resource_t *res, VALUE scope);
+
+static semian_histogram_t *
+scope_duration_histogram(semian_duration_histograms_t *histograms, VALUE scope);
+
+static void
+take_ticket(int argc, VALUE *argv, VALUE self, semian_resource_t *res);
+
+static VALUE
+yield_holding_ticket(semian_resource_t *res, VALUE wait_time);
+
+static void
+seconds_to_timespec(double seconds, struct timespec *ts);
+
+static VALUE
+wait_time_to_value(long wait_time_ns);
+
+static double
+check_timeout_arg(VALUE timeout);
+
+static int
+compare_resources_by_semaphore_set(const void *a, const void *b);
+
+static long
+count_colocated_resources(acquire_all_args_t *args, long start);
+
+static void *
+acquire_all_without_gvl(void *p);
+
+static VALUE
+cleanup_semian_resource_acquire_all(VALUE p);
+
 static void
-ms_to_timespec(long ms, struct timespec *ts);
+release_acquired_resources(acquire_all_args_t *args);
 
 static const rb_data_type_t
 semian_resource_type;
 
+static const rb_data_type_t
+semian_lease_type;
+
 VALUE
 semian_resource_acquire(int argc, VALUE *argv, VALUE self)
 {
-  semian_resource_t *self_res = NULL;
   semian_resource_t res = { 0 };
+  VALUE wait_time = Qnil;
 
   if (!rb_block_given_p()) {
     rb_raise(rb_eArgError, "acquire requires a block");
   }
 
+  take_ticket(argc, argv, self, &res);
+  if (res.wait_time >= 0) {
+    wait_time = wait_time_to_value(res.wait_time);
+  }
+
+  return yield_holding_ticket(&res, wait_time);
+}
+
+VALUE
+semian_resource_lease(int argc, VALUE *argv, VALUE self)
+{
+  semian_lease_t *lease = NULL;
+  // Allocated first, so that nothing can fail between taking the ticket and handing it to the lease
+  VALUE obj = TypedData_Make_Struct(cLease, semian_lease_t, &semian_lease_type, lease);
+
+  lease->resource = self;
+  take_ticket(argc, argv, self, &lease->res);
+  if (lease->res.shm_tickets) {
+    attach_lease_shm_tickets(lease);
+  }
+  lease->pid = getpid();
+  clock_gettime(CLOCK_MONOTONIC, &lease->res.acquired_at);
+
+  return obj;
+}
+
+// The lease maps the tickets segment itself, so that it can still give its ticket back once the
+// resource detached it, such as when both are collected together
+static void
+attach_lease_shm_tickets(semian_lease_t *lease)
+{
+  void *shm_tickets = shmat(lease->res.shm_id, NULL, 0);
+  int error = errno;
+
+  if (shm_tickets == (void *) -1) {
+    cleanup_semian_resource_acquire((VALUE) &lease->res);
+    raise_semian_syscall_error("shmat()", error);
+  }
+  lease->shm_tickets = shm_tickets;
+  lease->res.shm_tickets = shm_tickets;
+}
+
+VALUE
+semian_lease_release(VALUE self)
+{
+  semian_lease_t *lease = NULL;
+  semian_resource_t *res = NULL;
+
+  TypedData_Get_Struct(self, semian_lease_t, &semian_lease_type, lease);
+  if (lease->pid != getpid()) {
+    return Qfalse;
+  }
+  lease->pid = 0;
+
+  TypedData_Get_Struct(lease->resource, semian_resource_t, &semian_resource_type, res);
+  if (lease->res.stats != res->stats) {
+    // The resource was destroyed while the ticket was leased, its stats slot was given back
+    lease->res.stats = NULL;
+  }
+  cleanup_semian_resource_acquire((VALUE) &lease->res);
+  detach_shared_memory(lease->shm_tickets);
+  lease->shm_tickets = NULL;
+  return Qtrue;
+}
+
+VALUE
+semian_lease_released(VALUE self)
+{
+  semian_lease_t *lease = NULL;
+  TypedData_Get_Struct(self, semian_lease_t, &semian_lease_type, lease);
+  return lease->pid == getpid() ? Qfalse : Qtrue;
+}
+
+VALUE
+semian_lease_wait_time(VALUE self)
+{
+  semian_lease_t *lease = NULL;
+  TypedData_Get_Struct(self, semian_lease_t, &semian_lease_type, lease);
+  return wait_time_to_value(lease->res.wait_time > 0 ? lease->res.wait_time : 0);
+}
+
+// Takes a ticket for acquire or lease, raising Semian::TimeoutError if none could be taken.
+// Fills in res, the copy of the resource the ticket is held with.
+static void
+take_ticket(int argc, VALUE *argv, VALUE self, semian_resource_t *res)
+{
+  semian_resource_t *self_res = NULL;
+  VALUE scope, opts;
+
+  rb_scan_args(argc, argv, "01:", &scope, &opts);
   TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, self_res);
-  res = *self_res;
+  if (self_res->shm_tickets) {
+    ensure_shm_owner(self_res);
+  }
+  if (self_res->quota > 0) {
+    resize_quota_tickets(self_res);
+  }
+  *res = *self_res;
 
   /* allow the default timeout to be overridden by a "timeout" param */
-  if (argc == 1 && TYPE(argv[0]) == T_HASH) {
-    VALUE timeout = rb_hash_aref(argv[0], ID2SYM(id_timeout));
+  if (!NIL_P(opts)) {
+    VALUE timeout = rb_hash_aref(opts, ID2SYM(id_timeout));
     if (TYPE(timeout) != T_NIL) {
-      if (TYPE(timeout) != T_FLOAT && TYPE(timeout) != T_FIXNUM) {
-        rb_raise(rb_eArgError, "timeout parameter must be numeric");
-      }
-      ms_to_timespec(NUM2DBL(timeout) * 1000, &res.timeout);
+      seconds_to_timespec(check_timeout_arg(timeout), &res->timeout);
+    }
+    res->reserve = check_priority_arg(rb_hash_aref(opts, ID2SYM(id_priority)), res->reserved_tickets);
+    if (NIL_P(scope)) {
+      scope = rb_hash_aref(opts, ID2SYM(id_scope));
     }
-  } else if (argc > 0) {
-    rb_raise(rb_eArgError, "invalid arguments");
+    apply_deadline_arg(res, rb_hash_aref(opts, ID2SYM(id_deadline)));
   }
+  res->scope_sem = scope_semaphore(res, scope);
+  res->duration_histogram = scope_duration_histogram(res->duration_histograms, scope);
 
-  /* release the GVL to acquire the semaphore */
-  acquire_semaphore_without_gvl(&res);
-  if (res.error != 0) {
-    if (res.error == EAGAIN) {
-      rb_raise(eTimeout, "timed out waiting for resource '%s'", res.name);
+  if (res->early_fail) {
+    acquire_ticket_or_fail_early(self_res, res);
+  } else {
+    acquire_ticket(res);
+  }
+  if (res->error != 0) {
+    if (res->error == EAGAIN) {
+      record_stats_timeout(res->stats);
+      rb_raise(eTimeout, "timed out waiting for resource '%s'", res->name);
+    } else if (res->error == EBUSY) {
+      record_stats_timeout(res->stats);
+      rb_raise(eTimeout, "too many callers are waiting for resource '%s'", res->name);
+    } else if (res->error == ETIME) {
+      record_stats_timeout(res->stats);
+      rb_raise(eTimeout, "resource '%s' isn't expected to free a ticket in time", res->name);
     } else {
+      raise_semian_syscall_error("semop()", res->error);
+    }
+  }
+  record_stats_acquired(res->stats, res->wait_time);
+}
+
+VALUE
+semian_resource_try_acquire(int argc, VALUE *argv, VALUE self)
+{
+  semian_resource_t *self_res = NULL;
+  semian_resource_t res = { 0 };
+  VALUE scope, opts;
+
+  if (!rb_block_given_p()) {
+    rb_raise(rb_eArgError, "try_acquire requires a block");
+  }
+
+  rb_scan_args(argc, argv, "01:", &scope, &opts);
+  TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, self_res);
+  if (self_res->shm_tickets) {
+    ensure_shm_owner(self_res);
+  }
+  if (self_res->quota > 0) {
+    resize_quota_tickets(self_res);
+  }
+  res = *self_res;
+  if (!NIL_P(opts)) {
+    res.reserve = check_priority_arg(rb_hash_aref(opts, ID2SYM(id_priority)), res.reserved_tickets);
+    if (NIL_P(scope)) {
+      scope = rb_hash_aref(opts, ID2SYM(id_scope));
+    }
+  }
+  res.scope_sem = scope_semaphore(&res, scope);
+  res.duration_histogram = scope_duration_histogram(res.duration_histograms, scope);
+
+  if (!try_acquire_ticket(&res)) {
+    if (res.error != 0) {
       raise_semian_syscall_error("semop()", res.error);
     }
+    return Qfalse;
   }
+  record_histogram_value(res.wait_time_histogram, 0);
+  record_stats_acquired(res.stats, 0);
 
-  VALUE wait_time = Qnil;
-  if (res.wait_time >= 0) {
-    wait_time = LONG2NUM(res.wait_time);
+  return yield_holding_ticket(&res, wait_time_to_value(0));
+}
+
+VALUE
+semian_resource_acquire_all(int argc, VALUE *argv, VALUE klass)
+{
+  acquire_all_args_t args = { 0 };
+  semian_resource_t *res = NULL;
+  VALUE resources, opts, timeout = Qnil, resources_buf, sops_buf, wait_time, result;
+  long i;
+
+  if (!rb_block_given_p()) {
+    rb_raise(rb_eArgError, "acquire_all requires a block");
   }
 
-  return rb_ensure(rb_yield, wait_time, cleanup_semian_resource_acquire, self);
+  rb_scan_args(argc, argv, "1:", &resources, &opts);
+  Check_Type(resources, T_ARRAY);
+  if (!NIL_P(opts)) {
+    timeout = rb_hash_aref(opts, ID2SYM(id_timeout));
+  }
+
+  args.count = RARRAY_LEN(resources);
+  args.resources = ALLOCV_N(semian_resource_t, resources_buf, args.count);
+  args.sops = ALLOCV_N(struct sembuf, sops_buf, args.count);
+
+  for (i = 0; i < args.count; i++) {
+    TypedData_Get_Struct(RARRAY_AREF(resources, i), semian_resource_t, &semian_resource_type, res);
+    if (res->shm_tickets) {
+      ensure_shm_owner(res);
+    }
+    if (res->quota > 0) {
+      resize_quota_tickets(res);
+    }
+    args.resources[i] = *res;
+
+    // Without an explicit timeout, don't wait longer than any of the resources would on its own
+    if (i == 0 || res->timeout.tv_sec < args.timeout.tv_sec ||
+        (res->timeout.tv_sec == args.timeout.tv_sec && res->timeout.tv_nsec < args.timeout.tv_nsec)) {
+      args.timeout = res->timeout;
+    }
+  }
+  if (!NIL_P(timeout)) {
+    seconds_to_timespec(check_timeout_arg(timeout), &args.timeout);
+  }
+
+  // Acquiring in a global order prevents deadlocks between callers passing the same resources in a different order
+  qsort(args.resources, args.count, sizeof(semian_resource_t), compare_resources_by_semaphore_set);
+
+  WITHOUT_GVL(acquire_all_without_gvl, &args, RUBY_UBF_IO, NULL);
+  if (args.error != 0) {
+    // Releasing resets the count of acquired resources, which points at the one that failed
+    res = &args.resources[args.acquired];
+    // All or nothing, hand back the tickets of the resources acquired before the failure
+    release_acquired_resources(&args);
+    if (args.error == EAGAIN) {
+      record_stats_timeout(res->stats);
+      rb_raise(eTimeout, "timed out waiting for resource '%s'", res->name);
+    } else if (args.error == EBUSY) {
+      record_stats_timeout(res->stats);
+      rb_raise(eTimeout, "too many callers are waiting for resource '%s'", res->name);
+    } else {
+      raise_semian_syscall_error("semop()", args.error);
+    }
+  }
+  for (i = 0; i < args.count; i++) {
+    record_stats_acquired(args.resources[i].stats, args.wait_time);
+  }
+
+  wait_time = wait_time_to_value(args.wait_time);
+  result = rb_ensure(rb_yield, wait_time, cleanup_semian_resource_acquire_all, (VALUE) &args);
+
+  ALLOCV_END(resources_buf);
+  ALLOCV_END(sops_buf);
+  RB_GC_GUARD(resources);
+
+  return result;
+}
+
+VALUE
+semian_resource_get_wait_time_unit(VALUE klass)
+{
+  return ID2SYM(wait_time_unit ? wait_time_unit : id_milliseconds);
+}
+
+VALUE
+semian_resource_set_wait_time_unit(VALUE klass, VALUE unit)
+{
+  ID id;
+
+  if (TYPE(unit) != T_SYMBOL) {
+    rb_raise(rb_eTypeError, "wait time unit must be a symbol");
+  }
+
+  id = SYM2ID(unit);
+  if (id != id_milliseconds && id != id_nanoseconds && id != id_seconds) {
+    rb_raise(rb_eArgError, "wait time unit must be :milliseconds, :nanoseconds or :seconds");
+  }
+
+  wait_time_unit = id;
+  return unit;
+}
+
+VALUE
+semian_resource_get_key_hash(VALUE klass)
+{
+  return ID2SYM(get_ipc_key_hash() == SEMIAN_KEY_HASH_FNV1A ? id_fnv1a : id_sha1);
+}
+
+VALUE
+semian_resource_set_key_hash(VALUE klass, VALUE hash)
+{
+  if (hash == ID2SYM(id_sha1)) {
+    set_ipc_key_hash(SEMIAN_KEY_HASH_SHA1);
+  } else if (hash == ID2SYM(id_fnv1a)) {
+    set_ipc_key_hash(SEMIAN_KEY_HASH_FNV1A);
+  } else {
+    rb_raise(rb_eArgError, "key hash must be :sha1 or :fnv1a");
+  }
+  return hash;
 }
 
 VALUE
@@ -86,16 +482,28 @@ semian_resource_destroy(VALUE self)
 
   TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
 
+  release_resource_stats(res);
+  if (res->pool.shm) {
+    // The set is shared with the other resources of the pool, only reset this resource's slot,
+    // and only once no other worker uses it
+    detach_shm_tickets(res, reset_resource_pool_slot(res));
+    return Qtrue;
+  }
+
   // Prevent a race to deletion
   if (perform_semop(res->sem_id, SI_SEM_LOCK, -1, 0, &ts) == -1) {
     if (errno == EINVAL || errno == EIDRM) {
+      forget_semaphore_set(res->name);
       return Qtrue;
     }
   }
 
+  detach_shm_tickets(res, 1);
+
   if (semctl(res->sem_id, SI_NUM_SEMAPHORES, IPC_RMID) == -1) {
     raise_semian_syscall_error("semctl()", errno);
   }
+  forget_semaphore_set(res->name);
 
   return Qtrue;
 }
@@ -108,10 +516,10 @@ semian_resource_reset_workers(VALUE self)
 
   TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
 
-  sem_meta_lock(res->sem_id);
+  sem_meta_lock(res->sem_id, res->sem_base);
   // This SETVAL will purge the SEM_UNDO table
-  ret = semctl(res->sem_id, SI_SEM_REGISTERED_WORKERS, SETVAL, 0);
-  sem_meta_unlock(res->sem_id);
+  ret = semctl(res->sem_id, res->sem_base + SI_SEM_REGISTERED_WORKERS, SETVAL, 0);
+  sem_meta_unlock(res->sem_id, res->sem_base);
 
   if (ret == -1) {
     raise_semian_syscall_error("semctl()", errno);
@@ -120,6 +528,27 @@ semian_resource_reset_workers(VALUE self)
   return Qtrue;
 }
 
+VALUE
+semian_resource_register_workers(VALUE klass, VALUE resources)
+{
+  semian_resource_t **res;
+  VALUE res_buf;
+  long i, count, registered;
+
+  Check_Type(resources, T_ARRAY);
+  count = RARRAY_LEN(resources);
+  res = ALLOCV_N(semian_resource_t *, res_buf, count);
+  for (i = 0; i < count; i++) {
+    TypedData_Get_Struct(RARRAY_AREF(resources, i), semian_resource_t, &semian_resource_type, res[i]);
+  }
+
+  registered = register_semaphore_workers(res, count);
+  ALLOCV_END(res_buf);
+  RB_GC_GUARD(resources);
+
+  return LONG2NUM(registered);
+}
+
 VALUE
 semian_resource_unregister_worker(VALUE self)
 {
@@ -128,9 +557,14 @@ semian_resource_unregister_worker(VALUE self)
 
   TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
 
-  sem_meta_lock(res->sem_id);
-  ret = perform_semop(res->sem_id, SI_SEM_REGISTERED_WORKERS, -1, IPC_NOWAIT | SEM_UNDO, NULL);
-  sem_meta_unlock(res->sem_id);
+  // Preloaded, and no process registered for it since
+  if (res->registered_pid == 0) {
+    return Qtrue;
+  }
+
+  sem_meta_lock(res->sem_id, res->sem_base);
+  ret = perform_semop(res->sem_id, res->sem_base + SI_SEM_REGISTERED_WORKERS, -1, IPC_NOWAIT | SEM_UNDO, NULL);
+  sem_meta_unlock(res->sem_id, res->sem_base);
 
   if ( ret == -1) {
     // Allow EAGAIN with IPC_NOWAIT, as this signals that all workers were unregistered
@@ -150,7 +584,11 @@ semian_resource_count(VALUE self)
   semian_resource_t *res = NULL;
 
   TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
-  ret = semctl(res->sem_id, SI_SEM_TICKETS, GETVAL);
+  if (res->shm_tickets) {
+    return LONG2FIX(get_shm_ticket_count(res));
+  }
+
+  ret = semctl(res->sem_id, res->sem_base + SI_SEM_TICKETS, GETVAL);
   if (ret == -1) {
     raise_semian_syscall_error("semctl()", errno);
   }
@@ -165,7 +603,7 @@ semian_resource_tickets(VALUE self)
   semian_resource_t *res = NULL;
 
   TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
-  ret = semctl(res->sem_id, SI_SEM_CONFIGURED_TICKETS, GETVAL);
+  ret = semctl(res->sem_id, res->sem_base + SI_SEM_CONFIGURED_TICKETS, GETVAL);
   if (ret == -1) {
     raise_semian_syscall_error("semctl()", errno);
   }
@@ -173,6 +611,43 @@ semian_resource_tickets(VALUE self)
   return LONG2FIX(ret);
 }
 
+VALUE
+semian_resource_scale_tickets(VALUE self, VALUE factor, VALUE increment, VALUE min_tickets, VALUE max_tickets)
+{
+  scale_tickets_args_t args = { 0 };
+  semian_resource_t *res = NULL;
+  int state = 0;
+
+  TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
+  if (TYPE(factor) != T_FLOAT && TYPE(factor) != T_FIXNUM) {
+    rb_raise(rb_eTypeError, "expected numeric type for factor");
+  }
+  if (NUM2DBL(factor) < 0) {
+    rb_raise(rb_eArgError, "factor must be non-negative");
+  }
+  Check_Type(increment, T_FIXNUM);
+
+  args.sem_id = res->sem_id;
+  args.sem_base = res->sem_base;
+  args.factor = NUM2DBL(factor);
+  args.increment = FIX2INT(increment);
+  args.min_tickets = check_ticket_bound_arg(min_tickets, "min_tickets");
+  args.max_tickets = check_ticket_bound_arg(max_tickets, "max_tickets");
+  args.shm_tickets = res->shm_tickets;
+  if (args.min_tickets > args.max_tickets) {
+    rb_raise(rb_eArgError, "min_tickets must not be greater than max_tickets");
+  }
+
+  sem_meta_lock(res->sem_id, res->sem_base);
+  rb_protect(scale_tickets, (VALUE) &args, &state);
+  sem_meta_unlock(res->sem_id, res->sem_base);
+  if (state) {
+    rb_jump_tag(state);
+  }
+
+  return INT2FIX(args.tickets);
+}
+
 VALUE
 semian_resource_workers(VALUE self)
 {
@@ -180,7 +655,7 @@ semian_resource_workers(VALUE self)
   semian_resource_t *res = NULL;
 
   TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
-  ret = semctl(res->sem_id, SI_SEM_REGISTERED_WORKERS, GETVAL);
+  ret = semctl(res->sem_id, res->sem_base + SI_SEM_REGISTERED_WORKERS, GETVAL);
   if (ret == -1) {
     raise_semian_syscall_error("semctl()", errno);
   }
@@ -196,6 +671,50 @@ semian_resource_id(VALUE self)
   return LONG2FIX(res->sem_id);
 }
 
+VALUE
+semian_resource_set_circuit_state(VALUE self, VALUE state)
+{
+  semian_resource_t *res = NULL;
+  TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
+  record_stats_circuit_state(res->stats, state);
+  return state;
+}
+
+VALUE
+semian_resource_wait_time_histogram(VALUE self)
+{
+  semian_resource_t *res = NULL;
+  TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
+  return histogram_to_hash(res->wait_time_histogram);
+}
+
+VALUE
+semian_resource_duration_histograms(VALUE self)
+{
+  semian_resource_t *res = NULL;
+  VALUE hash = rb_hash_new();
+  VALUE unscoped;
+  int i;
+
+  TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
+  unscoped = histogram_to_hash(&res->duration_histograms->unscoped);
+  if (RHASH_SIZE(unscoped) > 0) {
+    rb_hash_aset(hash, Qnil, unscoped);
+  }
+  for (i = 0; i < SEMIAN_MAX_DURATION_SCOPES && res->duration_histograms->scopes[i] != 0; i++) {
+    rb_hash_aset(hash, res->duration_histograms->scopes[i], histogram_to_hash(&res->duration_histograms->histograms[i]));
+  }
+  return hash;
+}
+
+VALUE
+semian_resource_dropped_durations(VALUE self)
+{
+  semian_resource_t *res = NULL;
+  TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
+  return ULL2NUM(res->duration_histograms->dropped);
+}
+
 VALUE
 semian_resource_key(VALUE self)
 {
@@ -205,14 +724,22 @@ semian_resource_key(VALUE self)
 }
 
 VALUE
-semian_resource_initialize(VALUE self, VALUE id, VALUE tickets, VALUE quota, VALUE permissions, VALUE default_timeout)
+semian_resource_initialize(VALUE self, VALUE id, VALUE tickets, VALUE quota, VALUE permissions, VALUE default_timeout, VALUE options)
 {
   long c_permissions;
   double c_timeout;
   double c_quota;
   int c_tickets;
+  int c_shm_tickets;
+  int c_pool_capacity;
+  int c_adaptive;
+  int c_reserved_tickets;
+  int c_max_queue;
+  int c_scope_tickets[SEMIAN_MAX_SCOPE_LIMITS] = { 0 };
+  int c_scoped;
   semian_resource_t *res = NULL;
   const char *c_id_str = NULL;
+  const char *c_pool_name = NULL;
 
   // Check and cast arguments
   check_tickets_xor_quota_arg(tickets, quota);
@@ -221,18 +748,45 @@ semian_resource_initialize(VALUE self, VALUE id, VALUE tickets, VALUE quota, VAL
   c_permissions = check_permissions_arg(permissions);
   c_id_str = check_id_arg(id);
   c_timeout = check_default_timeout_arg(default_timeout);
+  c_shm_tickets = check_ticket_backend_arg(options);
+  c_pool_name = check_resource_pool_arg(options, &c_pool_capacity);
+  c_adaptive = RTEST(rb_hash_aref(options, ID2SYM(id_adaptive_tickets)));
+  c_reserved_tickets = check_reserved_tickets_arg(options);
+  c_max_queue = check_max_queue_arg(options);
 
   // Build semian resource structure
   TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
+  c_scoped = check_scope_tickets_arg(options, res, c_scope_tickets);
+  if (c_scoped && c_shm_tickets) {
+    rb_raise(rb_eArgError, "scope_tickets require the :sysv ticket backend");
+  }
+  if (c_scoped && c_pool_name) {
+    rb_raise(rb_eArgError, "scope_tickets can't be combined with a resource_pool");
+  }
+  if ((c_max_queue > 0 || RTEST(rb_hash_aref(options, ID2SYM(id_fifo)))) && !c_shm_tickets) {
+    rb_raise(rb_eArgError, "fifo and max_queue require the :shm ticket backend");
+  }
 
   // Populate struct fields
-  ms_to_timespec(c_timeout * 1000, &res->timeout);
+  seconds_to_timespec(c_timeout, &res->timeout);
   res->name = strdup(c_id_str);
   res->quota = c_quota;
   res->wait_time = -1;
+  res->reserved_tickets = c_reserved_tickets;
+  res->max_queue = c_max_queue;
+  // A bounded number of waiters needs them to stand in line
+  res->fifo = RTEST(rb_hash_aref(options, ID2SYM(id_fifo))) || c_max_queue > 0;
+  res->early_fail = RTEST(rb_hash_aref(options, ID2SYM(id_early_fail)));
+
+  // Stats are attached first, so that shared memory tickets reaped while attaching are subtracted
+  if (RTEST(rb_hash_aref(options, ID2SYM(id_stats)))) {
+    attach_resource_stats(res, c_permissions);
+  }
 
   // Initialize the semaphore set
-  initialize_semaphore_set(res, c_id_str, c_permissions, c_tickets, c_quota);
+  initialize_semaphore_set(res, c_id_str, c_permissions, c_tickets, c_quota, c_shm_tickets, c_pool_name, c_pool_capacity, c_adaptive,
+                           !RTEST(rb_hash_aref(options, ID2SYM(id_preload))), c_scoped ? c_scope_tickets : NULL);
+  publish_stats_semaphore_set(res);
 
   return self;
 }
@@ -242,6 +796,8 @@ semian_resource_alloc(VALUE klass)
 {
   semian_resource_t *res;
   VALUE obj = TypedData_Make_Struct(klass, semian_resource_t, &semian_resource_type, res);
+  res->wait_time_histogram = ZALLOC(semian_histogram_t);
+  res->duration_histograms = ZALLOC(semian_duration_histograms_t);
   return obj;
 }
 
@@ -251,17 +807,350 @@ semian_resource_in_use(VALUE self)
   return Qtrue;
 }
 
+// Takes the copy of the resource the ticket was acquired with, which knows the scope it was acquired for
 static VALUE
-cleanup_semian_resource_acquire(VALUE self)
+cleanup_semian_resource_acquire(VALUE p)
 {
-  semian_resource_t *res = NULL;
-  TypedData_Get_Struct(self, semian_resource_t, &semian_resource_type, res);
-  if (perform_semop(res->sem_id, SI_SEM_TICKETS, 1, SEM_UNDO, NULL) == -1) {
+  semian_resource_t *res = (semian_resource_t *) p;
+  struct timespec now;
+
+  if (res->duration_histogram) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record_histogram_interval(res->duration_histogram, &res->acquired_at, &now);
+  }
+  record_stats_released(res->stats);
+  if (res->shm_tickets) {
+    release_shm_ticket(res);
+  } else if (release_semaphore(res) == -1) {
     res->error = errno;
   }
   return Qnil;
 }
 
+static int
+try_acquire_ticket(semian_resource_t *res)
+{
+  if (res->shm_tickets) {
+    return try_acquire_shm_ticket(res);
+  }
+  return try_acquire_semaphore(res);
+}
+
+static void
+acquire_ticket(semian_resource_t *res)
+{
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+  VALUE scheduler = rb_fiber_scheduler_current();
+  if (!NIL_P(scheduler)) {
+    /* let the other fibers of the thread run while waiting */
+    acquire_with_fiber_scheduler(res, scheduler);
+  } else
+#endif
+  if (res->shm_tickets) {
+    /* only releases the GVL if no tickets are left */
+    acquire_shm_ticket(res);
+  } else {
+    /* release the GVL to acquire the semaphore */
+    acquire_semaphore_without_gvl(res);
+  }
+}
+
+// Takes a free ticket right away, otherwise only waits for one if it is expected within the timeout.
+// Sets res->error to ETIME if it isn't.
+static void
+acquire_ticket_or_fail_early(semian_resource_t *self_res, semian_resource_t *res)
+{
+  if (try_acquire_ticket(res)) {
+    res->wait_time = 0;
+    record_histogram_value(res->wait_time_histogram, 0);
+  } else if (res->error == 0) {
+    if (expects_wait_past_timeout(self_res, res)) {
+      res->error = ETIME;
+    } else {
+      acquire_ticket(res);
+      record_expected_wait(self_res, res);
+    }
+  }
+}
+
+static int
+expects_wait_past_timeout(semian_resource_t *self_res, semian_resource_t *res)
+{
+  struct timespec now;
+  long now_ns, expected_wait, expected_wait_at;
+
+  expected_wait = __atomic_load_n(&self_res->expected_wait, __ATOMIC_RELAXED);
+  if (expected_wait <= res->timeout.tv_sec * NANOSECONDS_IN_SECOND + res->timeout.tv_nsec) {
+    return 0;
+  }
+
+  // Callers failing early don't update the estimate, so once nobody waited for as long as it,
+  // a single caller waits again to find out if it still holds
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  now_ns = now.tv_sec * NANOSECONDS_IN_SECOND + now.tv_nsec;
+  expected_wait_at = __atomic_load_n(&self_res->expected_wait_at, __ATOMIC_RELAXED);
+  if (now_ns - expected_wait_at > expected_wait &&
+      __atomic_compare_exchange_n(&self_res->expected_wait_at, &expected_wait_at, now_ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    return 0;
+  }
+  return 1;
+}
+
+// Adds the wait of a caller that found no free ticket to the moving average. Timed out waits
+// count for twice the timeout, since they would have lasted longer, and the average can then
+// grow past the timeout of the next callers.
+static void
+record_expected_wait(semian_resource_t *self_res, semian_resource_t *res)
+{
+  struct timespec now;
+  long sample, expected_wait;
+
+  if (res->error == 0) {
+    sample = res->wait_time;
+  } else if (res->error == EAGAIN) {
+    sample = 2 * (res->timeout.tv_sec * NANOSECONDS_IN_SECOND + res->timeout.tv_nsec);
+  } else {
+    return;
+  }
+
+  expected_wait = __atomic_load_n(&self_res->expected_wait, __ATOMIC_RELAXED);
+  expected_wait += (sample - expected_wait) >> EXPECTED_WAIT_SHIFT;
+  __atomic_store_n(&self_res->expected_wait, expected_wait, __ATOMIC_RELAXED);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  __atomic_store_n(&self_res->expected_wait_at, now.tv_sec * NANOSECONDS_IN_SECOND + now.tv_nsec, __ATOMIC_RELAXED);
+}
+
+// Shortens the timeout of the acquire to the time left until the deadline, a CLOCK_MONOTONIC time in seconds
+static void
+apply_deadline_arg(semian_resource_t *res, VALUE deadline)
+{
+  struct timespec now, left;
+  double seconds_left;
+
+  if (NIL_P(deadline)) {
+    return;
+  }
+  if (TYPE(deadline) != T_FLOAT && TYPE(deadline) != T_FIXNUM) {
+    rb_raise(rb_eArgError, "deadline parameter must be numeric");
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  seconds_left = NUM2DBL(deadline) - (now.tv_sec + now.tv_nsec / 1e9);
+  seconds_to_timespec(seconds_left > 0 ? seconds_left : 0, &left);
+  if (left.tv_sec < res->timeout.tv_sec || (left.tv_sec == res->timeout.tv_sec && left.tv_nsec < res->timeout.tv_nsec)) {
+    res->timeout = left;
+  }
+}
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+typedef struct {
+  VALUE scheduler;
+  long sleep_ns;
+} scheduler_sleep_args_t;
+
+static VALUE
+sleep_with_fiber_scheduler(VALUE p)
+{
+  scheduler_sleep_args_t *args = (scheduler_sleep_args_t *) p;
+  return rb_fiber_scheduler_kernel_sleep(args->scheduler, DBL2NUM(args->sleep_ns / 1e9));
+}
+
+static void
+acquire_with_fiber_scheduler(semian_resource_t *res, VALUE scheduler)
+{
+  scheduler_sleep_args_t args = { scheduler, SCHEDULER_POLL_MIN_NS };
+  struct timespec begin, now;
+  long timeout_ns, elapsed_ns;
+  uint32_t number = 0;
+  int in_line = res->shm_tickets && res->fifo;
+  int state = 0;
+
+  res->wait_time = -1;
+  timeout_ns = res->timeout.tv_sec * NANOSECONDS_IN_SECOND + res->timeout.tv_nsec;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  // Take a place in the shared line like blocking callers do, so fifo and max_queue hold for fibers too
+  if (in_line && !join_shm_line(res, &number)) {
+    return;
+  }
+
+  // Semaphores and futexes can't be waited on by the scheduler's event loop, so poll for a
+  // ticket with backoff, sleeping through the scheduler so the thread's other fibers keep running
+  while (!(in_line ? try_acquire_shm_ticket_in_line(res, number) : try_acquire_ticket(res))) {
+    if (res->error != 0) {
+      return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ns = (now.tv_sec - begin.tv_sec) * NANOSECONDS_IN_SECOND + (now.tv_nsec - begin.tv_nsec);
+    if (elapsed_ns >= timeout_ns) {
+      if (in_line) {
+        leave_shm_line(res, number);
+      }
+      res->error = EAGAIN;
+      res->wait_time = elapsed_ns;
+      return;
+    }
+
+    if (args.sleep_ns > timeout_ns - elapsed_ns) {
+      args.sleep_ns = timeout_ns - elapsed_ns;
+    }
+    rb_protect(sleep_with_fiber_scheduler, (VALUE) &args, &state);
+    if (state) {
+      // The fiber was raised into while it slept, don't hold up the callers behind it
+      if (in_line) {
+        leave_shm_line(res, number);
+      }
+      rb_jump_tag(state);
+    }
+    args.sleep_ns = args.sleep_ns * 2 < SCHEDULER_POLL_MAX_NS ? args.sleep_ns * 2 : SCHEDULER_POLL_MAX_NS;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  res->wait_time = (now.tv_sec - begin.tv_sec) * NANOSECONDS_IN_SECOND + (now.tv_nsec - begin.tv_nsec);
+  record_histogram_interval(res->wait_time_histogram, &begin, &now);
+}
+#endif
+
+static VALUE
+cleanup_semian_resource_acquire_all(VALUE p)
+{
+  acquire_all_args_t *args = (acquire_all_args_t *) p;
+  long i;
+
+  for (i = 0; i < args->acquired; i++) {
+    record_stats_released(args->resources[i].stats);
+  }
+  release_acquired_resources(args);
+  return Qnil;
+}
+
+static void *
+acquire_all_without_gvl(void *p)
+{
+  acquire_all_args_t *args = (acquire_all_args_t *) p;
+  semian_resource_t *res;
+  struct timespec begin, now;
+  long timeout_ns, remaining_ns, colocated, i;
+
+  args->error = 0;
+  args->acquired = 0;
+  timeout_ns = args->timeout.tv_sec * NANOSECONDS_IN_SECOND + args->timeout.tv_nsec;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  while (args->acquired < args->count) {
+    res = &args->resources[args->acquired];
+
+    // All resources share a single deadline
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining_ns = timeout_ns - ((now.tv_sec - begin.tv_sec) * NANOSECONDS_IN_SECOND + (now.tv_nsec - begin.tv_nsec));
+    if (remaining_ns < 0) {
+      remaining_ns = 0;
+    }
+    res->timeout.tv_sec = remaining_ns / NANOSECONDS_IN_SECOND;
+    res->timeout.tv_nsec = remaining_ns % NANOSECONDS_IN_SECOND;
+
+    if (res->shm_tickets) {
+      acquire_shm_ticket_blocking(res);
+      if (res->error != 0) {
+        args->error = res->error;
+        break;
+      }
+      args->acquired++;
+      continue;
+    }
+
+    // Resources colocated in one semaphore set are acquired together in a single semop
+    colocated = count_colocated_resources(args, args->acquired);
+    for (i = 0; i < colocated; i++) {
+      args->sops[i].sem_num = args->resources[args->acquired + i].sem_base + SI_SEM_TICKETS;
+      args->sops[i].sem_op = -1;
+      args->sops[i].sem_flg = SEM_UNDO;
+    }
+    if (perform_semops(res->sem_id, args->sops, colocated, &res->timeout) == -1) {
+      args->error = errno;
+      break;
+    }
+    args->acquired += colocated;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  args->wait_time = (now.tv_sec - begin.tv_sec) * NANOSECONDS_IN_SECOND + (now.tv_nsec - begin.tv_nsec);
+  if (args->error == 0) {
+    // Every resource waited for the whole batch. Shared memory tickets recorded their own wait.
+    for (i = 0; i < args->count; i++) {
+      if (!args->resources[i].shm_tickets) {
+        record_histogram_interval(args->resources[i].wait_time_histogram, &begin, &now);
+      }
+    }
+  }
+  return NULL;
+}
+
+static void
+release_acquired_resources(acquire_all_args_t *args)
+{
+  semian_resource_t *res;
+  long released = 0, colocated, i;
+
+  while (released < args->acquired) {
+    res = &args->resources[released];
+    if (res->shm_tickets) {
+      release_shm_ticket(res);
+      released++;
+      continue;
+    }
+
+    colocated = count_colocated_resources(args, released);
+    if (colocated > args->acquired - released) {
+      colocated = args->acquired - released;
+    }
+    for (i = 0; i < colocated; i++) {
+      args->sops[i].sem_num = args->resources[released + i].sem_base + SI_SEM_TICKETS;
+      args->sops[i].sem_op = 1;
+      args->sops[i].sem_flg = SEM_UNDO;
+    }
+    perform_semops(res->sem_id, args->sops, colocated, NULL);
+    released += colocated;
+  }
+  args->acquired = 0;
+}
+
+static long
+count_colocated_resources(acquire_all_args_t *args, long start)
+{
+  long end = start + 1;
+
+  while (end < args->count && !args->resources[end].shm_tickets &&
+         args->resources[end].sem_id == args->resources[start].sem_id) {
+    end++;
+  }
+  return end - start;
+}
+
+static int
+compare_resources_by_semaphore_set(const void *a, const void *b)
+{
+  const semian_resource_t *res_a = (const semian_resource_t *) a;
+  const semian_resource_t *res_b = (const semian_resource_t *) b;
+
+  if (res_a->sem_id != res_b->sem_id) {
+    return res_a->sem_id < res_b->sem_id ? -1 : 1;
+  }
+  // Keep the shared memory backed resources of a set apart from the ones issuing SysV tickets
+  return res_a->shm_tickets != NULL ? (res_b->shm_tickets != NULL ? 0 : 1) : (res_b->shm_tickets != NULL ? -1 : 0);
+}
+
+static double
+check_timeout_arg(VALUE timeout)
+{
+  if (TYPE(timeout) != T_FLOAT && TYPE(timeout) != T_FIXNUM) {
+    rb_raise(rb_eArgError, "timeout parameter must be numeric");
+  }
+  return NUM2DBL(timeout);
+}
+
 static long
 check_permissions_arg(VALUE permissions)
 {
@@ -349,11 +1238,211 @@ check_default_timeout_arg(VALUE default_timeout)
   return NUM2DBL(default_timeout);
 }
 
+static int
+check_ticket_backend_arg(VALUE options)
+{
+  VALUE backend;
+
+  Check_Type(options, T_HASH);
+  backend = rb_hash_aref(options, ID2SYM(id_ticket_backend));
+  if (NIL_P(backend) || backend == ID2SYM(id_sysv)) {
+    return 0;
+  } else if (backend == ID2SYM(id_shm)) {
+    return 1;
+  }
+  rb_raise(rb_eArgError, "ticket_backend must be one of :sysv or :shm");
+}
+
+static const char *
+check_resource_pool_arg(VALUE options, int *capacity)
+{
+  VALUE pool, pool_capacity;
+  int max_capacity;
+
+  *capacity = 0;
+  pool = rb_hash_aref(options, ID2SYM(id_resource_pool));
+  if (NIL_P(pool)) {
+    return NULL;
+  }
+  Check_Type(pool, T_STRING);
+
+  pool_capacity = rb_hash_aref(options, ID2SYM(id_resource_pool_capacity));
+  Check_Type(pool_capacity, T_FIXNUM);
+  *capacity = FIX2INT(pool_capacity);
+  // The set can't hold more than the system's SEMMSL semaphores, addressed with the unsigned short
+  // semaphore numbers of semop
+  max_capacity = (system_max_semaphores_per_set < USHRT_MAX ? system_max_semaphores_per_set : USHRT_MAX) / SI_NUM_SEMAPHORES - 1;
+  if (*capacity < 1 || *capacity > max_capacity) {
+    rb_raise(rb_eArgError, "resource_pool_capacity must be between 1 and %d", max_capacity);
+  }
+
+  return StringValueCStr(pool);
+}
+
+static int
+check_ticket_bound_arg(VALUE bound, const char *name)
+{
+  Check_Type(bound, T_FIXNUM);
+  if (FIX2LONG(bound) < 1 || FIX2LONG(bound) > system_max_semaphore_count) {
+    rb_raise(rb_eArgError, "%s must be between 1 and %d", name, system_max_semaphore_count);
+  }
+  return FIX2INT(bound);
+}
+
+static int
+check_reserved_tickets_arg(VALUE options)
+{
+  VALUE reserved_tickets = rb_hash_aref(options, ID2SYM(id_reserved_tickets));
+
+  if (NIL_P(reserved_tickets)) {
+    return 0;
+  }
+  Check_Type(reserved_tickets, T_FIXNUM);
+  // Low priority callers take one ticket more than the reserve from a semaphore, which holds at most a short
+  if (FIX2LONG(reserved_tickets) < 0 || FIX2LONG(reserved_tickets) >= system_max_semaphore_count) {
+    rb_raise(rb_eArgError, "reserved_tickets must be a non-negative value and less than %d", system_max_semaphore_count);
+  }
+  return FIX2INT(reserved_tickets);
+}
+
+static int
+check_priority_arg(VALUE priority, int reserved_tickets)
+{
+  if (NIL_P(priority) || priority == ID2SYM(id_high)) {
+    return 0;
+  } else if (priority == ID2SYM(id_low)) {
+    return reserved_tickets;
+  }
+  rb_raise(rb_eArgError, "priority must be one of :high or :low");
+}
+
+static int
+check_max_queue_arg(VALUE options)
+{
+  VALUE max_queue = rb_hash_aref(options, ID2SYM(id_max_queue));
+
+  if (NIL_P(max_queue)) {
+    return 0;
+  }
+  Check_Type(max_queue, T_FIXNUM);
+  if (FIX2LONG(max_queue) < 1 || FIX2LONG(max_queue) > SEMIAN_SHM_MAX_QUEUE) {
+    rb_raise(rb_eArgError, "max_queue must be between 1 and %d", SEMIAN_SHM_MAX_QUEUE);
+  }
+  return FIX2INT(max_queue);
+}
+
+// Maps the scopes of the scope_tickets hash to the slots of res->scopes, and their sub-limits to scope_tickets.
+// Returns true if there are any.
+static int
+check_scope_tickets_arg(VALUE options, semian_resource_t *res, int *scope_tickets)
+{
+  VALUE hash = rb_hash_aref(options, ID2SYM(id_scope_tickets));
+  VALUE args[] = { (VALUE) res, (VALUE) scope_tickets };
+
+  if (NIL_P(hash)) {
+    return 0;
+  }
+  Check_Type(hash, T_HASH);
+  if (RHASH_SIZE(hash) < 1 || RHASH_SIZE(hash) > SEMIAN_MAX_SCOPE_LIMITS) {
+    rb_raise(rb_eArgError, "scope_tickets must limit between 1 and %d scopes", SEMIAN_MAX_SCOPE_LIMITS);
+  }
+  memset(res->scopes, 0, sizeof(res->scopes));
+  rb_hash_foreach(hash, check_scope_ticket_arg, (VALUE) args);
+  return 1;
+}
+
+static int
+check_scope_ticket_arg(VALUE scope, VALUE tickets, VALUE arg)
+{
+  semian_resource_t *res = (semian_resource_t *) ((VALUE *) arg)[0];
+  int *scope_tickets = (int *) ((VALUE *) arg)[1];
+  int slot = 0;
+
+  Check_Type(scope, T_SYMBOL);
+  Check_Type(tickets, T_FIXNUM);
+  if (FIX2LONG(tickets) < 1 || FIX2LONG(tickets) > system_max_semaphore_count) {
+    rb_raise(rb_eArgError, "scope tickets must be between 1 and %d", system_max_semaphore_count);
+  }
+
+  while (res->scopes[slot] != 0) {
+    slot++;
+  }
+  res->scopes[slot] = SYM2ID(scope);
+  scope_tickets[slot] = FIX2INT(tickets);
+  return ST_CONTINUE;
+}
+
+// Returns the semaphore of the sub-limit of a scope, or 0 if its tickets aren't limited
+static unsigned short
+scope_semaphore(semian_resource_t *res, VALUE scope)
+{
+  int i;
+
+  if (!SYMBOL_P(scope)) {
+    return 0;
+  }
+  for (i = 0; i < SEMIAN_MAX_SCOPE_LIMITS && res->scopes[i] != 0; i++) {
+    if (res->scopes[i] == SYM2ID(scope)) {
+      return res->sem_base + SI_SEM_SCOPE_TICKETS_0 + i;
+    }
+  }
+  return 0;
+}
+
+// Slots are claimed by the first call of each scope. Claiming holds the GVL, so it doesn't race
+// with other threads. Returns NULL and counts the call as dropped for scopes that aren't symbols,
+// or once every slot is taken.
+static semian_histogram_t *
+scope_duration_histogram(semian_duration_histograms_t *histograms, VALUE scope)
+{
+  int i;
+
+  if (NIL_P(scope)) {
+    return &histograms->unscoped;
+  }
+
+  for (i = 0; SYMBOL_P(scope) && i < SEMIAN_MAX_DURATION_SCOPES; i++) {
+    if (histograms->scopes[i] == 0) {
+      // Only pin the symbols that claim a slot, so ad-hoc scopes can still be collected
+      SYM2ID(scope);
+      histograms->scopes[i] = scope;
+    }
+    if (histograms->scopes[i] == scope) {
+      return &histograms->histograms[i];
+    }
+  }
+  histograms->dropped++;
+  return NULL;
+}
+
+// Times the block from here, the ticket was just acquired, to its release by cleanup_semian_resource_acquire
+static VALUE
+yield_holding_ticket(semian_resource_t *res, VALUE wait_time)
+{
+  clock_gettime(CLOCK_MONOTONIC, &res->acquired_at);
+  return rb_ensure(rb_yield, wait_time, cleanup_semian_resource_acquire, (VALUE) res);
+}
+
 static void
-ms_to_timespec(long ms, struct timespec *ts)
+seconds_to_timespec(double seconds, struct timespec *ts)
 {
-  ts->tv_sec = ms / 1000;
-  ts->tv_nsec = (ms % 1000) * 1000000;
+  ts->tv_sec = (time_t) seconds;
+  ts->tv_nsec = (long) ((seconds - ts->tv_sec) * 1e9 + 0.5);
+  if (ts->tv_nsec >= NANOSECONDS_IN_SECOND) {
+    ts->tv_sec += 1;
+    ts->tv_nsec -= NANOSECONDS_IN_SECOND;
+  }
+}
+
+static VALUE
+wait_time_to_value(long wait_time_ns)
+{
+  if (wait_time_unit == id_nanoseconds) {
+    return LONG2NUM(wait_time_ns);
+  } else if (wait_time_unit == id_seconds) {
+    return DBL2NUM(wait_time_ns / 1e9);
+  }
+  return LONG2NUM(wait_time_ns / 1000000);
 }
 
 static inline void
@@ -366,17 +1455,21 @@ static inline void
 semian_resource_free(void *ptr)
 {
   semian_resource_t *res = (semian_resource_t *) ptr;
+  detach_shm_tickets(res, 0);
+  detach_resource_pool(res);
   if (res->name) {
     free(res->name);
     res->name = NULL;
   }
+  xfree(res->wait_time_histogram);
+  xfree(res->duration_histograms);
   xfree(res);
 }
 
 static inline size_t
 semian_resource_memsize(const void *ptr)
 {
-  return sizeof(semian_resource_t);
+  return sizeof(semian_resource_t) + sizeof(semian_histogram_t) + sizeof(semian_duration_histograms_t);
 }
 
 static const rb_data_type_t
@@ -389,3 +1482,55 @@ semian_resource_type = {
   },
   NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
 };
+
+static void
+semian_lease_mark(void *ptr)
+{
+  semian_lease_t *lease = (semian_lease_t *) ptr;
+  rb_gc_mark(lease->resource);
+}
+
+static void
+semian_lease_free(void *ptr)
+{
+  semian_lease_t *lease = (semian_lease_t *) ptr;
+
+  // A lease collected without being released gives its ticket back. The resource may be freed by
+  // the same collection, so only the lease's own mapping of the tickets segment is used.
+  if (lease->pid == getpid()) {
+    record_stats_released(lease->res.stats);
+    if (lease->res.shm_tickets) {
+      release_shm_ticket(&lease->res);
+    } else {
+      release_semaphore(&lease->res);
+    }
+  }
+  detach_shared_memory(lease->shm_tickets);
+  xfree(lease);
+}
+
+static size_t
+semian_lease_memsize(const void *ptr)
+{
+  return sizeof(semian_lease_t);
+}
+
+static const rb_data_type_t
+semian_lease_type = {
+  "semian_lease",
+  {
+    semian_lease_mark,
+    semian_lease_free,
+    semian_lease_memsize
+  },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+VALUE
+semian_lease_alloc(VALUE klass)
+{
+  semian_lease_t *lease;
+  VALUE obj = TypedData_Make_Struct(klass, semian_lease_t, &semian_lease_type, lease);
+  lease->resource = Qnil;
+  return obj;
+}
@@ -12,20 +12,64 @@ Functions here are associated with rubyland operations.
 // Ruby variables
 extern ID id_wait_time;
 extern ID id_timeout;
+extern ID id_ticket_backend;
+extern ID id_sysv;
+extern ID id_shm;
+extern ID id_resource_pool;
+extern ID id_resource_pool_capacity;
+extern ID id_adaptive_tickets;
+extern ID id_reserved_tickets;
+extern ID id_priority;
+extern ID id_fifo;
+extern ID id_max_queue;
+extern ID id_scope;
+extern ID id_scope_tickets;
+extern ID id_deadline;
+extern ID id_early_fail;
+extern ID id_stats;
+extern ID id_preload;
+extern ID id_sha1;
+extern ID id_fnv1a;
+extern ID id_high;
+extern ID id_low;
+extern ID id_milliseconds;
+extern ID id_nanoseconds;
+extern ID id_seconds;
+extern VALUE cLease;
 extern int system_max_semaphore_count;
+extern int system_max_semaphores_per_set;
 
 /*
  * call-seq:
- *    Semian::Resource.new(id, tickets, quota, permissions, default_timeout) -> resource
+ *    Semian::Resource.new(id, tickets, quota, permissions, default_timeout, options) -> resource
  *
  * Creates a new Resource. Do not create resources directly. Use Semian.register.
+ *
+ * The <code>ticket_backend</code> option selects where tickets are issued from, either
+ * <code>:sysv</code> (the default) or <code>:shm</code> for the shared memory ticket backend.
+ *
+ * The <code>reserved_tickets</code> option sets how many tickets are only available to
+ * <code>:high</code> priority callers of acquire.
+ *
+ * The <code>resource_pool</code> option names a resource pool to allocate the resource's semaphores
+ * from, which holds at most <code>resource_pool_capacity</code> resources. Otherwise, the resource
+ * gets a semaphore set of its own.
+ *
+ * The <code>scope_tickets</code> option limits the tickets callers of acquire passing some
+ * <code>scope</code> may hold at once, by scope. At most 2 scopes may be limited.
+ *
+ * The <code>early_fail</code> option makes acquire fail right away when no ticket is free and the
+ * callers that had to wait recently waited longer than its timeout.
+ *
+ * The <code>preload</code> option prepares the semaphore set without registering the current process
+ * as a worker, for processes forked later to register with Semian::Resource.register_workers.
  */
 VALUE
-semian_resource_initialize(VALUE self, VALUE id, VALUE tickets, VALUE quota, VALUE permissions, VALUE default_timeout);
+semian_resource_initialize(VALUE self, VALUE id, VALUE tickets, VALUE quota, VALUE permissions, VALUE default_timeout, VALUE options);
 
 /*
  * call-seq:
- *    resource.acquire(timeout: default_timeout) { ... }  -> result of the block
+ *    resource.acquire(scope = nil, timeout: default_timeout, priority: :high, deadline: nil) { ... }  -> result of the block
  *
  * Acquires a resource. The call will block for <code>timeout</code> seconds if a ticket
  * is not available. If no ticket is available within the timeout period, Semian::TimeoutError
@@ -33,10 +77,89 @@ semian_resource_initialize(VALUE self, VALUE id, VALUE tickets, VALUE quota, VAL
  *
  * If no timeout argument is provided, the default timeout passed to Semian.register will be used.
  *
+ * Callers with a <code>priority</code> of <code>:low</code> can't take the last
+ * <code>reserved_tickets</code> tickets, which are kept for <code>:high</code> priority
+ * callers (the default), so low priority traffic is shed first when the resource is busy.
+ *
+ * A <code>deadline</code>, in seconds of the monotonic clock, shortens the timeout to the time left
+ * until then.
+ *
+ * Callers passing a <code>scope</code> limited by <code>scope_tickets</code> also take one of the
+ * scope's tickets, in the same semop as the resource's ticket. The scope can be passed positionally,
+ * which unlike the <code>scope</code> keyword doesn't allocate. The time the block holds the ticket
+ * is recorded in the scope's duration histogram.
+ *
+ * Under a fiber scheduler, waiting for a ticket polls with backoff and sleeps through the
+ * scheduler instead of blocking the thread, so the other fibers of the thread keep running.
  */
 VALUE
 semian_resource_acquire(int argc, VALUE *argv, VALUE self);
 
+/*
+ * call-seq:
+ *    resource.try_acquire(scope = nil, priority: :high) { ... }  -> result of the block or false
+ *
+ * Acquires a resource if a ticket is available, without waiting and without releasing the GVL.
+ * Returns false without yielding if no ticket is available.
+ */
+VALUE
+semian_resource_try_acquire(int argc, VALUE *argv, VALUE self);
+
+/*
+ * call-seq:
+ *    Semian::Resource.acquire_all(resources, timeout: nil) { |wait_time| ... }  -> result of the block
+ *
+ * Acquires a ticket of every resource, then yields. Either all tickets are acquired, or
+ * none are and Semian::TimeoutError is raised once <code>timeout</code> seconds elapsed.
+ * Resources colocated in one semaphore set are acquired in a single semop, and resources
+ * are always acquired in the same order so callers can't deadlock each other.
+ *
+ * If no timeout argument is provided, the smallest default timeout of the resources is used.
+ */
+VALUE
+semian_resource_acquire_all(int argc, VALUE *argv, VALUE klass);
+
+/*
+ * call-seq:
+ *    Semian::Resource.wait_time_unit -> symbol
+ *
+ * Returns the unit of the wait times yielded by acquire and acquire_all.
+ */
+VALUE
+semian_resource_get_wait_time_unit(VALUE klass);
+
+/*
+ * call-seq:
+ *    Semian::Resource.wait_time_unit = unit
+ *
+ * Sets the unit of the wait times yielded by acquire and acquire_all, either
+ * <code>:milliseconds</code> (the default, as an Integer), <code>:nanoseconds</code>
+ * (as an Integer) or <code>:seconds</code> (as a Float).
+ */
+VALUE
+semian_resource_set_wait_time_unit(VALUE klass, VALUE unit);
+
+/*
+ * call-seq:
+ *    Semian::Resource.key_hash -> symbol
+ *
+ * Returns the hash function the keys of semaphore sets and shared memory segments are derived with.
+ */
+VALUE
+semian_resource_get_key_hash(VALUE klass);
+
+/*
+ * call-seq:
+ *    Semian::Resource.key_hash = hash
+ *
+ * Sets the hash function keys are derived with from resource names, either <code>:sha1</code>
+ * (the default) or <code>:fnv1a</code>, which is cheaper to compute. Resources only share their
+ * semaphores with processes using the same hash function, so it must be set before registering
+ * any resource, and changed on every process of a host at once.
+ */
+VALUE
+semian_resource_set_key_hash(VALUE klass, VALUE hash);
+
 /*
  * call-seq:
  *   resource.destroy() -> true
@@ -80,6 +203,18 @@ semian_resource_count(VALUE self);
 VALUE
 semian_resource_tickets(VALUE self);
 
+/*
+ * call-seq:
+ *    resource.scale_tickets(factor, increment, min_tickets, max_tickets) -> count
+ *
+ * Sets the configured number of tickets of every process using the resource to
+ * <code>(tickets * factor).floor + increment</code>, bounded by <code>min_tickets</code>
+ * and <code>max_tickets</code>, and returns the new count. Only free tickets are taken
+ * back when shrinking, so this never waits for tickets in use to be released.
+ */
+VALUE
+semian_resource_scale_tickets(VALUE self, VALUE factor, VALUE increment, VALUE min_tickets, VALUE max_tickets);
+
 /*
  * call-seq:
  *    resource.registered_workers -> count
@@ -111,6 +246,62 @@ semian_resource_id(VALUE self);
 VALUE
 semian_resource_key(VALUE self);
 
+/*
+ * call-seq:
+ *    resource.wait_time_histogram -> hash
+ *
+ * Returns how long acquiring the resource's tickets took, since the resource was created
+ * in this process. Keys are the exclusive upper bound of each non-empty bucket in
+ * microseconds, and buckets double in width, up to a last one keyed by Float::INFINITY.
+ * Only successful acquisitions are counted.
+ */
+VALUE
+semian_resource_wait_time_histogram(VALUE self);
+
+/*
+ * call-seq:
+ *    resource.duration_histograms -> hash
+ *
+ * Returns how long the blocks given to acquire and try_acquire held a ticket, by scope, since the
+ * resource was created in this process. Calls that raised are counted too. Each histogram is keyed
+ * like wait_time_histogram, calls without a scope are under nil, and at most 8 scopes are kept.
+ * The first 8 Symbol scopes to acquire the resource claim them, see dropped_durations.
+ */
+VALUE
+semian_resource_duration_histograms(VALUE self);
+
+/*
+ * call-seq:
+ *    resource.dropped_durations -> integer
+ *
+ * Returns how many calls duration_histograms left out, because their scope isn't a Symbol or
+ * arrived after every scope slot was claimed. A growing count means ad-hoc scopes may be taking
+ * the slots of the scopes the adapter uses.
+ */
+VALUE
+semian_resource_dropped_durations(VALUE self);
+
+/*
+ * call-seq:
+ *    resource.circuit_state = state -> state
+ *
+ * Publishes the state of the resource's circuit breaker, one of :closed, :open or :half_open,
+ * in the host's statistics. Does nothing for resources created without stats.
+ */
+VALUE
+semian_resource_set_circuit_state(VALUE self, VALUE state);
+
+/*
+ * call-seq:
+ *   Semian::Resource.register_workers(resources) -> count
+ *
+ * Registers the current process as a worker of every resource it isn't registered for yet, with
+ * a single semop per semaphore set, and configures the quota tickets of the sets that have none yet.
+ * Returns the number of resources registered.
+ */
+VALUE
+semian_resource_register_workers(VALUE klass, VALUE resources);
+
 /*
  * call-seq:
  *   resource.unregister_worker() -> true
@@ -122,6 +313,52 @@ semian_resource_key(VALUE self);
 VALUE
 semian_resource_unregister_worker(VALUE self);
 
+/*
+ * call-seq:
+ *    resource.lease(scope = nil, timeout: default_timeout, priority: :high, deadline: nil) -> lease
+ *
+ * Takes a ticket like acquire, with the same options and errors, but holds it until
+ * lease.release is called rather than for the duration of a block. This fits calls that
+ * outlive the method starting them, like streams.
+ *
+ * The ticket is given back if the process dies, and if the lease is garbage collected
+ * without being released. A forked child doesn't hold the leases of its parent.
+ */
+VALUE
+semian_resource_lease(int argc, VALUE *argv, VALUE self);
+
+/*
+ * call-seq:
+ *    lease.release -> true or false
+ *
+ * Gives the ticket back. Returns false if the lease was already released, or was taken
+ * by another process.
+ */
+VALUE
+semian_lease_release(VALUE self);
+
+/*
+ * call-seq:
+ *    lease.released? -> true or false
+ *
+ * Returns true unless the lease holds a ticket for the current process.
+ */
+VALUE
+semian_lease_released(VALUE self);
+
+/*
+ * call-seq:
+ *    lease.wait_time -> wait_time
+ *
+ * Returns how long the lease waited for its ticket, in Resource.wait_time_unit.
+ */
+VALUE
+semian_lease_wait_time(VALUE self);
+
+// Allocate a released lease, for Semian::Resource::Lease.new
+VALUE
+semian_lease_alloc(VALUE klass);
+
 // Allocate a semian_resource_type struct for ruby memory management
 VALUE
 semian_resource_alloc(VALUE klass);
@@ -0,0 +1,125 @@
+#include "resource_pool.h"
+
+static void
+initialize_resource_pool(void *shm, void *arg);
+
+static int
+find_pool_slot(semian_resource_pool_t *pool, const char *name, int claim);
+
+key_t
+generate_pool_key(const char *pool_name, int capacity)
+{
+  char suffix[32];
+
+  // As for standalone sets, the number of semaphores must be part of the key
+  snprintf(suffix, sizeof(suffix), "_POOL_NUM_SEMS_%d", (capacity + 1) * SI_NUM_SEMAPHORES);
+  return generate_ipc_key(pool_name, suffix);
+}
+
+unsigned short
+attach_resource_pool(semian_resource_t *res, const char *name, const char *pool_name, int capacity, long permissions)
+{
+  semian_resource_pool_t *pool;
+  char suffix[64];
+  int slot;
+
+  if (strlen(name) >= SEMIAN_POOL_MAX_NAME) {
+    rb_raise(rb_eArgError, "resource names in a resource pool must be shorter than %d characters", SEMIAN_POOL_MAX_NAME);
+  }
+
+  snprintf(suffix, sizeof(suffix), "_POOL_INDEX_%d_%zu", capacity, sizeof(semian_pool_slot_t));
+  pool = attach_shared_memory_object(&res->pool, pool_name, suffix,
+                                     sizeof(semian_resource_pool_t) + sizeof(semian_pool_slot_t) * capacity,
+                                     permissions, initialize_resource_pool, &capacity);
+
+  // Resources that were registered before are found without taking the pool lock
+  slot = find_pool_slot(pool, name, 0);
+  if (slot == -1) {
+    sem_meta_lock(res->sem_id, 0);
+    slot = find_pool_slot(pool, name, 1);
+    sem_meta_unlock(res->sem_id, 0);
+  }
+
+  if (slot == -1) {
+    rb_raise(eInternal, "resource pool '%s' is full, it holds at most %d resources", pool_name, capacity);
+  }
+
+  // The first group of semaphores belongs to the pool
+  return (slot + 1) * SI_NUM_SEMAPHORES;
+}
+
+int
+reset_resource_pool_slot(semian_resource_t *res)
+{
+  int workers, registered = res->registered_pid == getpid();
+
+  sem_meta_lock(res->sem_id, res->sem_base);
+  workers = semctl(res->sem_id, res->sem_base + SI_SEM_REGISTERED_WORKERS, GETVAL);
+  if (workers > registered) {
+    // Other workers still use the resource, and must keep its tickets and their SEM_UNDO adjustments
+    if (registered && perform_semop(res->sem_id, res->sem_base + SI_SEM_REGISTERED_WORKERS, -1, IPC_NOWAIT | SEM_UNDO, NULL) == -1 &&
+        errno != EAGAIN) {
+      int error = errno;
+      sem_meta_unlock(res->sem_id, res->sem_base);
+      raise_semian_syscall_error("semop()", error);
+    }
+    res->registered_pid = 0;
+    sem_meta_unlock(res->sem_id, res->sem_base);
+    return 0;
+  }
+
+  if (workers == -1 ||
+      semctl(res->sem_id, res->sem_base + SI_SEM_TICKETS, SETVAL, 0) == -1 ||
+      semctl(res->sem_id, res->sem_base + SI_SEM_CONFIGURED_TICKETS, SETVAL, 0) == -1 ||
+      semctl(res->sem_id, res->sem_base + SI_SEM_REGISTERED_WORKERS, SETVAL, 0) == -1) {
+    int error = errno;
+    sem_meta_unlock(res->sem_id, res->sem_base);
+    raise_semian_syscall_error("semctl()", error);
+  }
+  res->registered_pid = 0;
+  sem_meta_unlock(res->sem_id, res->sem_base);
+  return 1;
+}
+
+void
+detach_resource_pool(semian_resource_t *res)
+{
+  detach_shared_memory(res->pool.shm);
+  res->pool.shm = NULL;
+}
+
+static void
+initialize_resource_pool(void *shm, void *arg)
+{
+  ((semian_resource_pool_t *) shm)->capacity = *(int *) arg;
+}
+
+// Claiming must be done with the pool lock held. Lookups without the lock only ever see
+// slots that are free, or fully claimed since the name is written before claimed is set.
+static int
+find_pool_slot(semian_resource_pool_t *pool, const char *name, int claim)
+{
+  uint32_t start = hash_fnv1a(FNV1A_OFFSET_BASIS, name) % pool->capacity;
+  semian_pool_slot_t *slot;
+  int i, index;
+
+  for (i = 0; i < pool->capacity; i++) {
+    index = (start + i) % pool->capacity;
+    slot = &pool->slots[index];
+
+    if (!__atomic_load_n(&slot->claimed, __ATOMIC_ACQUIRE)) {
+      if (!claim) {
+        return -1;
+      }
+      strncpy(slot->name, name, SEMIAN_POOL_MAX_NAME - 1);
+      __atomic_store_n(&slot->claimed, 1, __ATOMIC_RELEASE);
+      return index;
+    }
+
+    if (strncmp(slot->name, name, SEMIAN_POOL_MAX_NAME) == 0) {
+      return index;
+    }
+  }
+
+  return -1;
+}
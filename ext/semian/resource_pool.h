@@ -0,0 +1,39 @@
+/*
+For semian's resource pools
+
+A resource pool packs many resources into one large semaphore set, instead
+of creating a set per resource. Every resource in the pool is given a slot of
+SI_NUM_SEMAPHORES semaphores, laid out exactly like the set of a standalone
+resource, so the slot's own lock still serializes updates to its tickets.
+The first slot is reserved for the pool itself, its lock serializes claiming
+slots.
+
+Slots are claimed by name through an open-addressing index in shared memory,
+so looking up a resource that is already in the pool doesn't need a syscall.
+Slots are never handed back, a name keeps its slot for the lifetime of the pool.
+*/
+#ifndef SEMIAN_RESOURCE_POOL_H
+#define SEMIAN_RESOURCE_POOL_H
+
+#include "shared_memory.h"
+
+// Derive the key of a pool's semaphore set from its name and capacity
+key_t
+generate_pool_key(const char *pool_name, int capacity);
+
+// Attach the resource to its pool's index, claiming a slot for its name if it doesn't have one.
+// Must be called once the pool's semaphore set exists. Returns the slot's sem_base.
+unsigned short
+attach_resource_pool(semian_resource_t *res, const char *name, const char *pool_name, int capacity, long permissions);
+
+// Put the slot of the resource back in the state of a freshly created pool, without affecting the
+// other resources in the pool. If workers other than this process are still registered with the
+// resource, only unregisters this process instead. Returns whether the slot was reset.
+int
+reset_resource_pool_slot(semian_resource_t *res);
+
+// Detach from the pool's index
+void
+detach_resource_pool(semian_resource_t *res);
+
+#endif // SEMIAN_RESOURCE_POOL_H
@@ -1,4 +1,10 @@
 #include "semian.h"
+#include "integer.h"
+#include "request_window.h"
+#include "shm_tickets.h"
+#include "sliding_window.h"
+#include "state.h"
+#include "stats.h"
 
 VALUE eSyscall, eTimeout, eInternal;
 
@@ -19,6 +25,14 @@ void Init_semian()
    */
   cResource = rb_const_get(cSemian, rb_intern("Resource"));
 
+  /* Document-class: Semian::Resource::Lease
+   *
+   *  A ticket of a resource taken by Resource#lease, held until it's released. Tickets of a
+   *  process that dies are given back like those of acquire.
+   */
+  cLease = rb_const_get(cResource, rb_intern("Lease"));
+  rb_global_variable(&cLease);
+
   /* Document-class: Semian::SyscallError
    *
    * Represents a Semian error that was caused by an underlying syscall failure.
@@ -47,25 +61,75 @@ void Init_semian()
   rb_global_variable(&eInternal);
 
   rb_define_alloc_func(cResource, semian_resource_alloc);
-  rb_define_method(cResource, "initialize_semaphore", semian_resource_initialize, 5);
+  rb_define_method(cResource, "initialize_semaphore", semian_resource_initialize, 6);
   rb_define_method(cResource, "acquire", semian_resource_acquire, -1);
+  rb_define_method(cResource, "try_acquire", semian_resource_try_acquire, -1);
+  rb_define_method(cResource, "lease", semian_resource_lease, -1);
+  rb_define_singleton_method(cResource, "acquire_all", semian_resource_acquire_all, -1);
+  rb_define_singleton_method(cResource, "wait_time_unit", semian_resource_get_wait_time_unit, 0);
+  rb_define_singleton_method(cResource, "wait_time_unit=", semian_resource_set_wait_time_unit, 1);
+  rb_define_singleton_method(cResource, "key_hash", semian_resource_get_key_hash, 0);
+  rb_define_singleton_method(cResource, "key_hash=", semian_resource_set_key_hash, 1);
   rb_define_method(cResource, "count", semian_resource_count, 0);
   rb_define_method(cResource, "semid", semian_resource_id, 0);
   rb_define_method(cResource, "key", semian_resource_key, 0);
   rb_define_method(cResource, "tickets", semian_resource_tickets, 0);
+  rb_define_method(cResource, "scale_tickets", semian_resource_scale_tickets, 4);
   rb_define_method(cResource, "registered_workers", semian_resource_workers, 0);
   rb_define_method(cResource, "destroy", semian_resource_destroy, 0);
   rb_define_method(cResource, "reset_registered_workers!", semian_resource_reset_workers, 0);
   rb_define_method(cResource, "unregister_worker", semian_resource_unregister_worker, 0);
+  rb_define_singleton_method(cResource, "register_workers", semian_resource_register_workers, 1);
   rb_define_method(cResource, "in_use?", semian_resource_in_use, 0);
+  rb_define_method(cResource, "wait_time_histogram", semian_resource_wait_time_histogram, 0);
+  rb_define_method(cResource, "duration_histograms", semian_resource_duration_histograms, 0);
+  rb_define_method(cResource, "dropped_durations", semian_resource_dropped_durations, 0);
+  rb_define_method(cResource, "circuit_state=", semian_resource_set_circuit_state, 1);
+  rb_define_singleton_method(cResource, "stats_snapshot", semian_resource_stats_snapshot, 1);
+
+  rb_define_alloc_func(cLease, semian_lease_alloc);
+  rb_define_method(cLease, "release", semian_lease_release, 0);
+  rb_define_method(cLease, "released?", semian_lease_released, 0);
+  rb_define_method(cLease, "wait_time", semian_lease_wait_time, 0);
 
   id_wait_time = rb_intern("wait_time");
   id_timeout = rb_intern("timeout");
+  id_ticket_backend = rb_intern("ticket_backend");
+  id_sysv = rb_intern("sysv");
+  id_shm = rb_intern("shm");
+  id_resource_pool = rb_intern("resource_pool");
+  id_resource_pool_capacity = rb_intern("resource_pool_capacity");
+  id_adaptive_tickets = rb_intern("adaptive_tickets");
+  id_reserved_tickets = rb_intern("reserved_tickets");
+  id_priority = rb_intern("priority");
+  id_fifo = rb_intern("fifo");
+  id_max_queue = rb_intern("max_queue");
+  id_scope = rb_intern("scope");
+  id_scope_tickets = rb_intern("scope_tickets");
+  id_deadline = rb_intern("deadline");
+  id_early_fail = rb_intern("early_fail");
+  id_stats = rb_intern("stats");
+  id_preload = rb_intern("preload");
+  id_sha1 = rb_intern("sha1");
+  id_fnv1a = rb_intern("fnv1a");
+  id_high = rb_intern("high");
+  id_low = rb_intern("low");
+  id_milliseconds = rb_intern("milliseconds");
+  id_nanoseconds = rb_intern("nanoseconds");
+  id_seconds = rb_intern("seconds");
+
+  init_shm_tickets();
+  init_sliding_window();
+  init_integer();
+  init_request_window();
+  init_state();
+  init_stats();
 
   if (semctl(0, 0, SEM_INFO, &info_buf) == -1) {
     rb_raise(eInternal, "unable to determine maximum semaphore count - semctl() returned %d: %s ", errno, strerror(errno));
   }
   system_max_semaphore_count = info_buf.semvmx;
+  system_max_semaphores_per_set = info_buf.semmsl;
 
   /* Maximum number of tickets available on this system. */
   rb_define_const(cSemian, "MAX_TICKETS", INT2FIX(system_max_semaphore_count));
@@ -0,0 +1,130 @@
+#include "shared_memory.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+void *
+attach_shared_memory(key_t key, size_t size, long permissions, int *shm_id, int *created)
+{
+  void *ptr;
+
+  *created = 0;
+  *shm_id = shmget(key, size, IPC_CREAT | IPC_EXCL | permissions);
+  if (*shm_id != -1) {
+    *created = 1;
+  } else if (errno == EEXIST) {
+    // Someone else created the segment, attach to theirs
+    *shm_id = shmget(key, size, permissions);
+  }
+
+  if (*shm_id == -1) {
+    raise_semian_syscall_error("shmget()", errno);
+  }
+
+  ptr = shmat(*shm_id, NULL, 0);
+  if (ptr == (void *) -1) {
+    raise_semian_syscall_error("shmat()", errno);
+  }
+
+  return ptr;
+}
+
+void *
+attach_shared_memory_object(semian_shm_object_t *obj, const char *name, const char *suffix, size_t size, long permissions, void (*initialize)(void *shm, void *arg), void *arg)
+{
+  int created;
+  void *shm;
+
+  detach_shared_memory(obj->shm);
+  obj->shm = NULL;
+
+  shm = attach_shared_memory(generate_ipc_key(name, suffix), size, permissions, &obj->shm_id, &created);
+  if (created) {
+    if (initialize) {
+      initialize(shm, arg);
+    }
+    mark_shared_memory_initialized((int32_t *) shm);
+  } else {
+    wait_for_shared_memory_initialized((int32_t *) shm);
+  }
+
+  obj->shm = shm;
+  return shm;
+}
+
+void
+semian_shm_object_free(void *ptr)
+{
+  semian_shm_object_t *obj = (semian_shm_object_t *) ptr;
+  detach_shared_memory(obj->shm);
+  xfree(obj);
+}
+
+size_t
+semian_shm_object_memsize(const void *ptr)
+{
+  return sizeof(semian_shm_object_t);
+}
+
+void
+detach_shared_memory(void *ptr)
+{
+  if (ptr != NULL) {
+    shmdt(ptr);
+  }
+}
+
+void
+destroy_shared_memory(int shm_id)
+{
+  if (shmctl(shm_id, IPC_RMID, NULL) == -1 && errno != EINVAL && errno != EIDRM) {
+    raise_semian_syscall_error("shmctl()", errno);
+  }
+}
+
+void
+wait_for_shared_memory_initialized(int32_t *initialized)
+{
+  struct timespec now, deadline, remaining;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += INTERNAL_TIMEOUT;
+
+  while (__atomic_load_n(initialized, __ATOMIC_ACQUIRE) == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+    remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+    if (remaining.tv_nsec < 0) {
+      remaining.tv_sec -= 1;
+      remaining.tv_nsec += NANOSECONDS_IN_SECOND;
+    }
+    if (remaining.tv_sec < 0) {
+      rb_raise(eTimeout, "error: timeout waiting for shared memory to initialize after %d seconds", INTERNAL_TIMEOUT);
+    }
+
+    futex_wait(initialized, 0, &remaining);
+  }
+}
+
+void
+mark_shared_memory_initialized(int32_t *initialized)
+{
+  __atomic_store_n(initialized, 1, __ATOMIC_RELEASE);
+  futex_wake(initialized, INT_MAX);
+}
+
+int
+futex_wait(int32_t *word, int32_t expected, const struct timespec *timeout)
+{
+  // The segments are shared across processes, so the private futex flag must not be used
+  return syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+int
+futex_wake(int32_t *word, int count)
+{
+  return syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
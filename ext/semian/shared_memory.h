@@ -0,0 +1,58 @@
+/*
+For manipulating semian's shared memory segments
+
+Creation, attachment and removal of the SysV shared memory segments
+backing semian's optional shared-memory structures, and futex helpers
+for blocking on words stored inside of them.
+*/
+#ifndef SEMIAN_SHARED_MEMORY_H
+#define SEMIAN_SHARED_MEMORY_H
+
+#include <sys/shm.h>
+
+#include "sysv_semaphores.h"
+
+// Attach to the shared memory segment for a key, creating it if it doesn't exist.
+// Freshly created segments are zero-filled, and reported through created.
+void *
+attach_shared_memory(key_t key, size_t size, long permissions, int *shm_id, int *created);
+
+// Detach a shared memory segment from this process
+void
+detach_shared_memory(void *ptr);
+
+// Mark a shared memory segment for removal once the last process detaches
+void
+destroy_shared_memory(int shm_id);
+
+// Attach a Ruby object to its named shared memory segment, calling initialize on freshly
+// created segments. Segments must start with an int32_t initialized flag.
+void *
+attach_shared_memory_object(semian_shm_object_t *obj, const char *name, const char *suffix, size_t size, long permissions, void (*initialize)(void *shm, void *arg), void *arg);
+
+// Free function for the typed data of Ruby objects backed by shared memory
+void
+semian_shm_object_free(void *ptr);
+
+// Memsize function for the typed data of Ruby objects backed by shared memory
+size_t
+semian_shm_object_memsize(const void *ptr);
+
+// Block until a segment's creator marks it as initialized
+void
+wait_for_shared_memory_initialized(int32_t *initialized);
+
+// Mark a segment as initialized, waking anyone waiting for it
+void
+mark_shared_memory_initialized(int32_t *initialized);
+
+// Sleep while *word equals expected, for at most timeout.
+// Returns -1 and sets errno as the futex(2) FUTEX_WAIT operation does.
+int
+futex_wait(int32_t *word, int32_t expected, const struct timespec *timeout);
+
+// Wake up to count waiters sleeping on word
+int
+futex_wake(int32_t *word, int count);
+
+#endif // SEMIAN_SHARED_MEMORY_H
@@ -0,0 +1,607 @@
+#include "shm_tickets.h"
+#include "histogram.h"
+#include "stats.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+// How long a waiter sleeps before checking for tickets held by dead processes
+#define SHM_REAP_INTERVAL_NS 100000000L /* 100ms */
+
+// States of a place in line, see semian_shm_queue_slot_t
+#define QUEUE_WAITING(number) ((int32_t) ((number) & 0x3fffffff) + 1)
+#define QUEUE_ABANDONED(number) (-QUEUE_WAITING(number))
+
+// Pid of the current process, refreshed in forked children
+static pid_t current_pid;
+
+static void
+refresh_current_pid();
+
+// Returns 0 if /proc/<pid>/stat can't be read or parsed
+static uint64_t
+get_process_start_time(pid_t pid, char *state);
+
+static int
+owner_alive(semian_shm_owner_t *owner, pid_t pid);
+
+static int
+claim_owner_slot(semian_shm_tickets_t *shm_tickets, semian_stats_slot_t *stats);
+
+static void
+reap_dead_owners(semian_shm_tickets_t *shm_tickets, semian_stats_slot_t *stats);
+
+static int
+take_shm_ticket(semian_shm_tickets_t *shm_tickets, int reserve);
+
+static void
+record_shm_ticket(semian_resource_t *res);
+
+static void *
+wait_for_shm_ticket(void *p);
+
+static void
+wait_for_free_shm_ticket(semian_resource_t *res, struct timespec *begin, long timeout_ns);
+
+static void
+wait_in_shm_queue(semian_resource_t *res, struct timespec *begin, long timeout_ns);
+
+static int
+may_skip_shm_queue(semian_resource_t *res);
+
+static int
+join_shm_queue(semian_shm_tickets_t *shm_tickets, uint32_t limit, uint32_t *number);
+
+static void
+leave_shm_queue(semian_shm_tickets_t *shm_tickets, uint32_t number);
+
+static void
+advance_shm_queue(semian_shm_tickets_t *shm_tickets, uint32_t from);
+
+static void
+skip_dead_shm_queue_head(semian_shm_tickets_t *shm_tickets, uint32_t head);
+
+static long
+diff_timespec_ns(struct timespec *end, struct timespec *begin);
+
+void
+init_shm_tickets()
+{
+  refresh_current_pid();
+  pthread_atfork(NULL, NULL, refresh_current_pid);
+}
+
+int
+attach_shm_tickets(semian_resource_t *res, long permissions)
+{
+  char suffix[64];
+  int created;
+
+  // The segment is keyed on the semaphore set id and the resource's slot in it, so a set that
+  // was destroyed and recreated never inherits stale tickets from a previous segment.
+  snprintf(suffix, sizeof(suffix), "_SHM_TICKETS_%d_%d_%zu", res->sem_id, res->sem_base, sizeof(semian_shm_tickets_t));
+  res->shm_tickets = attach_shared_memory(generate_ipc_key(res->name, suffix), sizeof(semian_shm_tickets_t), permissions, &res->shm_id, &created);
+
+  if (!created) {
+    wait_for_shared_memory_initialized(&res->shm_tickets->initialized);
+    reap_dead_owners(res->shm_tickets, res->stats);
+  }
+
+  res->shm_owner = -1;
+  ensure_shm_owner(res);
+
+  return created;
+}
+
+void
+populate_shm_tickets(semian_shm_tickets_t *shm_tickets, int tickets)
+{
+  __atomic_store_n(&shm_tickets->tickets, tickets, __ATOMIC_RELAXED);
+  mark_shared_memory_initialized(&shm_tickets->initialized);
+}
+
+void
+update_shm_ticket_count(semian_shm_tickets_t *shm_tickets, int delta)
+{
+  // Shrinking never blocks, the counter goes negative until enough tickets are returned
+  __atomic_add_fetch(&shm_tickets->tickets, delta, __ATOMIC_ACQ_REL);
+  if (delta > 0 && __atomic_load_n(&shm_tickets->waiters, __ATOMIC_ACQUIRE) > 0) {
+    futex_wake(&shm_tickets->tickets, delta);
+  }
+}
+
+void
+ensure_shm_owner(semian_resource_t *res)
+{
+  if (res->shm_owner >= 0 && res->shm_owner_pid == current_pid) {
+    return;
+  }
+
+  res->shm_owner = claim_owner_slot(res->shm_tickets, res->stats);
+  if (res->shm_owner == -1) {
+    rb_raise(eInternal, "no free owner slots in shared memory tickets for '%s', at most %d processes are supported", res->name, SEMIAN_SHM_MAX_OWNERS);
+  }
+  res->shm_owner_pid = current_pid;
+}
+
+void
+acquire_shm_ticket(semian_resource_t *res)
+{
+  res->error = 0;
+  res->wait_time = -1;
+
+  if (may_skip_shm_queue(res) && take_shm_ticket(res->shm_tickets, res->reserve)) {
+    res->wait_time = 0;
+    record_histogram_value(res->wait_time_histogram, 0);
+  } else {
+    WITHOUT_GVL(wait_for_shm_ticket, res, RUBY_UBF_IO, NULL);
+  }
+
+  if (res->error == 0) {
+    record_shm_ticket(res);
+  }
+}
+
+void
+acquire_shm_ticket_blocking(semian_resource_t *res)
+{
+  res->error = 0;
+  res->wait_time = -1;
+
+  if (may_skip_shm_queue(res) && take_shm_ticket(res->shm_tickets, res->reserve)) {
+    res->wait_time = 0;
+    record_histogram_value(res->wait_time_histogram, 0);
+  } else {
+    wait_for_shm_ticket(res);
+  }
+
+  if (res->error == 0) {
+    record_shm_ticket(res);
+  }
+}
+
+int
+try_acquire_shm_ticket(semian_resource_t *res)
+{
+  res->error = 0;
+  if (!may_skip_shm_queue(res) || !take_shm_ticket(res->shm_tickets, res->reserve)) {
+    return 0;
+  }
+  record_shm_ticket(res);
+  return 1;
+}
+
+int
+join_shm_line(semian_resource_t *res, uint32_t *number)
+{
+  uint32_t limit = res->max_queue > 0 && res->max_queue < SEMIAN_SHM_MAX_QUEUE ? res->max_queue : SEMIAN_SHM_MAX_QUEUE;
+
+  res->error = 0;
+  if (!join_shm_queue(res->shm_tickets, limit, number)) {
+    res->error = EBUSY;
+    return 0;
+  }
+  return 1;
+}
+
+int
+try_acquire_shm_ticket_in_line(semian_resource_t *res, uint32_t number)
+{
+  semian_shm_tickets_t *shm_tickets = res->shm_tickets;
+  uint32_t head = __atomic_load_n(&shm_tickets->queue_head, __ATOMIC_SEQ_CST);
+
+  res->error = 0;
+  if (head != number) {
+    skip_dead_shm_queue_head(shm_tickets, head);
+    return 0;
+  }
+  if (!take_shm_ticket(shm_tickets, res->reserve)) {
+    return 0;
+  }
+  record_shm_ticket(res);
+  advance_shm_queue(shm_tickets, number);
+  return 1;
+}
+
+void
+leave_shm_line(semian_resource_t *res, uint32_t number)
+{
+  leave_shm_queue(res->shm_tickets, number);
+}
+
+void
+release_shm_ticket(semian_resource_t *res)
+{
+  semian_shm_tickets_t *shm_tickets = res->shm_tickets;
+
+  ensure_shm_owner(res);
+  __atomic_sub_fetch(&shm_tickets->owners[res->shm_owner].held, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&shm_tickets->tickets, 1, __ATOMIC_ACQ_REL);
+  if (__atomic_load_n(&shm_tickets->waiters, __ATOMIC_ACQUIRE) > 0) {
+    futex_wake(&shm_tickets->tickets, 1);
+  }
+}
+
+int
+get_shm_ticket_count(semian_resource_t *res)
+{
+  int tickets = __atomic_load_n(&res->shm_tickets->tickets, __ATOMIC_ACQUIRE);
+  return tickets > 0 ? tickets : 0;
+}
+
+void
+detach_shm_tickets(semian_resource_t *res, int destroy)
+{
+  if (res->shm_tickets == NULL) {
+    return;
+  }
+
+  if (destroy) {
+    destroy_shared_memory(res->shm_id);
+  }
+  detach_shared_memory(res->shm_tickets);
+  res->shm_tickets = NULL;
+}
+
+static void
+refresh_current_pid()
+{
+  current_pid = getpid();
+}
+
+static int
+take_shm_ticket(semian_shm_tickets_t *shm_tickets, int reserve)
+{
+  int32_t tickets = __atomic_load_n(&shm_tickets->tickets, __ATOMIC_ACQUIRE);
+
+  while (tickets > reserve) {
+    if (__atomic_compare_exchange_n(&shm_tickets->tickets, &tickets, tickets - 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void
+record_shm_ticket(semian_resource_t *res)
+{
+  __atomic_add_fetch(&res->shm_tickets->owners[res->shm_owner].held, 1, __ATOMIC_RELAXED);
+}
+
+static void *
+wait_for_shm_ticket(void *p)
+{
+  semian_resource_t *res = (semian_resource_t *) p;
+  struct timespec begin, now;
+  long timeout_ns;
+
+  timeout_ns = res->timeout.tv_sec * NANOSECONDS_IN_SECOND + res->timeout.tv_nsec;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  reap_dead_owners(res->shm_tickets, res->stats);
+
+  if (res->fifo) {
+    wait_in_shm_queue(res, &begin, timeout_ns);
+  } else {
+    wait_for_free_shm_ticket(res, &begin, timeout_ns);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  res->wait_time = diff_timespec_ns(&now, &begin);
+  if (res->error == 0) {
+    record_histogram_interval(res->wait_time_histogram, &begin, &now);
+  }
+  return NULL;
+}
+
+static void
+wait_for_free_shm_ticket(semian_resource_t *res, struct timespec *begin, long timeout_ns)
+{
+  semian_shm_tickets_t *shm_tickets = res->shm_tickets;
+  struct timespec now, wait;
+  long remaining_ns;
+  int32_t tickets;
+  int num_retries = 3;
+  int ret;
+
+  while (!take_shm_ticket(shm_tickets, res->reserve)) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining_ns = timeout_ns - diff_timespec_ns(&now, begin);
+    if (remaining_ns <= 0) {
+      res->error = EAGAIN;
+      break;
+    }
+
+    tickets = __atomic_load_n(&shm_tickets->tickets, __ATOMIC_ACQUIRE);
+    if (tickets > res->reserve) {
+      continue;
+    }
+
+    if (remaining_ns > SHM_REAP_INTERVAL_NS) {
+      remaining_ns = SHM_REAP_INTERVAL_NS;
+    }
+    wait.tv_sec = remaining_ns / NANOSECONDS_IN_SECOND;
+    wait.tv_nsec = remaining_ns % NANOSECONDS_IN_SECOND;
+
+    __atomic_add_fetch(&shm_tickets->waiters, 1, __ATOMIC_ACQ_REL);
+    ret = futex_wait(&shm_tickets->tickets, tickets, &wait);
+    __atomic_sub_fetch(&shm_tickets->waiters, 1, __ATOMIC_ACQ_REL);
+
+    if (ret == -1) {
+      if (errno == ETIMEDOUT) {
+        reap_dead_owners(shm_tickets, res->stats);
+      } else if (errno == EINTR && num_retries-- <= 0) {
+        res->error = EINTR;
+        break;
+      }
+    } else if (res->reserve > 0) {
+      // Woken for a ticket this caller may not take, pass the wakeup on to the next waiter
+      tickets = __atomic_load_n(&shm_tickets->tickets, __ATOMIC_ACQUIRE);
+      if (tickets > 0 && tickets <= res->reserve) {
+        futex_wake(&shm_tickets->tickets, 1);
+      }
+    }
+  }
+}
+
+static void
+wait_in_shm_queue(semian_resource_t *res, struct timespec *begin, long timeout_ns)
+{
+  semian_shm_tickets_t *shm_tickets = res->shm_tickets;
+  semian_shm_queue_slot_t *slot;
+  struct timespec now, wait;
+  long remaining_ns;
+  uint32_t number, head;
+  int num_retries = 3;
+
+  if (!join_shm_line(res, &number)) {
+    return;
+  }
+  slot = &shm_tickets->queue[number % SEMIAN_SHM_MAX_QUEUE];
+
+  for (;;) {
+    head = __atomic_load_n(&shm_tickets->queue_head, __ATOMIC_SEQ_CST);
+    if (head == number) {
+      // At the front of the line, wait for a ticket like unordered callers do
+      wait_for_free_shm_ticket(res, begin, timeout_ns);
+      advance_shm_queue(shm_tickets, number);
+      return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining_ns = timeout_ns - diff_timespec_ns(&now, begin);
+    if (remaining_ns <= 0) {
+      res->error = EAGAIN;
+      leave_shm_queue(shm_tickets, number);
+      return;
+    }
+
+    if (remaining_ns > SHM_REAP_INTERVAL_NS) {
+      remaining_ns = SHM_REAP_INTERVAL_NS;
+    }
+    wait.tv_sec = remaining_ns / NANOSECONDS_IN_SECOND;
+    wait.tv_nsec = remaining_ns % NANOSECONDS_IN_SECOND;
+
+    // Woken through the turn of the place in line once the caller ahead is served
+    if (futex_wait(&slot->turn, 0, &wait) == -1) {
+      if (errno == ETIMEDOUT) {
+        skip_dead_shm_queue_head(shm_tickets, head);
+      } else if (errno == EINTR && num_retries-- <= 0) {
+        res->error = EINTR;
+        leave_shm_queue(shm_tickets, number);
+        return;
+      }
+    }
+  }
+}
+
+static int
+may_skip_shm_queue(semian_resource_t *res)
+{
+  semian_shm_tickets_t *shm_tickets = res->shm_tickets;
+
+  // Callers may only take a ticket right away when nobody is waiting in line
+  return !res->fifo ||
+         __atomic_load_n(&shm_tickets->queue_head, __ATOMIC_ACQUIRE) == __atomic_load_n(&shm_tickets->queue_tail, __ATOMIC_ACQUIRE);
+}
+
+static int
+join_shm_queue(semian_shm_tickets_t *shm_tickets, uint32_t limit, uint32_t *number)
+{
+  semian_shm_queue_slot_t *slot;
+  uint32_t tail = __atomic_load_n(&shm_tickets->queue_tail, __ATOMIC_SEQ_CST);
+
+  do {
+    if (tail - __atomic_load_n(&shm_tickets->queue_head, __ATOMIC_SEQ_CST) >= limit) {
+      return 0;
+    }
+  } while (!__atomic_compare_exchange_n(&shm_tickets->queue_tail, &tail, tail + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+  // The line is shorter than the number of places, so the caller that had this place was served already
+  slot = &shm_tickets->queue[tail % SEMIAN_SHM_MAX_QUEUE];
+  __atomic_store_n(&slot->turn, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&slot->pid, current_pid, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&slot->state, QUEUE_WAITING(tail), __ATOMIC_SEQ_CST);
+
+  *number = tail;
+  return 1;
+}
+
+static void
+leave_shm_queue(semian_shm_tickets_t *shm_tickets, uint32_t number)
+{
+  semian_shm_queue_slot_t *slot = &shm_tickets->queue[number % SEMIAN_SHM_MAX_QUEUE];
+  int32_t waiting = QUEUE_WAITING(number);
+
+  // Whoever moves the head of the line past this place skips it from now on. If the head
+  // already reached it, move it along.
+  if (__atomic_compare_exchange_n(&slot->state, &waiting, QUEUE_ABANDONED(number), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) &&
+      __atomic_load_n(&shm_tickets->queue_head, __ATOMIC_SEQ_CST) == number) {
+    advance_shm_queue(shm_tickets, number);
+  }
+}
+
+static void
+advance_shm_queue(semian_shm_tickets_t *shm_tickets, uint32_t from)
+{
+  semian_shm_queue_slot_t *slot;
+  uint32_t next;
+
+  for (;;) {
+    __atomic_store_n(&shm_tickets->queue[from % SEMIAN_SHM_MAX_QUEUE].state, 0, __ATOMIC_SEQ_CST);
+    next = from + 1;
+    // Only one of the callers racing to move the head past a place does
+    if (!__atomic_compare_exchange_n(&shm_tickets->queue_head, &from, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+      return;
+    }
+    if (next == __atomic_load_n(&shm_tickets->queue_tail, __ATOMIC_SEQ_CST)) {
+      return;
+    }
+
+    slot = &shm_tickets->queue[next % SEMIAN_SHM_MAX_QUEUE];
+    if (__atomic_load_n(&slot->state, __ATOMIC_SEQ_CST) != QUEUE_ABANDONED(next)) {
+      __atomic_store_n(&slot->turn, 1, __ATOMIC_SEQ_CST);
+      futex_wake(&slot->turn, 1);
+      return;
+    }
+    from = next;
+  }
+}
+
+static void
+skip_dead_shm_queue_head(semian_shm_tickets_t *shm_tickets, uint32_t head)
+{
+  semian_shm_queue_slot_t *slot = &shm_tickets->queue[head % SEMIAN_SHM_MAX_QUEUE];
+  int32_t waiting = QUEUE_WAITING(head);
+  int32_t pid;
+
+  // A caller that died in line would hold up everyone behind it
+  if (__atomic_load_n(&slot->state, __ATOMIC_SEQ_CST) != waiting) {
+    return;
+  }
+  pid = __atomic_load_n(&slot->pid, __ATOMIC_SEQ_CST);
+  if (pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+    return;
+  }
+  if (__atomic_compare_exchange_n(&slot->state, &waiting, QUEUE_ABANDONED(head), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    advance_shm_queue(shm_tickets, head);
+  }
+}
+
+static int
+claim_owner_slot(semian_shm_tickets_t *shm_tickets, semian_stats_slot_t *stats)
+{
+  int attempt, i;
+  int32_t unowned;
+
+  for (attempt = 0; attempt < 2; attempt++) {
+    for (i = 0; i < SEMIAN_SHM_MAX_OWNERS; i++) {
+      semian_shm_owner_t *owner = &shm_tickets->owners[i];
+      unowned = 0;
+      if (__atomic_compare_exchange_n(&owner->pid, &unowned, current_pid, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&owner->start_time, get_process_start_time(current_pid, NULL), __ATOMIC_RELEASE);
+        return i;
+      }
+    }
+
+    // All slots are taken, try to make room by handing back the slots of dead processes
+    reap_dead_owners(shm_tickets, stats);
+  }
+
+  return -1;
+}
+
+static void
+reap_dead_owners(semian_shm_tickets_t *shm_tickets, semian_stats_slot_t *stats)
+{
+  int i;
+  int32_t pid, held;
+
+  for (i = 0; i < SEMIAN_SHM_MAX_OWNERS; i++) {
+    semian_shm_owner_t *owner = &shm_tickets->owners[i];
+    pid = __atomic_load_n(&owner->pid, __ATOMIC_ACQUIRE);
+    if (pid <= 0 || owner_alive(owner, pid)) {
+      continue;
+    }
+
+    // Lock the slot with a pid of -1 while handing back its tickets, so only one reaper does
+    if (!__atomic_compare_exchange_n(&owner->pid, &pid, -1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+
+    held = __atomic_exchange_n(&owner->held, 0, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&owner->start_time, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&owner->pid, 0, __ATOMIC_RELEASE);
+
+    if (held != 0) {
+      update_shm_ticket_count(shm_tickets, held);
+      record_stats_reaped(stats, held);
+    }
+  }
+}
+
+static int
+owner_alive(semian_shm_owner_t *owner, pid_t pid)
+{
+  uint64_t start_time, owner_start_time;
+  char state = 0;
+
+  if (kill(pid, 0) == -1 && errno == ESRCH) {
+    return 0;
+  }
+
+  // kill(2) succeeds for zombies and recycled pids, so also compare the process start time. It can't
+  // be read with hidepid or from another pid namespace, and the owner has to be assumed alive then.
+  start_time = get_process_start_time(pid, &state);
+  if (start_time == 0) {
+    return 1;
+  }
+  if (state == 'Z' || state == 'X') {
+    return 0;
+  }
+
+  owner_start_time = __atomic_load_n(&owner->start_time, __ATOMIC_ACQUIRE);
+  return owner_start_time == 0 || owner_start_time == start_time;
+}
+
+static uint64_t
+get_process_start_time(pid_t pid, char *state)
+{
+  char path[32], buf[1024];
+  char *fields;
+  char process_state;
+  unsigned long long start_time = 0;
+  FILE *stat_file;
+  size_t len;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  stat_file = fopen(path, "r");
+  if (stat_file == NULL) {
+    return 0;
+  }
+  len = fread(buf, 1, sizeof(buf) - 1, stat_file);
+  fclose(stat_file);
+  buf[len] = '\0';
+
+  // The command name may contain spaces and parentheses, so skip past the last ')'
+  fields = strrchr(buf, ')');
+  if (fields == NULL) {
+    return 0;
+  }
+  if (sscanf(fields + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+             &process_state, &start_time) != 2) {
+    return 0;
+  }
+
+  if (state != NULL) {
+    *state = process_state;
+  }
+  return start_time;
+}
+
+static long
+diff_timespec_ns(struct timespec *end, struct timespec *begin)
+{
+  return (end->tv_sec - begin->tv_sec) * NANOSECONDS_IN_SECOND + (end->tv_nsec - begin->tv_nsec);
+}
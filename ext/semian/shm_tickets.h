@@ -0,0 +1,83 @@
+/*
+For the shared memory ticket backend
+
+An opt-in alternative to issuing tickets from SI_SEM_TICKETS. Tickets are kept
+in an atomic counter in a shared memory segment next to the semaphore set, so an
+uncontended acquire or release is a single compare-and-swap that never enters
+the kernel. Callers only block on a futex when no tickets are left.
+
+Each process records the tickets it holds in an owner table. Tickets held by a
+process that died are handed back by the next caller that has to wait, which
+gives the same crash safety as SEM_UNDO does for the SysV backend.
+
+The semaphore set remains the source of truth for the configured ticket count and
+registered workers, and every resize of the set is mirrored into the segment.
+*/
+#ifndef SEMIAN_SHM_TICKETS_H
+#define SEMIAN_SHM_TICKETS_H
+
+#include "shared_memory.h"
+
+// Set up fork tracking for the owner table
+void
+init_shm_tickets();
+
+// Attach to the shared memory tickets of the resource's semaphore set, and claim an owner slot.
+// Returns true if the segment was created, in which case it must be populated by the caller.
+// Otherwise, this waits for the creator to populate it.
+int
+attach_shm_tickets(semian_resource_t *res, long permissions);
+
+// Populate a freshly created segment with the configured ticket count of the semaphore set.
+// Must be called with the semaphore meta lock already acquired.
+void
+populate_shm_tickets(semian_shm_tickets_t *shm_tickets, int tickets);
+
+// Apply a change of the configured ticket count to the segment
+void
+update_shm_ticket_count(semian_shm_tickets_t *shm_tickets, int delta);
+
+// Make sure the current process owns the resource's owner slot, claiming a new one after a fork
+void
+ensure_shm_owner(semian_resource_t *res);
+
+// Takes a ticket, only releasing the GVL and blocking if none are available.
+// Leaves res->reserve tickets to high priority callers.
+void
+acquire_shm_ticket(semian_resource_t *res);
+
+// Same as acquire_shm_ticket, for callers that already released the GVL
+void
+acquire_shm_ticket_blocking(semian_resource_t *res);
+
+// Takes a ticket if one is available, without waiting. Returns true if a ticket was taken.
+int
+try_acquire_shm_ticket(semian_resource_t *res);
+
+// Takes a place in the resource's line, for callers that can't block while they wait.
+// Returns false and sets res->error to EBUSY if the line is full.
+int
+join_shm_line(semian_resource_t *res, uint32_t *number);
+
+// Takes a ticket if the place taken by join_shm_line is at the front of the line and one is
+// available, letting the next caller in line move up. Returns true if a ticket was taken.
+int
+try_acquire_shm_ticket_in_line(semian_resource_t *res, uint32_t number);
+
+// Gives up a place taken by join_shm_line without a ticket
+void
+leave_shm_line(semian_resource_t *res, uint32_t number);
+
+// Returns a ticket taken by acquire_shm_ticket, waking a waiter if there is one
+void
+release_shm_ticket(semian_resource_t *res);
+
+// Retrieve the number of tickets currently available
+int
+get_shm_ticket_count(semian_resource_t *res);
+
+// Detach from the segment, and optionally mark it for removal
+void
+detach_shm_tickets(semian_resource_t *res, int destroy);
+
+#endif // SEMIAN_SHM_TICKETS_H
@@ -0,0 +1,696 @@
+#include "sliding_window.h"
+
+static ID id_max_size;
+
+// State of an in-progress reject! on a process local window
+typedef struct {
+  semian_sliding_window_t *window;
+  long read;
+  long write;
+} reject_args_t;
+
+// State of an in-progress reject! on a snapshot of a thread safe window
+typedef struct {
+  VALUE self;
+  semian_sliding_window_t *window;
+  VALUE *values;
+  char *rejected;
+  uint64_t generation;
+  long length;
+  long visited;
+  int applied;
+} snapshot_reject_args_t;
+
+static const rb_data_type_t
+semian_local_sliding_window_type;
+
+static const rb_data_type_t
+semian_sliding_window_type;
+
+static semian_sliding_window_t *
+get_local_sliding_window(VALUE self);
+
+static VALUE *
+local_sliding_window_at(semian_sliding_window_t *window, long index);
+
+static VALUE
+reject_local_sliding_window(VALUE p);
+
+static VALUE
+compact_local_sliding_window(VALUE p);
+
+static VALUE
+reject_sliding_window_snapshot(VALUE p);
+
+static VALUE
+apply_sliding_window_snapshot(VALUE p);
+
+static void
+check_not_rejecting(semian_sliding_window_t *window);
+
+static VALUE
+semian_sliding_window_alloc(VALUE klass);
+
+static void
+semian_sliding_window_mark(void *ptr);
+
+static void
+semian_sliding_window_free(void *ptr);
+
+static size_t
+semian_sliding_window_memsize(const void *ptr);
+
+static void
+initialize_sliding_window(void *shm, void *arg);
+
+static semian_shm_sliding_window_t *
+get_sliding_window(VALUE self);
+
+static void
+lock_sliding_window(semian_shm_sliding_window_t *window);
+
+static void
+unlock_sliding_window(semian_shm_sliding_window_t *window);
+
+static int64_t
+sliding_window_at(semian_shm_sliding_window_t *window, int32_t index);
+
+static VALUE
+semian_sysv_sliding_window_alloc(VALUE klass);
+
+void
+init_sliding_window()
+{
+  VALUE cSemian, cSimple, cThreadSafe, cSysV, cSimpleSlidingWindow, cThreadSafeSlidingWindow, cSlidingWindow;
+
+  cSemian = rb_const_get(rb_cObject, rb_intern("Semian"));
+  cSimple = rb_const_get(cSemian, rb_intern("Simple"));
+  cThreadSafe = rb_const_get(cSemian, rb_intern("ThreadSafe"));
+  cSysV = rb_const_get(cSemian, rb_intern("SysV"));
+  cSimpleSlidingWindow = rb_const_get(cSimple, rb_intern("SlidingWindow"));
+  cThreadSafeSlidingWindow = rb_const_get(cThreadSafe, rb_intern("SlidingWindow"));
+  cSlidingWindow = rb_const_get(cSysV, rb_intern("SlidingWindow"));
+
+  // Replaces the Array based implementation, ThreadSafe::SlidingWindow inherits the methods.
+  // Subclasses that already exist don't inherit a new allocator, so it is set on both.
+  rb_define_alloc_func(cSimpleSlidingWindow, semian_sliding_window_alloc);
+  rb_define_alloc_func(cThreadSafeSlidingWindow, semian_sliding_window_alloc);
+  rb_define_method(cSimpleSlidingWindow, "initialize", semian_sliding_window_initialize, -1);
+  rb_define_method(cSimpleSlidingWindow, "size", semian_sliding_window_size, 0);
+  rb_define_method(cSimpleSlidingWindow, "last", semian_sliding_window_last, 0);
+  rb_define_method(cSimpleSlidingWindow, "max_size", semian_sliding_window_max_size, 0);
+  rb_define_method(cSimpleSlidingWindow, "to_a", semian_sliding_window_to_a, 0);
+  rb_define_method(cSimpleSlidingWindow, "push", semian_sliding_window_push, 1);
+  rb_define_method(cSimpleSlidingWindow, "<<", semian_sliding_window_push, 1);
+  rb_define_method(cSimpleSlidingWindow, "reject!", semian_sliding_window_reject, 0);
+  rb_define_method(cSimpleSlidingWindow, "clear", semian_sliding_window_clear, 0);
+  rb_define_method(cSimpleSlidingWindow, "destroy", semian_sliding_window_clear, 0);
+
+  // Replaces the Mutex based ThreadSafe methods. The native methods run without switching
+  // threads, so only reject!, which calls back into Ruby, needs to guard against other threads.
+  rb_define_method(cThreadSafeSlidingWindow, "initialize", semian_sliding_window_initialize, -1);
+  rb_define_method(cThreadSafeSlidingWindow, "push", semian_sliding_window_push, 1);
+  rb_define_method(cThreadSafeSlidingWindow, "<<", semian_sliding_window_push, 1);
+  rb_define_method(cThreadSafeSlidingWindow, "reject!", semian_thread_safe_sliding_window_reject, 0);
+
+  rb_define_alloc_func(cSlidingWindow, semian_sysv_sliding_window_alloc);
+  rb_define_method(cSlidingWindow, "initialize_shared_memory", semian_sysv_sliding_window_initialize, 3);
+  rb_define_method(cSlidingWindow, "size", semian_sysv_sliding_window_size, 0);
+  rb_define_method(cSlidingWindow, "last", semian_sysv_sliding_window_last, 0);
+  rb_define_method(cSlidingWindow, "max_size", semian_sysv_sliding_window_max_size, 0);
+  rb_define_method(cSlidingWindow, "to_a", semian_sysv_sliding_window_to_a, 0);
+  rb_define_method(cSlidingWindow, "push", semian_sysv_sliding_window_push, 1);
+  rb_define_method(cSlidingWindow, "<<", semian_sysv_sliding_window_push, 1);
+  rb_define_method(cSlidingWindow, "reject!", semian_sysv_sliding_window_reject, 0);
+  rb_define_method(cSlidingWindow, "clear", semian_sysv_sliding_window_clear, 0);
+  rb_define_method(cSlidingWindow, "destroy", semian_sysv_sliding_window_destroy, 0);
+
+  id_max_size = rb_intern("max_size");
+}
+
+VALUE
+semian_sliding_window_initialize(int argc, VALUE *argv, VALUE self)
+{
+  semian_sliding_window_t *window;
+  VALUE opts, max_size;
+  long c_max_size;
+
+  // Accepts max_size:, and ignores the other keywords the SysV window needs
+  rb_scan_args(argc, argv, ":", &opts);
+  rb_get_kwargs(opts, &id_max_size, 1, -1, &max_size);
+  c_max_size = NUM2LONG(max_size);
+  if (c_max_size < 0) {
+    rb_raise(rb_eArgError, "max_size must not be negative");
+  }
+
+  TypedData_Get_Struct(self, semian_sliding_window_t, &semian_local_sliding_window_type, window);
+  // An empty window discards every push, but still needs a buffer to mark it as initialized
+  REALLOC_N(window->values, VALUE, c_max_size > 0 ? c_max_size : 1);
+  window->max_size = c_max_size;
+  window->start = 0;
+  window->length = 0;
+
+  return self;
+}
+
+VALUE
+semian_sliding_window_size(VALUE self)
+{
+  return LONG2NUM(get_local_sliding_window(self)->length);
+}
+
+VALUE
+semian_sliding_window_max_size(VALUE self)
+{
+  return LONG2NUM(get_local_sliding_window(self)->max_size);
+}
+
+VALUE
+semian_sliding_window_last(VALUE self)
+{
+  semian_sliding_window_t *window = get_local_sliding_window(self);
+
+  if (window->length == 0) {
+    return Qnil;
+  }
+  return *local_sliding_window_at(window, window->length - 1);
+}
+
+VALUE
+semian_sliding_window_to_a(VALUE self)
+{
+  semian_sliding_window_t *window = get_local_sliding_window(self);
+  VALUE ary = rb_ary_new_capa(window->length);
+  long i;
+
+  for (i = 0; i < window->length; i++) {
+    rb_ary_push(ary, *local_sliding_window_at(window, i));
+  }
+  return ary;
+}
+
+VALUE
+semian_sliding_window_push(VALUE self, VALUE value)
+{
+  semian_sliding_window_t *window = get_local_sliding_window(self);
+
+  check_not_rejecting(window);
+  if (window->max_size == 0) {
+    return self;
+  }
+  if (window->length == window->max_size) {
+    // Overwrite the oldest value
+    window->values[window->start] = value;
+    window->start = (window->start + 1) % window->max_size;
+  } else {
+    *local_sliding_window_at(window, window->length) = value;
+    window->length++;
+  }
+  window->generation++;
+  RB_OBJ_WRITTEN(self, Qundef, value);
+
+  return self;
+}
+
+VALUE
+semian_sliding_window_reject(VALUE self)
+{
+  reject_args_t args;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  args.window = get_local_sliding_window(self);
+  check_not_rejecting(args.window);
+  args.window->rejecting = 1;
+  args.read = 0;
+  args.write = 0;
+  rb_ensure(reject_local_sliding_window, (VALUE) &args, compact_local_sliding_window, (VALUE) &args);
+
+  return self;
+}
+
+VALUE
+semian_sliding_window_clear(VALUE self)
+{
+  semian_sliding_window_t *window = get_local_sliding_window(self);
+  long i;
+
+  check_not_rejecting(window);
+  // Drop the references so the values can be collected
+  for (i = 0; i < window->length; i++) {
+    *local_sliding_window_at(window, i) = Qnil;
+  }
+  window->start = 0;
+  window->length = 0;
+  window->generation++;
+
+  return self;
+}
+
+VALUE
+semian_thread_safe_sliding_window_reject(VALUE self)
+{
+  snapshot_reject_args_t args;
+  VALUE values_buf, rejected_buf;
+  long i, size;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  args.self = self;
+  args.window = get_local_sliding_window(self);
+  size = args.window->max_size > 0 ? args.window->max_size : 1;
+  args.values = ALLOCV_N(VALUE, values_buf, size);
+  args.rejected = ALLOCV_N(char, rejected_buf, size);
+
+  do {
+    // Copying and writing back can't be interrupted by other threads while holding the
+    // GVL, but the block can switch threads, so it's only called on a snapshot.
+    args.generation = args.window->generation;
+    args.length = args.window->length;
+    args.visited = 0;
+    args.applied = 0;
+    for (i = 0; i < args.length; i++) {
+      args.values[i] = *local_sliding_window_at(args.window, i);
+    }
+
+    rb_ensure(reject_sliding_window_snapshot, (VALUE) &args, apply_sliding_window_snapshot, (VALUE) &args);
+
+    // Another thread changed the window while the block was running, start over
+  } while (!args.applied);
+
+  ALLOCV_END(values_buf);
+  ALLOCV_END(rejected_buf);
+
+  return self;
+}
+
+VALUE
+semian_sysv_sliding_window_initialize(VALUE self, VALUE name, VALUE max_size, VALUE permissions)
+{
+  semian_shm_object_t *obj;
+  char suffix[64];
+  int32_t c_max_size;
+  size_t size;
+
+  Check_Type(name, T_STRING);
+  Check_Type(permissions, T_FIXNUM);
+  c_max_size = NUM2INT(max_size);
+  if (c_max_size < 0) {
+    rb_raise(rb_eArgError, "max_size must not be negative");
+  }
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_sliding_window_type, obj);
+
+  // The capacity is part of the key, so windows with different sizes never share a segment
+  size = sizeof(semian_shm_sliding_window_t) + sizeof(int64_t) * c_max_size;
+  snprintf(suffix, sizeof(suffix), "_SHM_SLIDING_WINDOW_%d_%zu", c_max_size, sizeof(semian_shm_sliding_window_t));
+  attach_shared_memory_object(obj, StringValueCStr(name), suffix, size, FIX2LONG(permissions), initialize_sliding_window, &c_max_size);
+
+  return self;
+}
+
+VALUE
+semian_sysv_sliding_window_size(VALUE self)
+{
+  semian_shm_sliding_window_t *window = get_sliding_window(self);
+  return INT2NUM(__atomic_load_n(&window->length, __ATOMIC_ACQUIRE));
+}
+
+VALUE
+semian_sysv_sliding_window_max_size(VALUE self)
+{
+  semian_shm_sliding_window_t *window = get_sliding_window(self);
+  return INT2NUM(window->max_size);
+}
+
+VALUE
+semian_sysv_sliding_window_last(VALUE self)
+{
+  semian_shm_sliding_window_t *window = get_sliding_window(self);
+  VALUE last = Qnil;
+
+  lock_sliding_window(window);
+  if (window->length > 0) {
+    last = LL2NUM(sliding_window_at(window, window->length - 1));
+  }
+  unlock_sliding_window(window);
+
+  return last;
+}
+
+VALUE
+semian_sysv_sliding_window_to_a(VALUE self)
+{
+  semian_shm_sliding_window_t *window = get_sliding_window(self);
+  int64_t *values;
+  int32_t i, length;
+  VALUE buf, ary;
+
+  values = ALLOCV_N(int64_t, buf, window->max_size);
+
+  lock_sliding_window(window);
+  length = window->length;
+  for (i = 0; i < length; i++) {
+    values[i] = sliding_window_at(window, i);
+  }
+  unlock_sliding_window(window);
+
+  ary = rb_ary_new_capa(length);
+  for (i = 0; i < length; i++) {
+    rb_ary_push(ary, LL2NUM(values[i]));
+  }
+  ALLOCV_END(buf);
+
+  return ary;
+}
+
+VALUE
+semian_sysv_sliding_window_push(VALUE self, VALUE value)
+{
+  semian_shm_sliding_window_t *window = get_sliding_window(self);
+  int64_t c_value = NUM2LL(value);
+
+  if (window->max_size == 0) {
+    return self;
+  }
+
+  lock_sliding_window(window);
+  if (window->length == window->max_size) {
+    // Make room by dropping the oldest value
+    window->start = (window->start + 1) % window->max_size;
+    window->length--;
+  }
+  window->values[(window->start + window->length) % window->max_size] = c_value;
+  __atomic_store_n(&window->length, window->length + 1, __ATOMIC_RELEASE);
+  window->generation++;
+  unlock_sliding_window(window);
+
+  return self;
+}
+
+VALUE
+semian_sysv_sliding_window_reject(VALUE self)
+{
+  semian_shm_sliding_window_t *window = get_sliding_window(self);
+  int64_t *values;
+  char *rejected;
+  uint64_t generation;
+  int32_t i, length, kept;
+  VALUE values_buf, rejected_buf;
+
+  RETURN_ENUMERATOR(self, 0, 0);
+
+  values = ALLOCV_N(int64_t, values_buf, window->max_size);
+  rejected = ALLOCV_N(char, rejected_buf, window->max_size);
+
+  for (;;) {
+    // Snapshot the window, the block can't be called with the lock held since it
+    // may switch threads, leaving other processes blocked on the lock meanwhile.
+    lock_sliding_window(window);
+    generation = window->generation;
+    length = window->length;
+    for (i = 0; i < length; i++) {
+      values[i] = sliding_window_at(window, i);
+    }
+    unlock_sliding_window(window);
+
+    for (i = 0; i < length; i++) {
+      rejected[i] = RTEST(rb_yield(LL2NUM(values[i])));
+    }
+
+    lock_sliding_window(window);
+    if (window->generation != generation) {
+      // Another thread or process changed the window while the block was running, start over
+      unlock_sliding_window(window);
+      continue;
+    }
+
+    kept = 0;
+    for (i = 0; i < length; i++) {
+      if (!rejected[i]) {
+        window->values[kept++] = values[i];
+      }
+    }
+    window->start = 0;
+    __atomic_store_n(&window->length, kept, __ATOMIC_RELEASE);
+    window->generation++;
+    unlock_sliding_window(window);
+    break;
+  }
+
+  ALLOCV_END(values_buf);
+  ALLOCV_END(rejected_buf);
+
+  return self;
+}
+
+VALUE
+semian_sysv_sliding_window_clear(VALUE self)
+{
+  semian_shm_sliding_window_t *window = get_sliding_window(self);
+
+  lock_sliding_window(window);
+  window->start = 0;
+  __atomic_store_n(&window->length, 0, __ATOMIC_RELEASE);
+  window->generation++;
+  unlock_sliding_window(window);
+
+  return self;
+}
+
+VALUE
+semian_sysv_sliding_window_destroy(VALUE self)
+{
+  semian_shm_object_t *obj;
+
+  semian_sysv_sliding_window_clear(self);
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_sliding_window_type, obj);
+  destroy_shared_memory(obj->shm_id);
+
+  return self;
+}
+
+static VALUE
+reject_local_sliding_window(VALUE p)
+{
+  reject_args_t *args = (reject_args_t *) p;
+  semian_sliding_window_t *window = args->window;
+  VALUE value;
+
+  // Kept values are moved down in place. The length is only updated by
+  // compact_local_sliding_window, so the window stays valid if the block raises.
+  for (; args->read < window->length; args->read++) {
+    value = *local_sliding_window_at(window, args->read);
+    if (!RTEST(rb_yield(value))) {
+      *local_sliding_window_at(window, args->write++) = value;
+    }
+  }
+  return Qnil;
+}
+
+static VALUE
+compact_local_sliding_window(VALUE p)
+{
+  reject_args_t *args = (reject_args_t *) p;
+  semian_sliding_window_t *window = args->window;
+  long length = window->length;
+  long i;
+
+  // Keep the values that weren't visited because the block raised
+  for (; args->read < length; args->read++) {
+    *local_sliding_window_at(window, args->write++) = *local_sliding_window_at(window, args->read);
+  }
+  for (i = args->write; i < length; i++) {
+    *local_sliding_window_at(window, i) = Qnil;
+  }
+  window->length = args->write;
+  window->rejecting = 0;
+  window->generation++;
+
+  return Qnil;
+}
+
+static VALUE
+reject_sliding_window_snapshot(VALUE p)
+{
+  snapshot_reject_args_t *args = (snapshot_reject_args_t *) p;
+
+  for (; args->visited < args->length; args->visited++) {
+    args->rejected[args->visited] = RTEST(rb_yield(args->values[args->visited]));
+  }
+  return Qnil;
+}
+
+static VALUE
+apply_sliding_window_snapshot(VALUE p)
+{
+  snapshot_reject_args_t *args = (snapshot_reject_args_t *) p;
+  semian_sliding_window_t *window = args->window;
+  long i, kept = 0;
+
+  if (window->generation != args->generation) {
+    return Qnil;
+  }
+
+  // Like the process local reject!, values that weren't visited because the block raised are kept
+  for (i = 0; i < args->length; i++) {
+    if (i >= args->visited || !args->rejected[i]) {
+      window->values[kept++] = args->values[i];
+      RB_OBJ_WRITTEN(args->self, Qundef, args->values[i]);
+    }
+  }
+  for (i = kept; i < window->max_size; i++) {
+    window->values[i] = Qnil;
+  }
+  window->start = 0;
+  window->length = kept;
+  window->generation++;
+  args->applied = 1;
+
+  return Qnil;
+}
+
+static void
+check_not_rejecting(semian_sliding_window_t *window)
+{
+  // Values are moved in place by reject!, so the window can't change until it returns
+  if (window->rejecting) {
+    rb_raise(rb_eRuntimeError, "can't modify a sliding window during reject!");
+  }
+}
+
+static semian_sliding_window_t *
+get_local_sliding_window(VALUE self)
+{
+  semian_sliding_window_t *window;
+
+  TypedData_Get_Struct(self, semian_sliding_window_t, &semian_local_sliding_window_type, window);
+  if (window->values == NULL) {
+    rb_raise(eInternal, "sliding window is not initialized");
+  }
+  return window;
+}
+
+static VALUE *
+local_sliding_window_at(semian_sliding_window_t *window, long index)
+{
+  return &window->values[(window->start + index) % window->max_size];
+}
+
+static VALUE
+semian_sliding_window_alloc(VALUE klass)
+{
+  semian_sliding_window_t *window;
+  return TypedData_Make_Struct(klass, semian_sliding_window_t, &semian_local_sliding_window_type, window);
+}
+
+static void
+semian_sliding_window_mark(void *ptr)
+{
+  semian_sliding_window_t *window = (semian_sliding_window_t *) ptr;
+  long i;
+
+  for (i = 0; i < window->length; i++) {
+    rb_gc_mark(*local_sliding_window_at(window, i));
+  }
+}
+
+static void
+semian_sliding_window_free(void *ptr)
+{
+  semian_sliding_window_t *window = (semian_sliding_window_t *) ptr;
+  xfree(window->values);
+  xfree(window);
+}
+
+static size_t
+semian_sliding_window_memsize(const void *ptr)
+{
+  const semian_sliding_window_t *window = (const semian_sliding_window_t *) ptr;
+  return sizeof(semian_sliding_window_t) + sizeof(VALUE) * window->max_size;
+}
+
+static VALUE
+semian_sysv_sliding_window_alloc(VALUE klass)
+{
+  semian_shm_object_t *obj;
+  VALUE self = TypedData_Make_Struct(klass, semian_shm_object_t, &semian_sliding_window_type, obj);
+  obj->shm_id = -1;
+  return self;
+}
+
+static void
+initialize_sliding_window(void *shm, void *arg)
+{
+  semian_shm_sliding_window_t *window = (semian_shm_sliding_window_t *) shm;
+  pthread_mutexattr_t attr;
+
+  window->max_size = *(int32_t *) arg;
+
+  // The lock is shared by every process, and must be recoverable if one dies while holding it
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&window->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+static semian_shm_sliding_window_t *
+get_sliding_window(VALUE self)
+{
+  semian_shm_object_t *obj;
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_sliding_window_type, obj);
+  if (obj->shm == NULL) {
+    rb_raise(eInternal, "sliding window is not attached to shared memory");
+  }
+  return (semian_shm_sliding_window_t *) obj->shm;
+}
+
+static void
+lock_sliding_window(semian_shm_sliding_window_t *window)
+{
+  int ret = pthread_mutex_lock(&window->lock);
+
+  if (ret == EOWNERDEAD) {
+    // The previous owner died in a critical section. Those only ever leave the ring
+    // buffer in a consistent state, so it's safe to keep using it.
+    pthread_mutex_consistent(&window->lock);
+  } else if (ret != 0) {
+    raise_semian_syscall_error("pthread_mutex_lock()", ret);
+  }
+}
+
+static void
+unlock_sliding_window(semian_shm_sliding_window_t *window)
+{
+  pthread_mutex_unlock(&window->lock);
+}
+
+static int64_t
+sliding_window_at(semian_shm_sliding_window_t *window, int32_t index)
+{
+  return window->values[(window->start + index) % window->max_size];
+}
+
+static const rb_data_type_t
+semian_local_sliding_window_type = {
+  "semian_local_sliding_window",
+  {
+    semian_sliding_window_mark,
+    semian_sliding_window_free,
+    semian_sliding_window_memsize
+  },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static const rb_data_type_t
+semian_sliding_window_type = {
+  "semian_sliding_window",
+  {
+    NULL,
+    semian_shm_object_free,
+    semian_shm_object_memsize
+  },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
@@ -0,0 +1,147 @@
+/*
+For semian's native sliding windows
+
+Implements Semian::Simple::SlidingWindow, a fixed-capacity ring buffer local
+to the process, which the ThreadSafe window builds upon. Pushing to a full
+window overwrites the oldest value in place instead of reallocating. The
+ThreadSafe window doesn't take a lock, native methods don't switch threads,
+and its reject! is optimistic.
+
+Also implements the storage of Semian::SysV::SlidingWindow, a ring buffer of
+timestamps kept in shared memory so that it is shared by every process on
+the host using the same circuit breaker.
+*/
+#ifndef SEMIAN_SLIDING_WINDOW_H
+#define SEMIAN_SLIDING_WINDOW_H
+
+#include "shared_memory.h"
+
+// Defines the native methods of the sliding window classes
+void
+init_sliding_window();
+
+/*
+ * call-seq:
+ *    Semian::Simple::SlidingWindow.new(max_size:) -> sliding_window
+ *
+ * Creates an empty window holding at most max_size values.
+ */
+VALUE
+semian_sliding_window_initialize(int argc, VALUE *argv, VALUE self);
+
+// Semian::Simple::SlidingWindow versions of the SysV methods below
+VALUE
+semian_sliding_window_size(VALUE self);
+
+VALUE
+semian_sliding_window_last(VALUE self);
+
+VALUE
+semian_sliding_window_max_size(VALUE self);
+
+VALUE
+semian_sliding_window_to_a(VALUE self);
+
+VALUE
+semian_sliding_window_push(VALUE self, VALUE value);
+
+VALUE
+semian_sliding_window_reject(VALUE self);
+
+VALUE
+semian_sliding_window_clear(VALUE self);
+
+/*
+ * call-seq:
+ *    sliding_window.reject! { |value| ... } -> sliding_window
+ *
+ * Semian::ThreadSafe::SlidingWindow version of reject!, which calls the block on a
+ * snapshot of the window and only writes the result back if no other thread changed
+ * the window meanwhile, starting over otherwise.
+ */
+VALUE
+semian_thread_safe_sliding_window_reject(VALUE self);
+
+/*
+ * call-seq:
+ *    sliding_window.initialize_shared_memory(name, max_size, permissions) -> sliding_window
+ *
+ * Attaches the sliding window to the shared memory segment for name, creating it if needed.
+ */
+VALUE
+semian_sysv_sliding_window_initialize(VALUE self, VALUE name, VALUE max_size, VALUE permissions);
+
+/*
+ * call-seq:
+ *    sliding_window.push(value) -> sliding_window
+ *
+ * Appends a value, dropping the oldest one if the window is full.
+ */
+VALUE
+semian_sysv_sliding_window_push(VALUE self, VALUE value);
+
+/*
+ * call-seq:
+ *    sliding_window.reject! { |value| ... } -> sliding_window
+ *
+ * Removes every value for which the block returns true. The block is never
+ * called while holding the window's lock.
+ */
+VALUE
+semian_sysv_sliding_window_reject(VALUE self);
+
+/*
+ * call-seq:
+ *    sliding_window.size -> size
+ *
+ * Returns the number of values in the window.
+ */
+VALUE
+semian_sysv_sliding_window_size(VALUE self);
+
+/*
+ * call-seq:
+ *    sliding_window.last -> value
+ *
+ * Returns the most recently pushed value, or nil if the window is empty.
+ */
+VALUE
+semian_sysv_sliding_window_last(VALUE self);
+
+/*
+ * call-seq:
+ *    sliding_window.max_size -> max_size
+ *
+ * Returns the capacity of the window.
+ */
+VALUE
+semian_sysv_sliding_window_max_size(VALUE self);
+
+/*
+ * call-seq:
+ *    sliding_window.to_a -> array
+ *
+ * Returns the values in the window, oldest first.
+ */
+VALUE
+semian_sysv_sliding_window_to_a(VALUE self);
+
+/*
+ * call-seq:
+ *    sliding_window.clear -> sliding_window
+ *
+ * Removes every value from the window.
+ */
+VALUE
+semian_sysv_sliding_window_clear(VALUE self);
+
+/*
+ * call-seq:
+ *    sliding_window.destroy -> sliding_window
+ *
+ * Clears the window and marks its shared memory segment for removal.
+ */
+VALUE
+semian_sysv_sliding_window_destroy(VALUE self);
+
+#endif // SEMIAN_SLIDING_WINDOW_H
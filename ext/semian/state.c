@@ -0,0 +1,158 @@
+#include "state.h"
+
+// The values stored in shared memory for each state. Segments start zero-filled, so closed must be 0.
+enum semian_state {
+  SI_STATE_CLOSED = 0,
+  SI_STATE_OPEN = 1,
+  SI_STATE_HALF_OPEN = 2
+};
+
+static ID id_closed;
+static ID id_open;
+static ID id_half_open;
+
+static const rb_data_type_t
+semian_state_type;
+
+static semian_shm_state_t *
+get_state(VALUE self);
+
+static VALUE
+state_to_sym(int32_t value);
+
+static VALUE
+set_state(VALUE self, int32_t value);
+
+static VALUE
+semian_sysv_state_alloc(VALUE klass);
+
+void
+init_state()
+{
+  VALUE cSemian, cSysV, cState;
+
+  cSemian = rb_const_get(rb_cObject, rb_intern("Semian"));
+  cSysV = rb_const_get(cSemian, rb_intern("SysV"));
+  cState = rb_const_get(cSysV, rb_intern("State"));
+
+  rb_define_alloc_func(cState, semian_sysv_state_alloc);
+  rb_define_method(cState, "initialize_shared_memory", semian_sysv_state_initialize, 2);
+  rb_define_method(cState, "value", semian_sysv_state_value, 0);
+  rb_define_method(cState, "open!", semian_sysv_state_open, 0);
+  rb_define_method(cState, "close!", semian_sysv_state_close, 0);
+  rb_define_method(cState, "half_open!", semian_sysv_state_half_open, 0);
+  rb_define_method(cState, "reset", semian_sysv_state_close, 0);
+  rb_define_method(cState, "destroy", semian_sysv_state_destroy, 0);
+
+  id_closed = rb_intern("closed");
+  id_open = rb_intern("open");
+  id_half_open = rb_intern("half_open");
+}
+
+VALUE
+semian_sysv_state_initialize(VALUE self, VALUE name, VALUE permissions)
+{
+  semian_shm_object_t *obj;
+  char suffix[64];
+
+  Check_Type(name, T_STRING);
+  Check_Type(permissions, T_FIXNUM);
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_state_type, obj);
+
+  // Segments are zero-filled when created, which is the closed state
+  snprintf(suffix, sizeof(suffix), "_SHM_STATE_%zu", sizeof(semian_shm_state_t));
+  attach_shared_memory_object(obj, StringValueCStr(name), suffix, sizeof(semian_shm_state_t), FIX2LONG(permissions), NULL, NULL);
+
+  return self;
+}
+
+VALUE
+semian_sysv_state_value(VALUE self)
+{
+  semian_shm_state_t *state = get_state(self);
+  return state_to_sym(__atomic_load_n(&state->value, __ATOMIC_ACQUIRE));
+}
+
+VALUE
+semian_sysv_state_open(VALUE self)
+{
+  return set_state(self, SI_STATE_OPEN);
+}
+
+VALUE
+semian_sysv_state_close(VALUE self)
+{
+  return set_state(self, SI_STATE_CLOSED);
+}
+
+VALUE
+semian_sysv_state_half_open(VALUE self)
+{
+  return set_state(self, SI_STATE_HALF_OPEN);
+}
+
+VALUE
+semian_sysv_state_destroy(VALUE self)
+{
+  semian_shm_object_t *obj;
+  VALUE value = semian_sysv_state_close(self);
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_state_type, obj);
+  destroy_shared_memory(obj->shm_id);
+
+  return value;
+}
+
+static VALUE
+semian_sysv_state_alloc(VALUE klass)
+{
+  semian_shm_object_t *obj;
+  VALUE self = TypedData_Make_Struct(klass, semian_shm_object_t, &semian_state_type, obj);
+  obj->shm_id = -1;
+  return self;
+}
+
+static semian_shm_state_t *
+get_state(VALUE self)
+{
+  semian_shm_object_t *obj;
+
+  TypedData_Get_Struct(self, semian_shm_object_t, &semian_state_type, obj);
+  if (obj->shm == NULL) {
+    rb_raise(eInternal, "state is not attached to shared memory");
+  }
+  return (semian_shm_state_t *) obj->shm;
+}
+
+static VALUE
+set_state(VALUE self, int32_t value)
+{
+  semian_shm_state_t *state = get_state(self);
+  __atomic_store_n(&state->value, value, __ATOMIC_RELEASE);
+  return state_to_sym(value);
+}
+
+static VALUE
+state_to_sym(int32_t value)
+{
+  switch (value) {
+    case SI_STATE_OPEN:
+      return ID2SYM(id_open);
+    case SI_STATE_HALF_OPEN:
+      return ID2SYM(id_half_open);
+    default:
+      return ID2SYM(id_closed);
+  }
+}
+
+static const rb_data_type_t
+semian_state_type = {
+  "semian_state",
+  {
+    NULL,
+    semian_shm_object_free,
+    semian_shm_object_memsize
+  },
+  NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
@@ -0,0 +1,70 @@
+/*
+For semian's native circuit breaker states
+
+Implements Semian::SysV::State, the state of a circuit breaker kept in shared
+memory so that every process on the host sees the same state.
+*/
+#ifndef SEMIAN_STATE_H
+#define SEMIAN_STATE_H
+
+#include "shared_memory.h"
+
+// Defines the native methods of the state classes
+void
+init_state();
+
+/*
+ * call-seq:
+ *    state.initialize_shared_memory(name, permissions) -> state
+ *
+ * Attaches the state to the shared memory segment for name, creating it if needed.
+ */
+VALUE
+semian_sysv_state_initialize(VALUE self, VALUE name, VALUE permissions);
+
+/*
+ * call-seq:
+ *    state.value -> :closed, :open or :half_open
+ *
+ * Returns the current state.
+ */
+VALUE
+semian_sysv_state_value(VALUE self);
+
+/*
+ * call-seq:
+ *    state.open! -> :open
+ *
+ * Transitions to the open state.
+ */
+VALUE
+semian_sysv_state_open(VALUE self);
+
+/*
+ * call-seq:
+ *    state.close! -> :closed
+ *
+ * Transitions to the closed state.
+ */
+VALUE
+semian_sysv_state_close(VALUE self);
+
+/*
+ * call-seq:
+ *    state.half_open! -> :half_open
+ *
+ * Transitions to the half open state.
+ */
+VALUE
+semian_sysv_state_half_open(VALUE self);
+
+/*
+ * call-seq:
+ *    state.destroy -> :closed
+ *
+ * Resets the state and marks its shared memory segment for removal.
+ */
+VALUE
+semian_sysv_state_destroy(VALUE self);
+
+#endif // SEMIAN_STATE_H
@@ -0,0 +1,367 @@
+#include "stats.h"
+#include "histogram.h"
+#include "sysv_semaphores.h"
+
+#include <sched.h>
+
+// Values of semian_stats_slot_t.circuit_state
+#define CIRCUIT_UNKNOWN 0
+#define CIRCUIT_CLOSED 1
+#define CIRCUIT_OPEN 2
+#define CIRCUIT_HALF_OPEN 3
+
+// Values of semian_stats_slot_t.claimed
+#define SLOT_FREE 0
+#define SLOT_CLAIMED 1
+#define SLOT_CLAIMING -1
+
+// Values of semian_stats_slot_t.sem_id that aren't the id of a set
+#define SET_DESTROYED -1
+#define SET_PENDING -2
+
+static ID id_closed;
+static ID id_open;
+static ID id_half_open;
+static ID id_acquisitions;
+static ID id_timeouts;
+static ID id_in_flight;
+static ID id_circuit_state;
+static ID id_wait_time_histogram;
+
+// The host's statistics, attached at most once per process
+static semian_shm_object_t host_stats;
+
+static semian_stats_t *
+attach_host_stats(long permissions);
+
+static void
+initialize_host_stats(void *shm, void *arg);
+
+static semian_stats_slot_t *
+claim_stats_slot(semian_stats_t *stats, const char *name);
+
+static semian_stats_slot_t *
+reclaim_stats_slot(semian_stats_t *stats, const char *name);
+
+static int
+stats_slot_in_use(semian_stats_slot_t *slot);
+
+static int64_t
+sysv_in_flight(semian_stats_slot_t *slot);
+
+static VALUE
+stats_slot_to_hash(semian_stats_slot_t *slot);
+
+void
+init_stats()
+{
+  id_closed = rb_intern("closed");
+  id_open = rb_intern("open");
+  id_half_open = rb_intern("half_open");
+  id_acquisitions = rb_intern("acquisitions");
+  id_timeouts = rb_intern("timeouts");
+  id_in_flight = rb_intern("in_flight");
+  id_circuit_state = rb_intern("circuit_state");
+  id_wait_time_histogram = rb_intern("wait_time_histogram");
+}
+
+void
+attach_resource_stats(semian_resource_t *res, long permissions)
+{
+  semian_stats_t *stats;
+
+  if (strlen(res->name) >= SEMIAN_STATS_MAX_NAME) {
+    rb_raise(rb_eArgError, "the names of resources with stats must be shorter than %d characters", SEMIAN_STATS_MAX_NAME);
+  }
+
+  stats = attach_host_stats(permissions);
+  res->stats = claim_stats_slot(stats, res->name);
+  if (res->stats == NULL) {
+    res->stats = reclaim_stats_slot(stats, res->name);
+  }
+  if (res->stats == NULL) {
+    rb_warn("the host's stats are full, they hold at most %d resources in use, '%s' has no stats",
+            SEMIAN_STATS_CAPACITY, res->name);
+  }
+}
+
+void
+publish_stats_semaphore_set(semian_resource_t *res)
+{
+  if (res->stats == NULL) {
+    return;
+  }
+  __atomic_store_n(&res->stats->sem_base, res->sem_base, __ATOMIC_RELAXED);
+  __atomic_store_n(&res->stats->shm_tickets, res->shm_tickets != NULL, __ATOMIC_RELAXED);
+  __atomic_store_n(&res->stats->sem_id, res->sem_id, __ATOMIC_RELEASE);
+}
+
+void
+release_resource_stats(semian_resource_t *res)
+{
+  if (res->stats == NULL) {
+    return;
+  }
+  __atomic_store_n(&res->stats->sem_id, SET_DESTROYED, __ATOMIC_RELEASE);
+  res->stats = NULL;
+}
+
+void
+record_stats_acquired(semian_stats_slot_t *stats, long wait_time)
+{
+  if (stats == NULL) {
+    return;
+  }
+  __atomic_add_fetch(&stats->acquisitions, 1, __ATOMIC_RELAXED);
+  if (__atomic_load_n(&stats->shm_tickets, __ATOMIC_RELAXED)) {
+    __atomic_add_fetch(&stats->in_flight, 1, __ATOMIC_RELAXED);
+  }
+  record_histogram_value(&stats->wait_time_histogram, wait_time > 0 ? wait_time / 1000 : 0);
+}
+
+void
+record_stats_released(semian_stats_slot_t *stats)
+{
+  if (stats == NULL || !__atomic_load_n(&stats->shm_tickets, __ATOMIC_RELAXED)) {
+    return;
+  }
+  __atomic_sub_fetch(&stats->in_flight, 1, __ATOMIC_RELAXED);
+}
+
+void
+record_stats_reaped(semian_stats_slot_t *stats, int held)
+{
+  if (stats == NULL) {
+    return;
+  }
+  __atomic_sub_fetch(&stats->in_flight, held, __ATOMIC_RELAXED);
+}
+
+void
+record_stats_timeout(semian_stats_slot_t *stats)
+{
+  if (stats == NULL) {
+    return;
+  }
+  __atomic_add_fetch(&stats->timeouts, 1, __ATOMIC_RELAXED);
+}
+
+void
+record_stats_circuit_state(semian_stats_slot_t *stats, VALUE state)
+{
+  int32_t value;
+
+  if (state == ID2SYM(id_closed)) {
+    value = CIRCUIT_CLOSED;
+  } else if (state == ID2SYM(id_open)) {
+    value = CIRCUIT_OPEN;
+  } else if (state == ID2SYM(id_half_open)) {
+    value = CIRCUIT_HALF_OPEN;
+  } else {
+    rb_raise(rb_eArgError, "circuit state must be one of :closed, :open or :half_open");
+  }
+
+  if (stats != NULL) {
+    __atomic_store_n(&stats->circuit_state, value, __ATOMIC_RELAXED);
+  }
+}
+
+VALUE
+semian_resource_stats_snapshot(VALUE klass, VALUE permissions)
+{
+  semian_stats_t *stats;
+  semian_stats_slot_t *slot;
+  VALUE snapshot = rb_hash_new();
+  int i;
+
+  Check_Type(permissions, T_FIXNUM);
+  stats = attach_host_stats(FIX2LONG(permissions));
+
+  for (i = 0; i < SEMIAN_STATS_CAPACITY; i++) {
+    slot = &stats->slots[i];
+    // Slots being claimed are skipped, they have nothing to report yet
+    if (__atomic_load_n(&slot->claimed, __ATOMIC_ACQUIRE) != SLOT_CLAIMED) {
+      continue;
+    }
+    rb_hash_aset(snapshot, rb_str_new_cstr(slot->name), stats_slot_to_hash(slot));
+  }
+
+  return snapshot;
+}
+
+static semian_stats_t *
+attach_host_stats(long permissions)
+{
+  char suffix[64];
+
+  if (host_stats.shm == NULL) {
+    snprintf(suffix, sizeof(suffix), "_STATS_%d_%zu", SEMIAN_STATS_CAPACITY, sizeof(semian_stats_slot_t));
+    attach_shared_memory_object(&host_stats, "semian_host_stats", suffix, sizeof(semian_stats_t),
+                                permissions, initialize_host_stats, NULL);
+  }
+  return (semian_stats_t *) host_stats.shm;
+}
+
+static void
+initialize_host_stats(void *shm, void *arg)
+{
+  semian_stats_t *stats = (semian_stats_t *) shm;
+  pthread_mutexattr_t attr;
+
+  // The lock is shared by every process, and must be recoverable if one dies while holding it
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&stats->reclaim_lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+// Unlike resource pools, there is no semaphore set to serialize claiming slots with, so a slot
+// is marked as being claimed until its name is written. Names never move once claimed.
+static semian_stats_slot_t *
+claim_stats_slot(semian_stats_t *stats, const char *name)
+{
+  uint32_t start = hash_fnv1a(FNV1A_OFFSET_BASIS, name) % SEMIAN_STATS_CAPACITY;
+  semian_stats_slot_t *slot;
+  int32_t claimed;
+  int i;
+
+  for (i = 0; i < SEMIAN_STATS_CAPACITY; i++) {
+    slot = &stats->slots[(start + i) % SEMIAN_STATS_CAPACITY];
+
+    claimed = SLOT_FREE;
+    if (__atomic_compare_exchange_n(&slot->claimed, &claimed, SLOT_CLAIMING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      strncpy(slot->name, name, SEMIAN_STATS_MAX_NAME - 1);
+      slot->sem_id = SET_PENDING;
+      __atomic_store_n(&slot->claimed, SLOT_CLAIMED, __ATOMIC_RELEASE);
+      return slot;
+    }
+
+    while (claimed == SLOT_CLAIMING) {
+      sched_yield();
+      claimed = __atomic_load_n(&slot->claimed, __ATOMIC_ACQUIRE);
+    }
+    if (strncmp(slot->name, name, SEMIAN_STATS_MAX_NAME) == 0) {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+// Once every slot was claimed, hands the slot of a resource no longer in use to name. Slots are
+// renamed rather than freed, so the probing of claim_stats_slot still finds every name.
+static semian_stats_slot_t *
+reclaim_stats_slot(semian_stats_t *stats, const char *name)
+{
+  semian_stats_slot_t *slot, *reclaimed = NULL;
+  int32_t claimed;
+  int ret, i;
+
+  ret = pthread_mutex_lock(&stats->reclaim_lock);
+  if (ret == EOWNERDEAD) {
+    // The previous owner died handing a slot over, at worst leaving it with stale counters
+    pthread_mutex_consistent(&stats->reclaim_lock);
+  } else if (ret != 0) {
+    return NULL;
+  }
+
+  // Another process may have reclaimed a slot for the same name while this one was waiting
+  for (i = 0; i < SEMIAN_STATS_CAPACITY && reclaimed == NULL; i++) {
+    slot = &stats->slots[i];
+    if (__atomic_load_n(&slot->claimed, __ATOMIC_ACQUIRE) == SLOT_CLAIMED &&
+        strncmp(slot->name, name, SEMIAN_STATS_MAX_NAME) == 0) {
+      reclaimed = slot;
+    }
+  }
+
+  for (i = 0; i < SEMIAN_STATS_CAPACITY && reclaimed == NULL; i++) {
+    slot = &stats->slots[i];
+    claimed = SLOT_CLAIMED;
+    if (stats_slot_in_use(slot) ||
+        !__atomic_compare_exchange_n(&slot->claimed, &claimed, SLOT_CLAIMING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    memset(slot, 0, sizeof(semian_stats_slot_t));
+    slot->claimed = SLOT_CLAIMING;
+    strncpy(slot->name, name, SEMIAN_STATS_MAX_NAME - 1);
+    slot->sem_id = SET_PENDING;
+    __atomic_store_n(&slot->claimed, SLOT_CLAIMED, __ATOMIC_RELEASE);
+    reclaimed = slot;
+  }
+
+  pthread_mutex_unlock(&stats->reclaim_lock);
+  return reclaimed;
+}
+
+// A slot is in use until its resource is destroyed, or until no process is registered with it
+static int
+stats_slot_in_use(semian_stats_slot_t *slot)
+{
+  int sem_id = __atomic_load_n(&slot->sem_id, __ATOMIC_ACQUIRE);
+  int workers;
+
+  if (sem_id == SET_PENDING) {
+    return 1;
+  }
+  if (sem_id == SET_DESTROYED) {
+    return 0;
+  }
+  workers = semctl(sem_id, __atomic_load_n(&slot->sem_base, __ATOMIC_RELAXED) + SI_SEM_REGISTERED_WORKERS, GETVAL);
+  if (workers == -1) {
+    return errno != EINVAL && errno != EIDRM;
+  }
+  return workers > 0;
+}
+
+// Tickets held from the semaphore set are given back by the kernel when their process dies, so
+// those in flight are the configured tickets that aren't free, rather than a count kept by callers
+static int64_t
+sysv_in_flight(semian_stats_slot_t *slot)
+{
+  int sem_id = __atomic_load_n(&slot->sem_id, __ATOMIC_ACQUIRE);
+  int sem_base = __atomic_load_n(&slot->sem_base, __ATOMIC_RELAXED);
+  int configured, free;
+
+  if (sem_id < 0) {
+    return 0;
+  }
+  configured = semctl(sem_id, sem_base + SI_SEM_CONFIGURED_TICKETS, GETVAL);
+  free = semctl(sem_id, sem_base + SI_SEM_TICKETS, GETVAL);
+  if (configured == -1 || free == -1 || free >= configured) {
+    return 0;
+  }
+  return configured - free;
+}
+
+static VALUE
+stats_slot_to_hash(semian_stats_slot_t *slot)
+{
+  VALUE hash = rb_hash_new();
+  VALUE circuit_state = Qnil;
+  int64_t in_flight;
+
+  switch (__atomic_load_n(&slot->circuit_state, __ATOMIC_RELAXED)) {
+    case CIRCUIT_CLOSED:
+      circuit_state = ID2SYM(id_closed);
+      break;
+    case CIRCUIT_OPEN:
+      circuit_state = ID2SYM(id_open);
+      break;
+    case CIRCUIT_HALF_OPEN:
+      circuit_state = ID2SYM(id_half_open);
+      break;
+  }
+
+  rb_hash_aset(hash, ID2SYM(id_acquisitions), ULL2NUM(__atomic_load_n(&slot->acquisitions, __ATOMIC_RELAXED)));
+  rb_hash_aset(hash, ID2SYM(id_timeouts), ULL2NUM(__atomic_load_n(&slot->timeouts, __ATOMIC_RELAXED)));
+  if (__atomic_load_n(&slot->shm_tickets, __ATOMIC_RELAXED)) {
+    in_flight = __atomic_load_n(&slot->in_flight, __ATOMIC_RELAXED);
+  } else {
+    in_flight = sysv_in_flight(slot);
+  }
+  rb_hash_aset(hash, ID2SYM(id_in_flight), LL2NUM(in_flight));
+  rb_hash_aset(hash, ID2SYM(id_circuit_state), circuit_state);
+  rb_hash_aset(hash, ID2SYM(id_wait_time_histogram), histogram_to_hash(&slot->wait_time_histogram));
+  return hash;
+}
@@ -0,0 +1,78 @@
+/*
+For semian's host-wide statistics
+
+Resources created with stats enabled keep their counters in a single shared
+memory segment for the whole host, instead of in the memory of every process.
+Every resource name is given a slot, claimed through an open-addressing index
+like the one of resource pools, holding how many tickets were acquired, how
+many callers timed out, how many tickets are held right now, how long callers
+waited and the last state of the circuit breaker.
+
+Recording is a relaxed atomic operation on the slot, so it never takes a lock
+and is safe without the GVL. A process reading the segment, such as a metrics
+sidecar, sees every resource of the host with a single mapping.
+
+Tickets held by processes that die are given back to the bulkhead, so they
+leave in_flight too. For the semaphore ticket backend it is read from the set when taking a
+snapshot, as the configured tickets that aren't free. The shared memory
+backend counts it, and subtracts the tickets of dead owners as it reaps them.
+
+Slots are given back when their resource is destroyed. Once every slot was
+claimed, the slot of a resource no longer in use, one whose set no process is
+registered with, goes to the next new name. If there is none, the resource has
+no stats.
+*/
+#ifndef SEMIAN_STATS_H
+#define SEMIAN_STATS_H
+
+#include "shared_memory.h"
+
+// Set up the symbols of circuit states
+void
+init_stats();
+
+// Claim the slot of the resource's name in the host's statistics, attaching to them first if needed.
+// Leaves res->stats NULL with a warning if they are full.
+void
+attach_resource_stats(semian_resource_t *res, long permissions);
+
+// Record the semaphore set of the resource in its slot, once the set is initialized
+void
+publish_stats_semaphore_set(semian_resource_t *res);
+
+// Give the slot of a destroyed resource back
+void
+release_resource_stats(semian_resource_t *res);
+
+// Count a ticket acquired after waiting wait_time nanoseconds
+void
+record_stats_acquired(semian_stats_slot_t *stats, long wait_time);
+
+// Count a ticket handed back
+void
+record_stats_released(semian_stats_slot_t *stats);
+
+// Subtract the tickets held by a dead owner of shared memory tickets from in_flight
+void
+record_stats_reaped(semian_stats_slot_t *stats, int held);
+
+// Count a caller that gave up waiting for a ticket
+void
+record_stats_timeout(semian_stats_slot_t *stats);
+
+// Publish the state of a circuit breaker, one of :closed, :open or :half_open
+void
+record_stats_circuit_state(semian_stats_slot_t *stats, VALUE state);
+
+/*
+ * call-seq:
+ *    Semian::Resource.stats_snapshot(permissions) -> hash
+ *
+ * Reads the statistics of every resource of the host, keyed by name. Each of them is a hash
+ * of :acquisitions, :timeouts, :in_flight, :circuit_state (nil until a circuit breaker
+ * published it) and :wait_time_histogram, as returned by Semian::Resource#wait_time_histogram.
+ */
+VALUE
+semian_resource_stats_snapshot(VALUE klass, VALUE permissions);
+
+#endif // SEMIAN_STATS_H
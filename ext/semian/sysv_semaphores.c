@@ -1,8 +1,20 @@
 #include "sysv_semaphores.h"
+#include "histogram.h"
+#include "resource_pool.h"
+#include "shm_tickets.h"
 #include <time.h>
+#include <unistd.h>
+
+// Most operations in a single semop, the default SEMOPM on Linux
+#define MAX_SEMOPS 500
+
+typedef struct {
+  int sem_id;
+  int error;
+} wait_for_initialization_args_t;
 
 static key_t
-generate_key(const char *name);
+generate_key(const char *name, int num_semaphores);
 
 static void *
 acquire_semaphore(void *p);
@@ -10,11 +22,43 @@ acquire_semaphore(void *p);
 static int
 wait_for_new_semaphore_set(key_t key, long permissions);
 
+static void *
+wait_for_initialization(void *p);
+
 static void
-initialize_new_semaphore_values(int sem_id, long permissions);
+initialize_new_semaphore_values(int sem_id, int num_semaphores, int group_size);
 
 static long
-diff_timespec_ms(struct timespec *end, struct timespec *begin);
+diff_timespec_ns(struct timespec *end, struct timespec *begin);
+
+static int
+attach_semaphore_set(semian_resource_t *res, const char *name, int num_semaphores, int pool_capacity, long permissions);
+
+static semian_semaphore_set_entry_t *
+find_semaphore_set(const char *name);
+
+static int
+free_semaphore_set_entry(st_data_t name, st_data_t entry, st_data_t arg);
+
+static int
+join_semaphore_set(semian_resource_t *res, int register_worker);
+
+static void
+configure_quota_tickets(semian_resource_t *res);
+
+static int
+compare_resources_by_semaphore_set(const void *a, const void *b);
+
+static size_t
+ticket_sops(semian_resource_t *res, struct sembuf *sops, short flags);
+
+// Hash function of generate_ipc_key, one of SEMIAN_KEY_HASH_*
+static int ipc_key_hash = SEMIAN_KEY_HASH_SHA1;
+
+// The semaphore sets this process attached to, by name. Keys are never recomputed for a name,
+// and the ids of sets are reused until they are removed, which skips hashing, semget and
+// setting permissions when a resource is registered again.
+static st_table *semaphore_sets;
 
 // Generate string rep for sem indices for debugging puproses
 static const char *SEMINDEX_STRING[] = {
@@ -28,60 +72,173 @@ raise_semian_syscall_error(const char *syscall, int error_num)
 }
 
 void
-initialize_semaphore_set(semian_resource_t* res, const char* id_str, long permissions, int tickets, double quota)
+initialize_semaphore_set(semian_resource_t* res, const char* id_str, long permissions, int tickets, double quota, int shm_tickets,
+                         const char *pool_name, int pool_capacity, int adaptive, int register_worker,
+                         const int *scope_tickets)
 {
-
-  res->key = generate_key(id_str);
+  int shm_created = 0;
+  const char *set_name = pool_name ? pool_name : id_str;
+  int num_semaphores = SI_NUM_SEMAPHORES;
+  int cached, result;
+
+  if (pool_name) {
+    num_semaphores = (pool_capacity + 1) * SI_NUM_SEMAPHORES;
+  } else if (scope_tickets) {
+    num_semaphores = SI_NUM_SCOPED_SEMAPHORES;
+  }
+  cached = attach_semaphore_set(res, set_name, num_semaphores, pool_capacity, permissions);
   res->strkey = (char*)  malloc((2 /*for 0x*/+ sizeof(uint64_t) /*actual key*/+ 1 /*null*/) * sizeof(char));
   sprintf(res->strkey, "0x%08x", (unsigned int) res->key);
-  res->sem_id = semget(res->key, SI_NUM_SEMAPHORES, IPC_CREAT | IPC_EXCL | permissions);
 
-  /*
-  This approach is based on http://man7.org/tlpi/code/online/dist/svsem/svsem_good_init.c.html
-  which avoids race conditions when initializing semaphore sets.
-  */
-  if (res->sem_id != -1) {
-    // Happy path - we are the first worker, initialize the semaphore set.
-    initialize_new_semaphore_values(res->sem_id, permissions);
+  if (pool_name) {
+    res->sem_base = attach_resource_pool(res, id_str, pool_name, pool_capacity, permissions);
   } else {
-    // Something went wrong
-    if (errno != EEXIST) {
-      raise_semian_syscall_error("semget() failed to initialize semaphore values", errno);
-    } else {
-      // The semaphore set already exists, ensure it is initialized
-      res->sem_id = wait_for_new_semaphore_set(res->key, permissions);
-    }
+    res->sem_base = 0;
   }
 
-  set_semaphore_permissions(res->sem_id, permissions);
-
   /*
     Ensure that a worker for this process is registered.
     Note that from ruby we ensure that at most one worker may be registered per process.
   */
-  if (perform_semop(res->sem_id, SI_SEM_REGISTERED_WORKERS, 1, SEM_UNDO, NULL) == -1) {
+  result = join_semaphore_set(res, register_worker);
+  if (result == -1 && cached && (errno == EINVAL || errno == EIDRM)) {
+    // Another process removed the set since this process last used it
+    forget_semaphore_set(set_name);
+    attach_semaphore_set(res, set_name, num_semaphores, pool_capacity, permissions);
+    result = join_semaphore_set(res, register_worker);
+  }
+  if (result == -1) {
     rb_raise(eInternal, "error incrementing registered workers, errno: %d (%s)", errno, strerror(errno));
   }
+  res->registered_pid = register_worker ? getpid() : 0;
+
+  if (shm_tickets) {
+    shm_created = attach_shm_tickets(res, permissions);
+  }
+
+  // Once configured, quota tickets are resized by acquire, so workers don't wait for each other to register.
+  // A set left configured by workers that are all gone is configured again.
+  if (quota > 0 && !shm_created && !scope_tickets &&
+      get_sem_val(res->sem_id, res->sem_base + SI_SEM_CONFIGURED_TICKETS) != 0 &&
+      get_sem_val(res->sem_id, res->sem_base + SI_SEM_REGISTERED_WORKERS) > register_worker) {
+    return;
+  }
 
   int state = 0;
-  sem_meta_lock(res->sem_id); // Sets otime for the first time by acquiring the sem lock
+  sem_meta_lock(res->sem_id, res->sem_base); // Sets otime for the first time by acquiring the sem lock
 
   configure_tickets_args_t configure_tickets_args = (configure_tickets_args_t){
     .sem_id = res->sem_id,
+    .sem_base = res->sem_base,
     .tickets = tickets,
     .quota = quota,
+    .shm_tickets = res->shm_tickets,
+    .shm_created = shm_created,
+    .adaptive = adaptive,
+    .registered = register_worker,
+    .defer_quota = !register_worker,
+    .scope_tickets = scope_tickets,
   };
   rb_protect(
     configure_tickets,
     (VALUE)&configure_tickets_args,
     &state);
 
-  sem_meta_unlock(res->sem_id);
+  sem_meta_unlock(res->sem_id, res->sem_base);
+  if (state) {
+    rb_jump_tag(state);
+  }
+}
+
+long
+register_semaphore_workers(semian_resource_t **resources, long count)
+{
+  struct sembuf sops[MAX_SEMOPS];
+  pid_t pid = getpid();
+  long start, end, i, registered = 0;
+  size_t nsops;
+
+  // Duplicates end up next to each other, and every set is registered for in a single semop
+  qsort(resources, count, sizeof(semian_resource_t *), compare_resources_by_semaphore_set);
+
+  for (start = 0; start < count; start = end) {
+    nsops = 0;
+    for (end = start; end < count && nsops < MAX_SEMOPS && resources[end]->sem_id == resources[start]->sem_id; end++) {
+      if (resources[end]->registered_pid == pid || (end > start && resources[end] == resources[end - 1])) {
+        continue;
+      }
+      sops[nsops].sem_num = resources[end]->sem_base + SI_SEM_REGISTERED_WORKERS;
+      sops[nsops].sem_op = 1;
+      sops[nsops].sem_flg = SEM_UNDO;
+      nsops++;
+    }
+    if (nsops == 0) {
+      continue;
+    }
+
+    if (perform_semops(resources[start]->sem_id, sops, nsops, NULL) == -1) {
+      rb_raise(eInternal, "error incrementing registered workers, errno: %d (%s)", errno, strerror(errno));
+    }
+    registered += nsops;
+
+    for (i = start; i < end; i++) {
+      if (resources[i]->registered_pid != pid) {
+        resources[i]->registered_pid = pid;
+        // Only the first worker configures them, acquire resizes them for the other ones
+        if (resources[i]->quota > 0 && get_sem_val(resources[i]->sem_id, resources[i]->sem_base + SI_SEM_CONFIGURED_TICKETS) == 0) {
+          configure_quota_tickets(resources[i]);
+        }
+      }
+    }
+  }
+
+  return registered;
+}
+
+// Registers a worker of the resource, or only checks that its set still exists
+static int
+join_semaphore_set(semian_resource_t *res, int register_worker)
+{
+  if (register_worker) {
+    return perform_semop(res->sem_id, res->sem_base + SI_SEM_REGISTERED_WORKERS, 1, SEM_UNDO, NULL);
+  }
+  return semctl(res->sem_id, res->sem_base + SI_SEM_REGISTERED_WORKERS, GETVAL);
+}
+
+static void
+configure_quota_tickets(semian_resource_t *res)
+{
+  int state = 0;
+  configure_tickets_args_t configure_tickets_args = (configure_tickets_args_t){
+    .sem_id = res->sem_id,
+    .sem_base = res->sem_base,
+    .quota = res->quota,
+    .shm_tickets = res->shm_tickets,
+  };
+
+  sem_meta_lock(res->sem_id, res->sem_base);
+  rb_protect(configure_tickets, (VALUE)&configure_tickets_args, &state);
+  sem_meta_unlock(res->sem_id, res->sem_base);
   if (state) {
     rb_jump_tag(state);
   }
 }
 
+static int
+compare_resources_by_semaphore_set(const void *a, const void *b)
+{
+  const semian_resource_t *res_a = *(semian_resource_t * const *) a;
+  const semian_resource_t *res_b = *(semian_resource_t * const *) b;
+
+  if (res_a->sem_id != res_b->sem_id) {
+    return res_a->sem_id < res_b->sem_id ? -1 : 1;
+  }
+  if (res_a != res_b) {
+    return (uintptr_t) res_a < (uintptr_t) res_b ? -1 : 1;
+  }
+  return 0;
+}
+
 void
 set_semaphore_permissions(int sem_id, long permissions)
 {
@@ -98,19 +255,25 @@ set_semaphore_permissions(int sem_id, long permissions)
 }
 
 int
-perform_semop(int sem_id, short index, short op, short flags, struct timespec *ts)
+perform_semop(int sem_id, unsigned short index, short op, short flags, struct timespec *ts)
 {
-  int result;
   struct sembuf buf = { 0 };
 
   buf.sem_num = index;
   buf.sem_op  = op;
   buf.sem_flg = flags;
 
+  return perform_semops(sem_id, &buf, 1, ts);
+}
+
+int
+perform_semops(int sem_id, struct sembuf *sops, size_t nsops, struct timespec *ts)
+{
+  int result;
   int num_retries = 3;
 
   do {
-    result = semtimedop(sem_id, &buf, 1, ts);
+    result = semtimedop(sem_id, sops, nsops, ts);
   } while (result < 0 && errno == EINTR && num_retries-- > 0);
 
   return result;
@@ -121,30 +284,63 @@ get_sem_val(int sem_id, int sem_index)
 {
   int ret = semctl(sem_id, sem_index, GETVAL);
   if (ret == -1) {
-    rb_raise(eInternal, "error getting value of %s for sem %d, errno: %d (%s)", SEMINDEX_STRING[sem_index], sem_id, errno, strerror(errno));
+    // Past the first group, the layout depends on the set: scope limits or the slots of a pool
+    if (sem_index < SI_NUM_SEMAPHORES) {
+      rb_raise(eInternal, "error getting value of %s for sem %d, errno: %d (%s)", SEMINDEX_STRING[sem_index], sem_id, errno, strerror(errno));
+    }
+    rb_raise(eInternal, "error getting value of semaphore %d for sem %d, errno: %d (%s)", sem_index, sem_id, errno, strerror(errno));
   }
   return ret;
 }
 
 void
-sem_meta_lock(int sem_id)
+sem_meta_lock(int sem_id, unsigned short sem_base)
 {
   struct timespec ts = { 0 };
   ts.tv_sec = INTERNAL_TIMEOUT;
 
-  if (perform_semop(sem_id, SI_SEM_LOCK, -1, SEM_UNDO, &ts) == -1) {
+  if (perform_semop(sem_id, sem_base + SI_SEM_LOCK, -1, SEM_UNDO, &ts) == -1) {
     raise_semian_syscall_error("error acquiring internal semaphore lock, semtimedop()", errno);
   }
 }
 
 void
-sem_meta_unlock(int sem_id)
+sem_meta_unlock(int sem_id, unsigned short sem_base)
 {
-  if (perform_semop(sem_id, SI_SEM_LOCK, 1, SEM_UNDO, NULL) == -1) {
+  if (perform_semop(sem_id, sem_base + SI_SEM_LOCK, 1, SEM_UNDO, NULL) == -1) {
     raise_semian_syscall_error("error releasing internal semaphore lock, semop()", errno);
   }
 }
 
+int
+create_semaphore_set(key_t key, int num_semaphores, int group_size, long permissions)
+{
+  int sem_id = semget(key, num_semaphores, IPC_CREAT | IPC_EXCL | permissions);
+
+  /*
+  This approach is based on http://man7.org/tlpi/code/online/dist/svsem/svsem_good_init.c.html
+  which avoids race conditions when initializing semaphore sets.
+  */
+  if (sem_id != -1) {
+    // Happy path - we are the first worker, initialize the semaphore set.
+    initialize_new_semaphore_values(sem_id, num_semaphores, group_size);
+    // Set otime right away to signal the values are initialized, in case the caller raises before its first semop
+    sem_meta_lock(sem_id, 0);
+    sem_meta_unlock(sem_id, 0);
+  } else {
+    // Something went wrong
+    if (errno != EEXIST) {
+      raise_semian_syscall_error("semget() failed to initialize semaphore values", errno);
+    } else {
+      // The semaphore set already exists, ensure it is initialized
+      sem_id = wait_for_new_semaphore_set(key, permissions);
+    }
+  }
+
+  set_semaphore_permissions(sem_id, permissions);
+  return sem_id;
+}
+
 int
 get_semaphore(int key)
 {
@@ -158,6 +354,23 @@ acquire_semaphore_without_gvl(void *p)
   return NULL;
 }
 
+int
+try_acquire_semaphore(semian_resource_t *res)
+{
+  struct sembuf sops[3];
+  int result;
+
+  res->error = 0;
+  result = perform_semops(res->sem_id, sops, ticket_sops(res, sops, IPC_NOWAIT), NULL);
+  if (result == -1) {
+    if (errno != EAGAIN) {
+      res->error = errno;
+    }
+    return 0;
+  }
+  return 1;
+}
+
 static void *
 acquire_semaphore(void *p)
 {
@@ -169,31 +382,64 @@ acquire_semaphore(void *p)
 #endif
 
   struct timespec begin, end;
+  struct sembuf sops[3];
   int benchmark_result = clock_gettime(CLOCK_MONOTONIC, &begin);
-  if (perform_semop(res->sem_id, SI_SEM_TICKETS, -1, SEM_UNDO, &res->timeout) == -1) {
+  if (perform_semops(res->sem_id, sops, ticket_sops(res, sops, 0), &res->timeout) == -1) {
     res->error = errno;
   }
   if (benchmark_result == 0) {
     if (clock_gettime(CLOCK_MONOTONIC, &end) == 0) {
-      res->wait_time = diff_timespec_ms(&end, &begin);
+      res->wait_time = diff_timespec_ns(&end, &begin);
+      if (res->error == 0) {
+        record_histogram_interval(res->wait_time_histogram, &begin, &end);
+      }
     }
   }
   return NULL;
 }
 
-static key_t
-generate_key(const char *name)
+int
+release_semaphore(semian_resource_t *res)
+{
+  struct sembuf sops[] = {
+    { res->sem_base + SI_SEM_TICKETS, 1, SEM_UNDO },
+    { res->scope_sem, 1, SEM_UNDO },
+  };
+  return perform_semops(res->sem_id, sops, res->scope_sem ? 2 : 1, NULL);
+}
+
+// Fills in the operations taking a ticket, and a ticket of the scope limit of the acquire if it has one.
+// Returns the number of operations, at most 3.
+static size_t
+ticket_sops(semian_resource_t *res, struct sembuf *sops, short flags)
+{
+  size_t nsops = 0;
+
+  if (res->reserve > 0) {
+    // Waits for more than the reserved tickets to be available, then takes a single one
+    sops[nsops++] = (struct sembuf) { res->sem_base + SI_SEM_TICKETS, -(res->reserve + 1), SEM_UNDO | flags };
+    sops[nsops++] = (struct sembuf) { res->sem_base + SI_SEM_TICKETS, res->reserve, SEM_UNDO | flags };
+  } else {
+    sops[nsops++] = (struct sembuf) { res->sem_base + SI_SEM_TICKETS, -1, SEM_UNDO | flags };
+  }
+  if (res->scope_sem) {
+    sops[nsops++] = (struct sembuf) { res->scope_sem, -1, SEM_UNDO | flags };
+  }
+  return nsops;
+}
+
+key_t
+generate_ipc_key(const char *name, const char *suffix)
 {
-  char semset_size_key[20];
   char *uniq_id_str;
 
-  // It is necessary for the cardinatily of the semaphore set to be part of the key
-  // or else sem_get will complain that we have requested an incorrect number of sems
-  // for the desired key, and have changed the number of semaphores for a given key
-  sprintf(semset_size_key, "_NUM_SEMS_%d", SI_NUM_SEMAPHORES);
-  uniq_id_str = malloc(strlen(name)+strlen(semset_size_key)+1);
+  if (ipc_key_hash == SEMIAN_KEY_HASH_FNV1A) {
+    return (key_t) hash_fnv1a(hash_fnv1a(FNV1A_OFFSET_BASIS, name), suffix);
+  }
+
+  uniq_id_str = malloc(strlen(name)+strlen(suffix)+1);
   strcpy(uniq_id_str, name);
-  strcat(uniq_id_str, semset_size_key);
+  strcat(uniq_id_str, suffix);
 
   union {
     unsigned char str[SHA_DIGEST_LENGTH];
@@ -205,17 +451,135 @@ generate_key(const char *name)
   return digest.key;
 }
 
+void
+set_ipc_key_hash(int hash)
+{
+  if (hash == ipc_key_hash) {
+    return;
+  }
+  // Cached keys were derived with the previous hash function
+  if (semaphore_sets) {
+    st_foreach(semaphore_sets, free_semaphore_set_entry, 0);
+    st_clear(semaphore_sets);
+  }
+  ipc_key_hash = hash;
+}
 
-static void
-initialize_new_semaphore_values(int sem_id, long permissions)
+int
+get_ipc_key_hash()
 {
-  unsigned short init_vals[SI_NUM_SEMAPHORES];
+  return ipc_key_hash;
+}
 
-  init_vals[SI_SEM_TICKETS] = init_vals[SI_SEM_CONFIGURED_TICKETS] = 0;
-  init_vals[SI_SEM_REGISTERED_WORKERS] = 0;
-  init_vals[SI_SEM_LOCK] = 1;
+uint32_t
+hash_fnv1a(uint32_t hash, const char *str)
+{
+  for (; *str; str++) {
+    hash ^= (unsigned char) *str;
+    hash *= 16777619u;
+  }
+  return hash;
+}
 
-  if (semctl(sem_id, 0, SETALL, init_vals) == -1) {
+void
+forget_semaphore_set(const char *name)
+{
+  semian_semaphore_set_entry_t *entry = find_semaphore_set(name);
+
+  if (entry) {
+    entry->sem_id = -1;
+  }
+}
+
+// Returns true if the id of the set was cached, in which case the set may have been removed since
+static int
+attach_semaphore_set(semian_resource_t *res, const char *name, int num_semaphores, int pool_capacity, long permissions)
+{
+  semian_semaphore_set_entry_t *entry;
+
+  if (!semaphore_sets) {
+    semaphore_sets = st_init_strtable();
+  }
+
+  entry = find_semaphore_set(name);
+  if (entry && entry->num_semaphores != num_semaphores) {
+    // A pool and a resource may share a name, keep the most recent of them
+    st_delete(semaphore_sets, (st_data_t *) &entry->name, NULL);
+    free_semaphore_set_entry(0, (st_data_t) entry, 0);
+    entry = NULL;
+  }
+  if (!entry) {
+    entry = ALLOC(semian_semaphore_set_entry_t);
+    entry->name = strdup(name);
+    entry->num_semaphores = num_semaphores;
+    entry->key = pool_capacity ? generate_pool_key(name, pool_capacity) : generate_key(name, num_semaphores);
+    entry->sem_id = -1;
+    entry->permissions = permissions;
+    st_insert(semaphore_sets, (st_data_t) entry->name, (st_data_t) entry);
+  }
+
+  res->key = entry->key;
+  if (entry->sem_id != -1 && entry->permissions == permissions) {
+    res->sem_id = entry->sem_id;
+    return 1;
+  }
+
+  // Pools hold a group of semaphores per resource, other sets a single one
+  res->sem_id = create_semaphore_set(entry->key, num_semaphores, pool_capacity ? SI_NUM_SEMAPHORES : num_semaphores,
+                                     permissions);
+  entry->sem_id = res->sem_id;
+  entry->permissions = permissions;
+  return 0;
+}
+
+static semian_semaphore_set_entry_t *
+find_semaphore_set(const char *name)
+{
+  st_data_t entry;
+
+  if (semaphore_sets && st_lookup(semaphore_sets, (st_data_t) name, &entry)) {
+    return (semian_semaphore_set_entry_t *) entry;
+  }
+  return NULL;
+}
+
+static int
+free_semaphore_set_entry(st_data_t name, st_data_t entry, st_data_t arg)
+{
+  free(((semian_semaphore_set_entry_t *) entry)->name);
+  xfree((semian_semaphore_set_entry_t *) entry);
+  return ST_CONTINUE;
+}
+
+static key_t
+generate_key(const char *name, int num_semaphores)
+{
+  char semset_size_key[20];
+
+  // It is necessary for the cardinatily of the semaphore set to be part of the key
+  // or else sem_get will complain that we have requested an incorrect number of sems
+  // for the desired key, and have changed the number of semaphores for a given key
+  sprintf(semset_size_key, "_NUM_SEMS_%d", num_semaphores);
+  return generate_ipc_key(name, semset_size_key);
+}
+
+
+static void
+initialize_new_semaphore_values(int sem_id, int num_semaphores, int group_size)
+{
+  unsigned short *init_vals;
+  int i, ret;
+
+  // Sets hold groups of group_size semaphores, one per resource for resource pools,
+  // and are all initialized at once. Only the lock of each group starts at 1.
+  init_vals = ZALLOC_N(unsigned short, num_semaphores);
+  for (i = 0; i < num_semaphores; i += group_size) {
+    init_vals[i + SI_SEM_LOCK] = 1;
+  }
+
+  ret = semctl(sem_id, 0, SETALL, init_vals);
+  xfree(init_vals);
+  if (ret == -1) {
     raise_semian_syscall_error("semctl()", errno);
   }
 #ifdef DEBUG
@@ -226,46 +590,63 @@ initialize_new_semaphore_values(int sem_id, long permissions)
 static int
 wait_for_new_semaphore_set(key_t key, long permissions)
 {
-  int i;
-  int sem_id = -1;
+  wait_for_initialization_args_t args = { 0 };
   union semun sem_opts;
   struct semid_ds sem_ds;
 
   sem_opts.buf = &sem_ds;
-  sem_id = semget(key, 1, permissions);
+  args.sem_id = semget(key, 1, permissions);
 
-  if (sem_id == -1){
+  if (args.sem_id == -1){
       raise_semian_syscall_error("semget()", errno);
   }
 
-  for (i = 0; i < ((INTERNAL_TIMEOUT * MICROSECONDS_IN_SECOND) / INIT_WAIT); i++) {
-
-    if (semctl(sem_id, 0, IPC_STAT, sem_opts) == -1) {
-      raise_semian_syscall_error("semctl()", errno);
-    }
+  if (semctl(args.sem_id, 0, IPC_STAT, sem_opts) == -1) {
+    raise_semian_syscall_error("semctl()", errno);
+  }
 
-    // If a semop has been performed by someone else, the values must be initialized
-    if (sem_ds.sem_otime != 0) {
-      break;
-    }
+  // If a semop has been performed by someone else, the values must be initialized
+  if (sem_ds.sem_otime != 0) {
+    return args.sem_id;
+  }
 
 #ifdef DEBUG
-    printf("Waiting for another process to initialize semaphore values, checked: %d times\n", i);
+  printf("Waiting for another process to initialize semaphore values\n");
 #endif
-    usleep(INIT_WAIT);
-  }
+  WITHOUT_GVL(wait_for_initialization, &args, RUBY_UBF_IO, NULL);
 
-  if (sem_ds.sem_otime == 0) {
-    rb_raise(eTimeout, "error: timeout waiting for semaphore values to initialize after %d checks", INTERNAL_TIMEOUT);
+  if (args.error == EAGAIN) {
+    rb_raise(eTimeout, "error: timeout waiting for semaphore values to initialize after %d seconds", INTERNAL_TIMEOUT);
+  } else if (args.error != 0) {
+    raise_semian_syscall_error("error waiting for semaphore values to initialize, semtimedop()", args.error);
   }
 
-  return sem_id;
+  return args.sem_id;
+}
+
+static void *
+wait_for_initialization(void *p)
+{
+  wait_for_initialization_args_t *args = (wait_for_initialization_args_t *) p;
+  struct timespec ts = { 0 };
+  ts.tv_sec = INTERNAL_TIMEOUT;
+
+  // Semaphores start out at zero, so the lock of the first group only becomes available once the
+  // creator has set the initial values with SETALL. Taking and handing it back in a single
+  // operation sleeps in the kernel until then, without holding on to the lock.
+  struct sembuf sops[] = {
+    { .sem_num = SI_SEM_LOCK, .sem_op = -1, .sem_flg = 0 },
+    { .sem_num = SI_SEM_LOCK, .sem_op = 1, .sem_flg = 0 },
+  };
+
+  if (perform_semops(args->sem_id, sops, 2, &ts) == -1) {
+    args->error = errno;
+  }
+  return NULL;
 }
 
 static long
-diff_timespec_ms(struct timespec *end, struct timespec *begin)
+diff_timespec_ns(struct timespec *end, struct timespec *begin)
 {
-  long end_ms = (end->tv_sec * 1e3) + (end->tv_nsec / 1e6);
-  long begin_ms = (begin->tv_sec * 1e3) + (begin->tv_nsec / 1e6);
-  return end_ms - begin_ms;
+  return (end->tv_sec - begin->tv_sec) * NANOSECONDS_IN_SECOND + (end->tv_nsec - begin->tv_nsec);
 }
@@ -33,11 +33,7 @@ typedef VALUE (*my_blocking_fn_t)(void*);
 // Time to wait for timed ops to complete
 #define INTERNAL_TIMEOUT 5 /* seconds */
 
-// Time to wait while checking if semaphore has been initialized
-#define INIT_WAIT 10 /* microseconds */
-
-// Helper definition to prevent magic number for conversion of microseconds to seconds
-#define MICROSECONDS_IN_SECOND 1000000
+#define NANOSECONDS_IN_SECOND 1000000000L
 
 // Here we define an enum value and string representation of each semaphore
 // This allows us to key the sem value and string rep in sync easily
@@ -48,6 +44,8 @@ typedef VALUE (*my_blocking_fn_t)(void*);
 //   SI_SEM_CONFIGURED_TICKETS  semaphore to track the desired number of tickets available for issue
 //   SI_SEM_REGISTERED_WORKERS  semaphore for the number of workers currently registered
 //   SI_NUM_SEMAPHORES          always leave this as last entry for count to be accurate
+// Resources in a resource pool use the SI_NUM_SEMAPHORES semaphores starting at their sem_base,
+// while other resources have a set of their own with a sem_base of 0.
 #define FOREACH_SEMINDEX(SEMINDEX) \
         SEMINDEX(SI_SEM_LOCK)   \
         SEMINDEX(SI_SEM_TICKETS)   \
@@ -63,40 +61,97 @@ enum SEMINDEX_ENUM {
     FOREACH_SEMINDEX(GENERATE_ENUM)
 };
 
+// Resources with scope_tickets have a larger set of their own, keyed by its size, with these
+// semaphores after the SI_NUM_SEMAPHORES ones. Other resources keep the smaller set.
+//   SI_SEM_SCOPE_TICKETS_0 + n             tickets scope n may still take, taken in the same semop
+//                                          as SI_SEM_TICKETS (n < SEMIAN_MAX_SCOPE_LIMITS)
+//   SI_SEM_SCOPE_CONFIGURED_TICKETS_0 + n  sub-limit of scope n
+#define SI_SEM_SCOPE_TICKETS_0 SI_NUM_SEMAPHORES
+#define SI_SEM_SCOPE_CONFIGURED_TICKETS_0 (SI_SEM_SCOPE_TICKETS_0 + SEMIAN_MAX_SCOPE_LIMITS)
+#define SI_NUM_SCOPED_SEMAPHORES (SI_SEM_SCOPE_CONFIGURED_TICKETS_0 + SEMIAN_MAX_SCOPE_LIMITS)
+
 extern VALUE eSyscall, eTimeout, eInternal;
 
 // Helper for syscall verbose debugging
 void
 raise_semian_syscall_error(const char *syscall, int error_num);
 
-// Initialize the sysv semaphore structure
+// Initialize the sysv semaphore structure, optionally with shared memory tickets.
+// Resources are given a slot of the pool's semaphore set when pool_name isn't NULL.
+// The ticket count of adaptive resources is only configured when the set is created.
+// Without register_worker, the set is only prepared for processes forked later, which register
+// themselves with register_semaphore_workers, and quota tickets are left for them to configure.
+// The sub-limits of res->scopes are set from scope_tickets, and resources with some get the larger
+// set of SI_NUM_SCOPED_SEMAPHORES semaphores. scope_tickets must be NULL for pooled resources.
+void
+initialize_semaphore_set(semian_resource_t* res, const char* id_str, long permissions, int tickets, double quota, int shm_tickets,
+                         const char *pool_name, int pool_capacity, int adaptive, int register_worker,
+                         const int *scope_tickets);
+
+// Register the current process as a worker of every resource, with a single semop per semaphore set,
+// then configure the quota tickets of the sets that have none yet. Resources the process is already
+// registered for are skipped. Returns the number of resources registered.
+long
+register_semaphore_workers(semian_resource_t **resources, long count);
+
+// Hash functions generate_ipc_key may derive keys with
+#define SEMIAN_KEY_HASH_SHA1 0
+#define SEMIAN_KEY_HASH_FNV1A 1
+
+// Initial value of hash_fnv1a
+#define FNV1A_OFFSET_BASIS 2166136261u
+
+// Derive a SysV IPC key from a resource name and a suffix identifying the IPC object
+key_t
+generate_ipc_key(const char *name, const char *suffix);
+
+// Select the hash function of generate_ipc_key, one of SEMIAN_KEY_HASH_*.
+// Every process using a resource must use the same one.
+void
+set_ipc_key_hash(int hash);
+
+// Returns the hash function of generate_ipc_key
+int
+get_ipc_key_hash();
+
+// Continue an FNV-1a hash, starting from FNV1A_OFFSET_BASIS, with the bytes of a string
+uint32_t
+hash_fnv1a(uint32_t hash, const char *str);
+
+// Forget the id of the semaphore set of a resource, once it was removed
 void
-initialize_semaphore_set(semian_resource_t* res, const char* id_str, long permissions, int tickets, double quota);
+forget_semaphore_set(const char *name);
 
 // Set semaphore UNIX octal permissions
 void
 set_semaphore_permissions(int sem_id, long permissions);
 
-// Create a new sysV IPC semaphore set
+// Wrapper to performs a semop call
+// The call may be timed or untimed
 int
-create_semaphore(int key, long permissions, int *created);
+perform_semop(int sem_id, unsigned short index, short op, short flags, struct timespec *ts);
 
-// Wrapper to performs a semop call
+// Wrapper to perform several operations on a semaphore set in a single atomic semop call
 // The call may be timed or untimed
 int
-perform_semop(int sem_id, short index, short op, short flags, struct timespec *ts);
+perform_semops(int sem_id, struct sembuf *sops, size_t nsops, struct timespec *ts);
 
 // Retrieve the current number of tickets in a semaphore by its semaphore index
 int
 get_sem_val(int sem_id, int sem_index);
 
-// Obtain an exclusive lock on the semaphore set critical section
+// Obtain an exclusive lock on the critical section of the semaphores starting at sem_base
 void
-sem_meta_lock(int sem_id);
+sem_meta_lock(int sem_id, unsigned short sem_base);
 
-// Release an exclusive lock on the semaphore set critical section
+// Release an exclusive lock on the critical section of the semaphores starting at sem_base
 void
-sem_meta_unlock(int sem_id);
+sem_meta_unlock(int sem_id, unsigned short sem_base);
+
+// Get or create the semaphore set for a key, initializing every group of group_size semaphores
+// in it with a single SETALL if it was created
+int
+create_semaphore_set(key_t key, int num_semaphores, int group_size, long permissions);
 
 // Retrieve a semaphore's ID from its key
 int
@@ -106,6 +161,15 @@ get_semaphore(int key);
 void *
 acquire_semaphore_without_gvl(void *p);
 
+// Decrements the ticket semaphore if a ticket is available, without waiting.
+// Returns true if a ticket was taken, otherwise res->error is set if the semop failed.
+int
+try_acquire_semaphore(semian_resource_t *res);
+
+// Increments the ticket semaphore, and the scope tickets taken with it
+int
+release_semaphore(semian_resource_t *res);
+
 #ifdef DEBUG
 static inline void
 print_sem_vals(int sem_id)
@@ -1,20 +1,50 @@
 #include "tickets.h"
+#include "shm_tickets.h"
+
+typedef struct {
+  scale_tickets_args_t scale;
+  double quota;
+} resize_quota_tickets_args_t;
 
 // Update the ticket count for static ticket tracking
 static VALUE
-update_ticket_count(int sem_id, int count);
+update_ticket_count(int sem_id, unsigned short sem_base, int count, semian_shm_tickets_t *shm_tickets, short flags);
 
 static int
-calculate_quota_tickets(int sem_id, double quota);
+calculate_quota_tickets(int sem_id, unsigned short sem_base, double quota);
+
+static VALUE
+scale_quota_tickets(VALUE value);
+
+static void
+update_scope_ticket_count(int sem_id, unsigned short sem_base, int slot, int tickets);
 
 // Must be called with the semaphore meta lock already acquired
 VALUE
 configure_tickets(VALUE value)
 {
   configure_tickets_args_t *args = (configure_tickets_args_t *)value;
+  int i;
+
+  if (args->shm_created) {
+    populate_shm_tickets(args->shm_tickets, get_sem_val(args->sem_id, args->sem_base + SI_SEM_CONFIGURED_TICKETS));
+  }
+
+  if (args->scope_tickets) {
+    for (i = 0; i < SEMIAN_MAX_SCOPE_LIMITS; i++) {
+      if (args->scope_tickets[i] > 0) {
+        update_scope_ticket_count(args->sem_id, args->sem_base, i, args->scope_tickets[i]);
+      }
+    }
+  }
+
+  // A preloaded set has no registered workers yet to calculate the quota tickets of
+  if (args->quota > 0 && args->defer_quota) {
+    return Qnil;
+  }
 
   if (args->quota > 0) {
-    args->tickets = calculate_quota_tickets(args->sem_id, args->quota);
+    args->tickets = calculate_quota_tickets(args->sem_id, args->sem_base, args->quota);
   }
 
   /*
@@ -22,37 +52,137 @@ configure_tickets(VALUE value)
     We need to throw an error if we set it to 0 during initialization.
     Otherwise, we back out of here completely.
   */
-  if (get_sem_val(args->sem_id, SI_SEM_CONFIGURED_TICKETS) == 0 && args->tickets == 0) {
+  if (get_sem_val(args->sem_id, args->sem_base + SI_SEM_CONFIGURED_TICKETS) == 0 && args->tickets == 0) {
     rb_raise(eSyscall, "More than 0 tickets must be specified when initializing semaphore");
   } else if (args->tickets == 0) {
     return Qnil;
   }
 
+  // The count of an adaptive resource is only set when the semaphore set is created, or left by
+  // workers that are all gone. Workers registering later must not undo the adjustments made so far.
+  if (args->adaptive && get_sem_val(args->sem_id, args->sem_base + SI_SEM_CONFIGURED_TICKETS) != 0 &&
+      get_sem_val(args->sem_id, args->sem_base + SI_SEM_REGISTERED_WORKERS) > args->registered) {
+    return Qnil;
+  }
+
   /*
      If the current configured ticket count is not the same as the requested ticket
      count, we need to resize the count. We do this by adding the delta of
      (tickets - current_configured_tickets) to the semaphore value.
   */
-  if (get_sem_val(args->sem_id, SI_SEM_CONFIGURED_TICKETS) != args->tickets) {
-    update_ticket_count(args->sem_id, args->tickets);
+  if (get_sem_val(args->sem_id, args->sem_base + SI_SEM_CONFIGURED_TICKETS) != args->tickets) {
+    update_ticket_count(args->sem_id, args->sem_base, args->tickets, args->shm_tickets, 0);
+  }
+
+  return Qnil;
+}
+
+// Must be called with the semaphore meta lock already acquired
+VALUE
+scale_tickets(VALUE value)
+{
+  scale_tickets_args_t *args = (scale_tickets_args_t *)value;
+  int configured, available, in_use, tickets;
+
+  configured = get_sem_val(args->sem_id, args->sem_base + SI_SEM_CONFIGURED_TICKETS);
+  if (args->shm_tickets) {
+    available = __atomic_load_n(&args->shm_tickets->tickets, __ATOMIC_ACQUIRE);
+  } else {
+    available = get_sem_val(args->sem_id, args->sem_base + SI_SEM_TICKETS);
   }
+  in_use = configured - (available > 0 ? available : 0);
+
+  tickets = (int) floor(configured * args->factor) + args->increment;
+  if (tickets < args->min_tickets) {
+    tickets = args->min_tickets;
+  }
+  if (tickets > args->max_tickets) {
+    tickets = args->max_tickets;
+  }
+  if (tickets < configured && tickets < in_use) {
+    // Only take back the free tickets, the rest are taken back by the next adjustments
+    tickets = in_use < configured ? in_use : configured;
+  }
+
+  if (tickets != configured) {
+    update_ticket_count(args->sem_id, args->sem_base, tickets, args->shm_tickets, IPC_NOWAIT);
+  }
+  args->tickets = tickets;
 
   return Qnil;
 }
 
+void
+resize_quota_tickets(semian_resource_t *res)
+{
+  resize_quota_tickets_args_t args = { 0 };
+  struct timespec now;
+  long now_ns;
+  int tickets, state = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  now_ns = now.tv_sec * NANOSECONDS_IN_SECOND + now.tv_nsec;
+  if (now_ns < res->quota_resize_at) {
+    return;
+  }
+  res->quota_resize_at = now_ns + QUOTA_RESIZE_INTERVAL * NANOSECONDS_IN_SECOND;
+
+  // The count is usually up to date already, which doesn't need the lock
+  tickets = calculate_quota_tickets(res->sem_id, res->sem_base, res->quota);
+  if (tickets == 0 || tickets == get_sem_val(res->sem_id, res->sem_base + SI_SEM_CONFIGURED_TICKETS)) {
+    return;
+  }
+
+  args.scale.sem_id = res->sem_id;
+  args.scale.sem_base = res->sem_base;
+  args.scale.shm_tickets = res->shm_tickets;
+  args.quota = res->quota;
+
+  sem_meta_lock(res->sem_id, res->sem_base);
+  rb_protect(scale_quota_tickets, (VALUE) &args, &state);
+  sem_meta_unlock(res->sem_id, res->sem_base);
+  if (state) {
+    if (!rb_obj_is_kind_of(rb_errinfo(), eTimeout)) {
+      rb_jump_tag(state);
+    }
+    // Free tickets were taken while shrinking, the next resize tries again
+    rb_set_errinfo(Qnil);
+  }
+}
+
+// Must be called with the semaphore meta lock already acquired
 static VALUE
-update_ticket_count(int sem_id, int tickets)
+scale_quota_tickets(VALUE value)
+{
+  resize_quota_tickets_args_t *args = (resize_quota_tickets_args_t *) value;
+  int tickets;
+
+  // Workers may have registered or exited since the count was checked
+  tickets = calculate_quota_tickets(args->scale.sem_id, args->scale.sem_base, args->quota);
+  if (tickets == 0) {
+    return Qnil;
+  }
+
+  args->scale.factor = 0;
+  args->scale.increment = tickets;
+  args->scale.min_tickets = tickets;
+  args->scale.max_tickets = tickets;
+  return scale_tickets((VALUE) &args->scale);
+}
+
+static VALUE
+update_ticket_count(int sem_id, unsigned short sem_base, int tickets, semian_shm_tickets_t *shm_tickets, short flags)
 {
   short delta;
   struct timespec ts = { 0 };
   ts.tv_sec = INTERNAL_TIMEOUT;
 
-  delta = tickets - get_sem_val(sem_id, SI_SEM_CONFIGURED_TICKETS);
+  delta = tickets - get_sem_val(sem_id, sem_base + SI_SEM_CONFIGURED_TICKETS);
 
 #ifdef DEBUG
   print_sem_vals(sem_id);
 #endif
-  if (perform_semop(sem_id, SI_SEM_TICKETS, delta, 0, &ts) == -1) {
+  if (perform_semop(sem_id, sem_base + SI_SEM_TICKETS, delta, flags, &ts) == -1) {
     if (delta < 0 && errno == EAGAIN) {
       rb_raise(eTimeout, "timeout while trying to update ticket count");
     } else {
@@ -60,17 +190,47 @@ update_ticket_count(int sem_id, int tickets)
     }
   }
 
-  if (semctl(sem_id, SI_SEM_CONFIGURED_TICKETS, SETVAL, tickets) == -1) {
+  if (semctl(sem_id, sem_base + SI_SEM_CONFIGURED_TICKETS, SETVAL, tickets) == -1) {
     rb_raise(eInternal, "error configuring ticket count, errno: %d (%s)", errno, strerror(errno));
   }
 
+  if (shm_tickets) {
+    update_shm_ticket_count(shm_tickets, delta);
+  }
+
   return Qnil;
 }
 
+// Like update_ticket_count, for the sub-limit of the scope in a slot
+static void
+update_scope_ticket_count(int sem_id, unsigned short sem_base, int slot, int tickets)
+{
+  short delta;
+  struct timespec ts = { 0 };
+  ts.tv_sec = INTERNAL_TIMEOUT;
+
+  delta = tickets - get_sem_val(sem_id, sem_base + SI_SEM_SCOPE_CONFIGURED_TICKETS_0 + slot);
+  if (delta == 0) {
+    return;
+  }
+
+  if (perform_semop(sem_id, sem_base + SI_SEM_SCOPE_TICKETS_0 + slot, delta, 0, &ts) == -1) {
+    if (delta < 0 && errno == EAGAIN) {
+      rb_raise(eTimeout, "timeout while trying to update scope ticket count");
+    } else {
+      rb_raise(eInternal, "error setting scope ticket count, errno: %d (%s)", errno, strerror(errno));
+    }
+  }
+
+  if (semctl(sem_id, sem_base + SI_SEM_SCOPE_CONFIGURED_TICKETS_0 + slot, SETVAL, tickets) == -1) {
+    rb_raise(eInternal, "error configuring scope ticket count, errno: %d (%s)", errno, strerror(errno));
+  }
+}
+
 static int
-calculate_quota_tickets (int sem_id, double quota)
+calculate_quota_tickets (int sem_id, unsigned short sem_base, double quota)
 {
   int tickets = 0;
-  tickets = (int) ceil(get_sem_val(sem_id, SI_SEM_REGISTERED_WORKERS) * quota);
+  tickets = (int) ceil(get_sem_val(sem_id, sem_base + SI_SEM_REGISTERED_WORKERS) * quota);
   return tickets;
 }
@@ -6,8 +6,23 @@ For logic specific to manipulating semian ticket counts
 
 #include "sysv_semaphores.h"
 
+// Least time between two checks of the ticket count of a quota resource by a process
+#define QUOTA_RESIZE_INTERVAL 1 /* seconds */
+
 // Set initial ticket values upon resource creation
 VALUE
 configure_tickets(VALUE);
 
+// Set the ticket count to (tickets * factor) + increment, bounded by min_tickets and max_tickets.
+// Shrinking only takes back free tickets, so it never waits for tickets in use to be released.
+// Must be called with the semaphore meta lock already acquired.
+VALUE
+scale_tickets(VALUE);
+
+// Resize the tickets of a quota resource to the workers registered since, at most once per
+// QUOTA_RESIZE_INTERVAL. The meta lock is only taken when the count changed, and shrinking only
+// takes back free tickets, so it never waits for tickets in use. Later resizes take back the rest.
+void
+resize_quota_tickets(semian_resource_t *res);
+
 #endif // SEMIAN_TICKETS_H
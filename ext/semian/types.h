@@ -4,6 +4,8 @@ For custom type definitions specific to semian
 #ifndef SEMIAN_TYPES_H
 #define SEMIAN_TYPES_H
 
+#include <pthread.h>
+#include <ruby.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
@@ -20,22 +22,260 @@ union semun {
                              (Linux-specific) */
 };
 
+// Maximum number of processes that may use a shared memory ticket backend at once
+#define SEMIAN_SHM_MAX_OWNERS 1024
+
+// Tickets held by a process, which are handed back if the process dies.
+// Like a semadj value, held may go negative when a process releases a ticket
+// acquired before it was forked.
+typedef struct {
+  int32_t pid;
+  int32_t held;
+  uint64_t start_time;
+} semian_shm_owner_t;
+
+// Maximum number of callers waiting in the line of a shared memory ticket backend
+#define SEMIAN_SHM_MAX_QUEUE 1024
+
+// A place in the line of a shared memory ticket backend. The state holds the waiter's
+// number + 1 while it waits, its negation once it gave up, or 0 if the place is free.
+// The waiter sleeps on turn until the caller ahead of it is served.
+typedef struct {
+  int32_t state;
+  int32_t pid;
+  int32_t turn;
+} semian_shm_queue_slot_t;
+
+// Shared memory segment for the shared memory ticket backend. Callers waiting in FIFO order
+// take a number from queue_tail, and are served once queue_head reaches it.
+typedef struct {
+  int32_t initialized;
+  int32_t tickets;
+  int32_t waiters;
+  uint32_t queue_head;
+  uint32_t queue_tail;
+  semian_shm_owner_t owners[SEMIAN_SHM_MAX_OWNERS];
+  semian_shm_queue_slot_t queue[SEMIAN_SHM_MAX_QUEUE];
+} semian_shm_tickets_t;
+
+// A Ruby object backed by a shared memory segment
+typedef struct {
+  void *shm;
+  int shm_id;
+} semian_shm_object_t;
+
+// Maximum length of the names of resources in a resource pool
+#define SEMIAN_POOL_MAX_NAME 128
+
+// An entry of a resource pool's index, free until a resource claims it
+typedef struct {
+  int32_t claimed;
+  char name[SEMIAN_POOL_MAX_NAME];
+} semian_pool_slot_t;
+
+// Shared memory segment of a resource pool, mapping resource names to their slot in the pool's semaphore set
+typedef struct {
+  int32_t initialized;
+  int32_t capacity;
+  semian_pool_slot_t slots[];
+} semian_resource_pool_t;
+
+// Number of buckets of a semian_histogram_t, the last one counting values of 2^(n-2) microseconds or more
+#define SEMIAN_HISTOGRAM_BUCKETS 32
+
+// Histogram of microsecond durations with logarithmic buckets, see histogram.h
+typedef struct {
+  uint64_t counts[SEMIAN_HISTOGRAM_BUCKETS];
+} semian_histogram_t;
+
+// Number of scopes a resource keeps call durations for, calls of any further scope aren't recorded
+#define SEMIAN_MAX_DURATION_SCOPES 8
+
+// Durations of the calls made while holding a ticket of a resource in this process, by scope
+typedef struct {
+  semian_histogram_t unscoped;
+  VALUE scopes[SEMIAN_MAX_DURATION_SCOPES]; // 0 for an unused slot, symbols are pinned when they claim one
+  semian_histogram_t histograms[SEMIAN_MAX_DURATION_SCOPES];
+  uint64_t dropped; // calls that weren't recorded because their scope found no slot
+} semian_duration_histograms_t;
+
+// Number of resources the host's statistics hold
+#define SEMIAN_STATS_CAPACITY 1024
+
+// Maximum length of the names of resources with stats
+#define SEMIAN_STATS_MAX_NAME 128
+
+// Statistics of a resource, shared by every process on the host, see stats.h
+typedef struct {
+  int32_t claimed;
+  int32_t circuit_state;
+  char name[SEMIAN_STATS_MAX_NAME];
+  int32_t sem_id; // semaphore set of the resource, -1 once it was destroyed
+  int32_t sem_base;
+  int32_t shm_tickets; // in_flight is only counted for the shared memory ticket backend
+  uint64_t acquisitions;
+  uint64_t timeouts;
+  int64_t in_flight;
+  semian_histogram_t wait_time_histogram;
+} semian_stats_slot_t;
+
+// Shared memory segment of the host's statistics
+typedef struct {
+  int32_t initialized;
+  pthread_mutex_t reclaim_lock; // taken to hand the slot of a resource no longer in use to another one
+  semian_stats_slot_t slots[SEMIAN_STATS_CAPACITY];
+} semian_stats_t;
+
+// A semaphore set known to this process, by the name of its resource or pool
+typedef struct {
+  char *name;
+  int num_semaphores;
+  key_t key;
+  int sem_id; // -1 until it is created or attached to, and once it was removed
+  long permissions;
+} semian_semaphore_set_entry_t;
+
 typedef struct {
   int sem_id;
+  unsigned short sem_base;
   int tickets;
   double quota;
+  semian_shm_tickets_t *shm_tickets;
+  int shm_created;
+  int adaptive;
+  int registered; // whether the configuring process is one of the set's registered workers
+  int defer_quota; // quota tickets are left to the workers registering later
+  const int *scope_tickets; // sub-limits by scope slot, 0 to leave one unchanged, NULL for none
 } configure_tickets_args_t;
 
+// For scaling the ticket count of an adaptive resource, see scale_tickets
+typedef struct {
+  int sem_id;
+  unsigned short sem_base;
+  double factor;
+  int increment;
+  int min_tickets;
+  int max_tickets;
+  semian_shm_tickets_t *shm_tickets;
+  int tickets;
+} scale_tickets_args_t;
+
+// Scopes of a resource that may each be limited to a part of its tickets
+#define SEMIAN_MAX_SCOPE_LIMITS 2
+
 // Internal semaphore structure
 typedef struct {
   int sem_id;
+  unsigned short sem_base;
   struct timespec timeout;
   double quota;
   int error;
   uint64_t key;
   char *strkey;
   char *name;
-  long wait_time;
+  long wait_time; // nanoseconds
+  semian_shm_tickets_t *shm_tickets;
+  int shm_id;
+  int shm_owner;
+  pid_t shm_owner_pid;
+  semian_shm_object_t pool;
+  semian_histogram_t *wait_time_histogram;
+  semian_duration_histograms_t *duration_histograms;
+  semian_histogram_t *duration_histogram; // of the scope of the current acquire, NULL to not record it
+  struct timespec acquired_at; // when the current acquire got its ticket, from CLOCK_MONOTONIC
+  int reserved_tickets; // only taken by high priority callers
+  int reserve; // tickets the current acquire must leave to others, 0 for high priority
+  int fifo; // shared memory tickets are handed out in line
+  int max_queue; // callers that may wait for a ticket, 0 for no limit
+  semian_stats_slot_t *stats; // in the host's statistics, NULL without stats
+  pid_t registered_pid; // process registered as a worker of the resource, 0 for none
+  long quota_resize_at; // monotonic nanoseconds from which acquire resizes quota tickets
+  ID scopes[SEMIAN_MAX_SCOPE_LIMITS]; // scopes with a sub-limit of the tickets by slot, 0 for none
+  unsigned short scope_sem; // semaphore of the scope tickets taken by the current acquire, 0 for none
+  int early_fail; // acquire fails right away when it isn't expected to get a ticket within its timeout
+  long expected_wait; // moving average of the waits of callers finding no free ticket, nanoseconds
+  long expected_wait_at; // monotonic nanoseconds of the last sample of expected_wait, or of a probe
 } semian_resource_t;
 
+// A Semian::Resource::Lease, a ticket of resource held until it's released
+typedef struct {
+  VALUE resource;
+  semian_resource_t res; // copy of the resource the ticket was taken with
+  pid_t pid; // process holding the ticket, 0 once released
+  semian_shm_tickets_t *shm_tickets; // the lease's own mapping of the tickets segment, if it has one
+} semian_lease_t;
+
+// For acquiring tickets of several resources at once. Resources are sorted by
+// semaphore set, and the first acquired of them hold a ticket.
+typedef struct {
+  semian_resource_t *resources;
+  struct sembuf *sops;
+  long count;
+  long acquired;
+  struct timespec timeout;
+  long wait_time; // nanoseconds
+  int error;
+} acquire_all_args_t;
+
+// A Semian::Simple::SlidingWindow, a ring buffer of at most max_size values local to the process.
+// The generation is bumped by every change, for the optimistic reject! of the ThreadSafe window.
+typedef struct {
+  long max_size;
+  long start;
+  long length;
+  int rejecting;
+  uint64_t generation;
+  VALUE *values;
+} semian_sliding_window_t;
+
+// A Semian::ThreadSafe::Integer
+typedef struct {
+  int64_t value;
+} semian_integer_t;
+
+// Shared memory segment of a Semian::SysV::SlidingWindow, a ring buffer of at most max_size values
+typedef struct {
+  int32_t initialized;
+  int32_t max_size;
+  int32_t start;
+  int32_t length;
+  uint64_t generation;
+  pthread_mutex_t lock;
+  int64_t values[];
+} semian_shm_sliding_window_t;
+
+// The requests counted by a request window during one second of the monotonic clock. The second is
+// stored plus one, so that zero-filled buckets are empty.
+typedef struct {
+  int64_t second;
+  int64_t successes;
+  int64_t errors;
+} semian_request_bucket_t;
+
+// A Semian::Simple::RequestWindow, with one bucket per second of the window
+typedef struct {
+  long size;
+  semian_request_bucket_t *buckets;
+} semian_request_window_t;
+
+// Shared memory segment of a Semian::SysV::RequestWindow
+typedef struct {
+  int32_t initialized;
+  int32_t size;
+  pthread_mutex_t lock;
+  semian_request_bucket_t buckets[];
+} semian_shm_request_window_t;
+
+// Shared memory segment of a Semian::SysV::Integer
+typedef struct {
+  int32_t initialized;
+  int64_t value;
+} semian_shm_integer_t;
+
+// Shared memory segment of a Semian::SysV::State
+typedef struct {
+  int32_t initialized;
+  int32_t value;
+} semian_shm_state_t;
+
 #endif // SEMIAN_TYPES_H
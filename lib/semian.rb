@@ -6,11 +6,14 @@ require 'thread'
 require 'semian/version'
 require 'semian/instrumentable'
 require 'semian/platform'
+require 'semian/adaptive_tickets'
+require 'semian/distributed_tickets'
 require 'semian/resource'
 require 'semian/circuit_breaker'
 require 'semian/protected_resource'
 require 'semian/unprotected_resource'
 require 'semian/simple_sliding_window'
+require 'semian/simple_request_window'
 require 'semian/simple_integer'
 require 'semian/simple_state'
 require 'semian/lru_hash'
@@ -90,10 +93,36 @@ module Semian
   InternalError = Class.new(BaseError)
   OpenCircuitError = Class.new(BaseError)
 
-  attr_accessor :maximum_lru_size, :minimum_lru_time, :default_permissions, :namespace
+  attr_accessor :maximum_lru_size, :minimum_lru_time, :lru_gc_batch_size, :default_permissions, :namespace,
+                :resource_pool_capacity, :stats_enabled
   self.maximum_lru_size = 500
   self.minimum_lru_time = 300
+  self.lru_gc_batch_size = nil
   self.default_permissions = 0660
+  self.resource_pool_capacity = 1024
+  self.stats_enabled = false
+
+  # Unit of the bulkhead wait times yielded by +acquire+ and passed to subscribers, either
+  # +:milliseconds+ (the default, as an Integer), +:nanoseconds+ (as an Integer) or +:seconds+ (as a Float).
+  def wait_time_unit
+    Resource.wait_time_unit
+  end
+
+  def wait_time_unit=(unit)
+    Resource.wait_time_unit = unit
+  end
+
+  # Hash function the keys of semaphore sets and shared memory segments are derived with from
+  # resource names, either +:sha1+ (the default) or +:fnv1a+, which is cheaper to compute.
+  # Processes only share a resource if they use the same hash function, so set it before
+  # registering any resource, and change it on every process of a host at once.
+  def key_hash
+    Resource.key_hash
+  end
+
+  def key_hash=(hash)
+    Resource.key_hash = hash
+  end
 
   def issue_disabled_semaphores_warning
     return if defined?(@warning_issued)
@@ -135,7 +164,8 @@ module Semian
   #
   # +quota+: Calculate tickets as a ratio of the number of registered workers.
   # Must be greater than 0, less than or equal to 1. There will always be at least 1 ticket, as it
-  # is calculated as (workers * quota).ceil
+  # is calculated as (workers * quota).ceil. The tickets are resized to the registered workers by +acquire+,
+  # at most once a second per process, and shrinking only takes back free tickets.
   # Mutually exclusive with the 'ticket' argument.
   # but the resource must have been previously registered otherwise an error will be raised. (bulkhead)
   #
@@ -143,8 +173,58 @@ module Semian
   #
   # +timeout+: Default timeout in seconds. Default 0. (bulkhead)
   #
+  # +ticket_backend+: Where tickets are issued from. Either +:sysv+ (default), which issues
+  # tickets from the SysV semaphore set, or +:shm+, which issues them from an atomic counter
+  # in shared memory so that acquiring a free ticket does not need a syscall. All processes
+  # using a resource must use the same backend. (bulkhead)
+  #
+  # +resource_pool+: Name of a resource pool to allocate the resource's semaphores from, instead of
+  # creating a semaphore set for every resource. A pool holds up to +Semian.resource_pool_capacity+ (1024)
+  # resources, at most SEMMSL / 4 - 1. All processes using a resource must agree on its pool. Default nil. (bulkhead)
+  #
+  # +reserved_tickets+: Number of tickets that only callers acquiring the resource with the default
+  # +priority: :high+ may take. Callers passing +priority: :low+ wait for more tickets than that to be
+  # available, so they are shed first when the resource is busy. Default 0. (bulkhead)
+  #
+  # +fifo+: Hand out tickets in the order callers started waiting, instead of to whichever waiter
+  # wakes up first. Requires the +:shm+ ticket backend. Default false. (bulkhead)
+  #
+  # +max_queue+: Maximum number of callers waiting for a ticket. Callers arriving once that many
+  # wait raise Semian::TimeoutError right away instead of waiting for +timeout+. Implies +fifo+,
+  # and requires the +:shm+ ticket backend. Default nil, no limit. (bulkhead)
+  #
+  # +early_fail+: When no ticket is free, raise Semian::TimeoutError right away instead of waiting if
+  # the callers of this process that had to wait recently waited longer than the timeout, or than the
+  # time left until the +deadline:+ passed to +acquire+. Default false. (bulkhead)
+  #
+  # +scope_tickets+: A hash limiting how many tickets callers acquiring the resource with a +scope+ may
+  # hold at once, by scope, for example +{ connection: 2 }+ so that reconnecting can't take the tickets
+  # of queries. The scope's ticket is taken in the same semop as the resource's. At most 2 scopes may be
+  # limited, and all processes using a resource must pass the same limits, in the same order. Limited
+  # resources get a larger semaphore set, keyed apart from unlimited ones. Requires the +:sysv+ ticket
+  # backend, without a +resource_pool+. Default nil. (bulkhead)
+  #
+  # +adaptive_tickets+: A hash to adapt the ticket count to the latency of the resource, see
+  # Semian::AdaptiveTickets. Takes +max+ and +target_latency+ (seconds), and optionally +min+ (1),
+  # +backoff_ratio+ (0.9) and +interval+ (1 second). The count starts at +tickets+, or +max+ when
+  # +tickets+ is not given. Can't be combined with +quota+. Default nil. (bulkhead)
+  #
+  # +distributed_tickets+: A hash to limit the tickets of the resource across hosts, see
+  # Semian::DistributedTickets. Takes a +source+ leasing tickets to the hosts, such as a
+  # Semian::RedisTicketSource, and the +tickets+ of the whole fleet, and optionally the +max+ tickets
+  # of a host (+tickets+), +interval+ (1 second) and +ttl+ (5 intervals). Can't be combined with
+  # +tickets+, +quota+ or +adaptive_tickets+. Default nil. (bulkhead)
+  #
   # +error_threshold+: The amount of errors that must happen within error_timeout amount of time to open
-  # the circuit. (circuit breaker required)
+  # the circuit. (circuit breaker required, unless +error_percent_threshold+ is given)
+  #
+  # +error_percent_threshold+: Open the circuit on the percentage of failed requests within error_timeout
+  # amount of time instead, once at least +minimum_request_volume+ requests were made. Requests are counted
+  # in per-second buckets, shared like the rest of the state with +shared_circuit_breaker+. Replaces
+  # +error_threshold+. Default nil. (circuit breaker)
+  #
+  # +minimum_request_volume+: The number of requests within error_timeout amount of time below which
+  # +error_percent_threshold+ never opens the circuit. Default 1. (circuit breaker)
   #
   # +error_timeout+: The duration in seconds since the last error after which the error count is reset to 0.
   # (circuit breaker required)
@@ -155,6 +235,14 @@ module Semian
   # +exceptions+: An array of exception classes that should be accounted as resource errors. Default [].
   # (circuit breaker)
   #
+  # +shared_circuit_breaker+: The boolean if you want the circuit breaker state to be kept in shared memory,
+  # so that it is shared by every process on the host registering the same resource. Default false.
+  # Ignored when semaphores are not enabled. (circuit breaker)
+  #
+  # +half_open_probes+: The number of calls allowed through a half-open circuit at the same time, by every
+  # process on the host together. Other callers keep failing fast with +Semian::OpenCircuitError+. Default nil,
+  # every call is allowed. Only limited within the process when semaphores are not enabled. (circuit breaker)
+  #
   # Returns the registered resource.
   def register(name, **options)
     circuit_breaker = create_circuit_breaker(name, **options)
@@ -167,6 +255,37 @@ module Semian
     resources[name] = ProtectedResource.new(name, bulkhead, circuit_breaker)
   end
 
+  # Registers resources in a process that forks workers, before forking them. Takes a hash of
+  # options for +register+ by resource name:
+  #
+  #   Semian.preload(
+  #     mysql_shard_0: { tickets: 4, error_threshold: 3, error_timeout: 10, success_threshold: 2 },
+  #     redis_cache: { quota: 0.5, error_threshold: 3, error_timeout: 10, success_threshold: 2 },
+  #   )
+  #
+  # The semaphore sets are created and their tickets configured once, and the workers inherit
+  # ready resources. The preloading process isn't registered as a worker, so tickets calculated
+  # from a +quota+ are only configured as workers call +Semian.after_fork+.
+  #
+  # Returns the registered resources.
+  def preload(resources)
+    resources.map do |name, options|
+      register(name, **options, preload: true)
+    end
+  end
+
+  # Registers the current process as a worker of every resource registered before it was forked,
+  # such as with +Semian.preload+, so that +quota+ tickets account for it. Resources in the same
+  # semaphore set are all registered for with a single semop. Call it from the worker, e.g. in the
+  # +after_fork+ hook of Unicorn or the +on_worker_boot+ hook of Puma. Calling it again in the same
+  # process does nothing.
+  #
+  # Returns the number of resources registered.
+  def after_fork
+    return 0 unless semaphores_enabled?
+    Resource.register_workers(resources.values.map(&:bulkhead).compact)
+  end
+
   def retrieve_or_register(name, **args)
     # If consumer who retrieved / registered by a Semian::Adapter, keep track
     # of who the consumer was so that we can clear the resource reference if needed.
@@ -184,6 +303,48 @@ module Semian
     resources[name]
   end
 
+  # Acquires a bulkhead ticket of every named resource at once, then yields.
+  #
+  # Either all tickets are acquired, or none are and +Semian::TimeoutError+ is raised.
+  # Resources are always acquired in the same order, so concurrent callers naming the
+  # same resources in a different order can't deadlock each other.
+  #
+  # +timeout+: Seconds to wait for all tickets. Defaults to the smallest default timeout of the resources.
+  #
+  # Circuit breakers are not involved, since an error raised by the block can't be
+  # attributed to a single resource.
+  def acquire_all(names, timeout: nil, scope: nil, adapter: nil)
+    protected_resources = names.map do |name|
+      self[name] || raise(ArgumentError, "Unknown resource #{name.inspect}, register it first")
+    end
+    bulkheads = protected_resources.map(&:bulkhead).compact
+
+    begin
+      Resource.acquire_all(bulkheads, timeout: timeout) do |wait_time|
+        protected_resources.each { |resource| notify(:success, resource, scope, adapter, wait_time) }
+        yield wait_time
+      end
+    rescue ::Semian::TimeoutError
+      protected_resources.each { |resource| notify(:busy, resource, scope, adapter) }
+      raise
+    end
+  end
+
+  # Reads the stats of every bulkhead on the host created with +Semian.stats_enabled+ set, keyed by
+  # name (including +Semian.namespace+). The stats are kept in a single shared memory segment, so a
+  # sidecar process can export the metrics of all workers without registering any resource:
+  #
+  #   Semian.snapshot
+  #   # => { "mysql_shard_0" => { acquisitions: 1204, timeouts: 3, in_flight: 2, circuit_state: :closed,
+  #   #                           wait_time_histogram: { 1 => 1180, 2048 => 21, ... } } }
+  #
+  # +circuit_state+ is the last state published by a process on a transition of its circuit breaker,
+  # nil for resources without one.
+  def snapshot
+    return {} unless semaphores_enabled?
+    Resource.stats_snapshot(default_permissions)
+  end
+
   def destroy(name)
     if resource = resources.delete(name)
       resource.destroy
@@ -250,7 +411,9 @@ module Semian
   def create_circuit_breaker(name, **options)
     circuit_breaker = options.fetch(:circuit_breaker, true)
     return unless circuit_breaker
-    require_keys!([:success_threshold, :error_threshold, :error_timeout], options)
+    required = [:success_threshold, :error_timeout]
+    required << :error_threshold unless options[:error_percent_threshold]
+    require_keys!(required, options)
 
     exceptions = options[:exceptions] || []
     CircuitBreaker.new(
@@ -260,6 +423,9 @@ module Semian
       error_timeout: options[:error_timeout],
       exceptions: Array(exceptions) + [::Semian::BaseError],
       half_open_resource_timeout: options[:half_open_resource_timeout],
+      half_open_probes: options[:half_open_probes],
+      error_percent_threshold: options[:error_percent_threshold],
+      minimum_request_volume: options[:minimum_request_volume] || 1,
       implementation: implementation(**options),
     )
   end
@@ -276,6 +442,8 @@ module Semian
       )
     end
 
+    return ::Semian::SysV if options[:shared_circuit_breaker] && Semian.semaphores_enabled?
+
     thread_safe = options[:thread_safety_disabled].nil? ? Semian.thread_safe? : !options[:thread_safety_disabled]
     thread_safe ? ::Semian::ThreadSafe : ::Semian::Simple
   end
@@ -286,7 +454,13 @@ module Semian
 
     permissions = options[:permissions] || default_permissions
     timeout = options[:timeout] || 0
-    Resource.new(name, tickets: options[:tickets], quota: options[:quota], permissions: permissions, timeout: timeout)
+    ticket_backend = options[:ticket_backend] || :sysv
+    Resource.new(name, tickets: options[:tickets], quota: options[:quota], permissions: permissions, timeout: timeout,
+                       ticket_backend: ticket_backend, resource_pool: options[:resource_pool],
+                       adaptive_tickets: options[:adaptive_tickets], reserved_tickets: options[:reserved_tickets],
+                       fifo: options[:fifo], max_queue: options[:max_queue], scope_tickets: options[:scope_tickets],
+                       early_fail: options[:early_fail], preload: options[:preload],
+                       distributed_tickets: options[:distributed_tickets])
   end
 
   def require_keys!(required, options)
@@ -29,21 +29,39 @@ module Semian
 
     private
 
-    def acquire_semian_resource(scope:, adapter:, &block)
+    def acquire_semian_resource(scope:, adapter:)
       return yield if resource_already_acquired?
       semian_resource.acquire(scope: scope, adapter: adapter, resource: self) do
-        mark_resource_as_acquired(&block)
+        mark_resource_as_acquired { yield }
+      end
+    rescue ::Semian::BaseError, *resource_exceptions => error
+      raise_semian_error(error)
+    end
+
+    # Like acquire_semian_resource, but yields a Semian::Resource::Lease holding the bulkhead ticket
+    # until it's released, for calls that outlive the block. A nested call gets a released lease.
+    def lease_semian_resource(scope:, adapter:)
+      return yield Semian::Resource::Lease.new if resource_already_acquired?
+      semian_resource.lease(scope: scope, adapter: adapter, resource: self) do |lease|
+        mark_resource_as_acquired { yield lease }
+      end
+    rescue ::Semian::BaseError, *resource_exceptions => error
+      raise_semian_error(error)
+    end
+
+    def raise_semian_error(error)
+      case error
+      when ::Semian::OpenCircuitError
+        last_error = semian_resource.circuit_breaker.last_error
+        message = "#{error.message} caused by #{last_error.message}"
+        last_error = nil unless last_error.is_a?(Exception) # Net::HTTPServerError is not an exception
+        raise self.class::CircuitOpenError.new(semian_identifier, message), cause: last_error
+      when ::Semian::BaseError
+        raise self.class::ResourceBusyError.new(semian_identifier, error.message)
+      else
+        error.semian_identifier = semian_identifier if error.respond_to?(:semian_identifier=)
+        raise error
       end
-    rescue ::Semian::OpenCircuitError => error
-      last_error = semian_resource.circuit_breaker.last_error
-      message = "#{error.message} caused by #{last_error.message}"
-      last_error = nil unless last_error.is_a?(Exception) # Net::HTTPServerError is not an exception
-      raise self.class::CircuitOpenError.new(semian_identifier, message), cause: last_error
-    rescue ::Semian::BaseError => error
-      raise self.class::ResourceBusyError.new(semian_identifier, error.message)
-    rescue *resource_exceptions => error
-      error.semian_identifier = semian_identifier if error.respond_to?(:semian_identifier=)
-      raise
     end
 
     def semian_options
@@ -0,0 +1,79 @@
+module Semian
+  # Adapts the number of tickets of a resource to the latency of the calls it protects, with additive
+  # increase and multiplicative decrease (AIMD).
+  #
+  # Once every +interval+ seconds, the average duration of the calls made by this process is compared
+  # to +target_latency+. When it is over the target, the resource is slowing down and its ticket count
+  # is multiplied by +backoff_ratio+. Otherwise, if callers had to wait for a ticket, one more ticket is
+  # added. The count stays between +min+ and +max+.
+  #
+  # The ticket count is shared by every process using the resource, so each of them adjusts it.
+  class AdaptiveTickets
+    attr_reader :min, :max, :target_latency, :backoff_ratio, :interval
+
+    def initialize(resource, max:, target_latency:, min: 1, backoff_ratio: 0.9, interval: 1)
+      unless min.is_a?(Integer) && max.is_a?(Integer) && min >= 1 && min <= max
+        raise ArgumentError, "min and max must be integers with 1 <= min <= max, got: #{min.inspect}, #{max.inspect}"
+      end
+      unless target_latency.is_a?(Numeric) && target_latency > 0
+        raise ArgumentError, "target_latency must be a positive number of seconds, got: #{target_latency.inspect}"
+      end
+      unless backoff_ratio.is_a?(Numeric) && backoff_ratio > 0 && backoff_ratio < 1
+        raise ArgumentError, "backoff_ratio must be between 0 and 1, got: #{backoff_ratio.inspect}"
+      end
+
+      @resource = resource
+      @min = min
+      @max = max
+      @target_latency = target_latency.to_f
+      @backoff_ratio = backoff_ratio.to_f
+      @interval = interval
+      @lock = Mutex.new
+      reset(Process.clock_gettime(Process::CLOCK_MONOTONIC))
+    end
+
+    # Records a call that started at +started_at+, a monotonic clock time in seconds, after
+    # waiting +wait_time+ for its ticket.
+    def record(started_at, wait_time)
+      now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      @calls += 1
+      @latency += now - started_at
+      @queued = true if wait_time && wait_time > 0
+      adjust(now) if now >= @next_adjustment_at
+    end
+
+    private
+
+    def adjust(now)
+      # Another thread is already adjusting, the calls it didn't count go into the next interval
+      return unless @lock.try_lock
+
+      begin
+        if now >= @next_adjustment_at
+          scale_tickets
+          reset(now)
+        end
+      ensure
+        @lock.unlock
+      end
+    end
+
+    def scale_tickets
+      if @latency / @calls > @target_latency
+        @resource.scale_tickets(@backoff_ratio, 0, @min, @max)
+      elsif @queued
+        @resource.scale_tickets(1.0, 1, @min, @max)
+      end
+    rescue ::Semian::TimeoutError
+      # Free tickets were taken while shrinking, try again next interval
+      nil
+    end
+
+    def reset(now)
+      @calls = 0
+      @latency = 0.0
+      @queued = false
+      @next_adjustment_at = now + @interval
+    end
+  end
+end
@@ -1,45 +1,74 @@
 module Semian
   class CircuitBreaker #:nodoc:
-    extend Forwardable
+    CIRCUIT_BREAKER_DISABLED_ENV = 'SEMIAN_CIRCUIT_BREAKER_DISABLED'.freeze
+    DISABLED_ENV = 'SEMIAN_DISABLED'.freeze
+    private_constant :CIRCUIT_BREAKER_DISABLED_ENV, :DISABLED_ENV
 
-    def_delegators :@state, :closed?, :open?, :half_open?
+    attr_reader :name, :half_open_resource_timeout, :half_open_probes, :error_timeout, :state, :last_error
 
-    attr_reader :name, :half_open_resource_timeout, :error_timeout, :state, :last_error
+    def initialize(name, exceptions:, success_threshold:, error_timeout:, implementation:, error_threshold: nil,
+                         half_open_resource_timeout: nil, half_open_probes: nil, error_percent_threshold: nil,
+                         minimum_request_volume: 1)
+      if error_threshold.nil? && error_percent_threshold.nil?
+        raise ArgumentError, 'error_threshold or error_percent_threshold must be given'
+      end
+      unless error_percent_threshold.nil? || (error_percent_threshold.is_a?(Numeric) &&
+                                              error_percent_threshold > 0 && error_percent_threshold <= 100)
+        raise ArgumentError, "error_percent_threshold must be between 0 and 100, got: #{error_percent_threshold.inspect}"
+      end
+      unless minimum_request_volume.is_a?(Integer) && minimum_request_volume > 0
+        raise ArgumentError, "minimum_request_volume must be a positive integer, got: #{minimum_request_volume.inspect}"
+      end
+      unless half_open_probes.nil? || (half_open_probes.is_a?(Integer) && half_open_probes > 0)
+        raise ArgumentError, "half_open_probes must be a positive integer, got: #{half_open_probes.inspect}"
+      end
 
-    def initialize(name, exceptions:, success_threshold:, error_threshold:,
-                         error_timeout:, implementation:, half_open_resource_timeout: nil)
       @name = name.to_sym
       @success_count_threshold = success_threshold
       @error_count_threshold = error_threshold
       @error_timeout = error_timeout
+      @error_timeout_ms = (error_timeout * 1000).to_i
       @exceptions = exceptions
       @half_open_resource_timeout = half_open_resource_timeout
+      @half_open_probes = half_open_probes
+      @probe_slots = create_probe_slots if half_open_probes
+      @error_percent_threshold = error_percent_threshold
+      @minimum_request_volume = minimum_request_volume
 
-      @errors = implementation::SlidingWindow.new(max_size: @error_count_threshold)
-      @successes = implementation::Integer.new
-      @state = implementation::State.new
+      # With an error percentage, the sliding window only keeps the last error, for error_timeout_expired?
+      @errors = implementation::SlidingWindow.new(name: @name, max_size: @error_count_threshold || 1)
+      if error_percent_threshold
+        # One bucket per second errors are counted for, like errors older than error_timeout are dropped
+        @requests = implementation::RequestWindow.new(name: @name, buckets: [error_timeout.ceil, 1].max)
+      end
+      @successes = implementation::Integer.new(name: @name)
+      @state = implementation::State.new(name: @name)
 
-      reset
+      # A shared state already carries the history of the other processes using it
+      reset unless @state.shared?
     end
 
-    def acquire(resource = nil, &block)
+    def acquire(resource = nil)
       return yield if disabled?
       transition_to_half_open if transition_to_half_open?
 
       raise OpenCircuitError unless request_allowed?
+      return probe(resource) { yield } if @probe_slots && half_open?
 
-      result = nil
-      begin
-        result = maybe_with_half_open_resource_timeout(resource, &block)
-      rescue *@exceptions => error
-        if !error.respond_to?(:marks_semian_circuits?) || error.marks_semian_circuits?
-          mark_failed(error)
-        end
-        raise error
-      else
-        mark_success
-      end
-      result
+      call(resource) { yield }
+    end
+
+    # Not delegated with Forwardable, whose methods allocate their arguments on every call
+    def closed?
+      @state.closed?
+    end
+
+    def open?
+      @state.open?
+    end
+
+    def half_open?
+      @state.half_open?
     end
 
     def transition_to_half_open?
@@ -51,16 +80,19 @@ module Semian
     end
 
     def mark_failed(error)
+      time = current_time
       push_error(error)
-      push_time(@errors)
+      push_time(@errors, time: time)
+      @requests&.record_error(time)
       if closed?
-        transition_to_open if error_threshold_reached?
+        transition_to_open if error_threshold_reached?(time)
       elsif half_open?
         transition_to_open
       end
     end
 
     def mark_success
+      @requests&.record_success(current_time)
       return unless half_open?
       @successes.increment
       transition_to_close if success_threshold_reached?
@@ -76,6 +108,8 @@ module Semian
       @errors.destroy
       @successes.destroy
       @state.destroy
+      @probe_slots&.destroy
+      @requests&.destroy
     end
 
     def in_use?
@@ -83,13 +117,67 @@ module Semian
       @errors.size > 0
     end
 
+    # Publishes the state, and every transition from now on, to the stats of a bulkhead
+    def publish_state_to(resource)
+      @published_to = resource
+      resource.circuit_state = @state.value
+    end
+
     private
 
+    def call(resource)
+      result = nil
+      begin
+        result = maybe_with_half_open_resource_timeout(resource) { yield }
+      rescue *@exceptions => error
+        if !error.respond_to?(:marks_semian_circuits?) || error.marks_semian_circuits?
+          mark_failed(error)
+        end
+        raise error
+      else
+        mark_success
+      end
+      result
+    end
+
+    # Callers that don't get one of the probe slots fail fast, as if the circuit was still open
+    def probe(resource)
+      probing = false
+      result = take_probe_slot do
+        probing = true
+        call(resource) { yield }
+      end
+      raise OpenCircuitError unless probing
+      result
+    end
+
+    def take_probe_slot
+      return @probe_slots.try_acquire { yield } if @probe_slots.is_a?(Resource)
+
+      begin
+        yield if @probe_slots.increment <= @half_open_probes
+      ensure
+        @probe_slots.increment(-1)
+      end
+    end
+
+    # The slots are the tickets of a bulkhead, so probes are limited across every process on the host
+    # and the slot of a process that dies while probing is given back by SEM_UNDO. Without semaphores,
+    # probes are only limited within the process.
+    def create_probe_slots
+      if Semian.semaphores_enabled?
+        Resource.new(:"#{@name}_half_open_probes", tickets: @half_open_probes, timeout: 0)
+      else
+        ThreadSafe::Integer.new(name: @name)
+      end
+    end
+
     def transition_to_close
       notify_state_transition(:closed)
       log_state_transition(:closed)
       @state.close!
       @errors.clear
+      @requests&.clear
     end
 
     def transition_to_open
@@ -109,23 +197,37 @@ module Semian
       @successes.value >= @success_count_threshold
     end
 
-    def error_threshold_reached?
+    def error_threshold_reached?(time)
+      return error_percent_threshold_reached?(time) if @requests
       @errors.size == @error_count_threshold
     end
 
+    # Only trips once enough requests were made in the window for the percentage to be meaningful
+    def error_percent_threshold_reached?(time)
+      requests = @requests.requests(time)
+      requests >= @minimum_request_volume && @requests.errors(time) * 100 >= @error_percent_threshold * requests
+    end
+
     def error_timeout_expired?
       last_error_time = @errors.last
       return false unless last_error_time
-      Time.at(last_error_time) + @error_timeout < Time.now
+      last_error_time + @error_timeout_ms < current_time
     end
 
     def push_error(error)
       @last_error = error
     end
 
-    def push_time(window, time: Time.now)
-      window.reject! { |err_time| err_time + @error_timeout < time.to_i }
-      window << time.to_i
+    def push_time(window, time: current_time)
+      window.reject! { |err_time| err_time + @error_timeout_ms < time }
+      window << time
+    end
+
+    # Error times are integer milliseconds of the monotonic clock, like the timestamps of LRUHash,
+    # so checking them doesn't allocate and isn't affected by changes to the wall clock. The monotonic
+    # clock is the same for every process on the host, so shared error windows can use it too.
+    def current_time
+      Process.clock_gettime(Process::CLOCK_MONOTONIC, :millisecond)
     end
 
     def log_state_transition(new_state)
@@ -134,6 +236,9 @@ module Semian
       str = "[#{self.class.name}] State transition from #{@state.value} to #{new_state}."
       str << " success_count=#{@successes.value} error_count=#{@errors.size}"
       str << " success_count_threshold=#{@success_count_threshold} error_count_threshold=#{@error_count_threshold}"
+      if @requests
+        str << " error_percent_threshold=#{@error_percent_threshold} minimum_request_volume=#{@minimum_request_volume}"
+      end
       str << " error_timeout=#{@error_timeout} error_last_at=\"#{@errors.last}\""
       str << " name=\"#{@name}\""
       if new_state == :open && @last_error
@@ -144,21 +249,22 @@ module Semian
     end
 
     def notify_state_transition(new_state)
+      @published_to&.circuit_state = new_state
       Semian.notify(:state_change, self, nil, nil, state: new_state)
     end
 
     def disabled?
-      ENV['SEMIAN_CIRCUIT_BREAKER_DISABLED'] || ENV['SEMIAN_DISABLED']
+      ENV[CIRCUIT_BREAKER_DISABLED_ENV] || ENV[DISABLED_ENV]
     end
 
-    def maybe_with_half_open_resource_timeout(resource, &block)
+    def maybe_with_half_open_resource_timeout(resource)
       result =
         if half_open? && @half_open_resource_timeout && resource.respond_to?(:with_resource_timeout)
           resource.with_resource_timeout(@half_open_resource_timeout) do
-            block.call
+            yield
           end
         else
-          block.call
+          yield
         end
 
       result
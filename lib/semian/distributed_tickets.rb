@@ -0,0 +1,150 @@
+require 'socket'
+
+module Semian
+  # Limits the tickets of a resource across hosts, for backends shared by a whole fleet: without it,
+  # every host using a resource with 10 tickets may open 10 connections to it.
+  #
+  # The +tickets+ of the limit are leased from a +source+ shared by the hosts, that grants each
+  # holder a share of them for +ttl+ seconds. The share leased for this host becomes the ticket
+  # count of the resource, so acquiring a ticket stays local and never calls the source. A
+  # background thread leases the share when it starts, renews it every +interval+ seconds and
+  # resizes the tickets to it. Shrinking only takes back free tickets.
+  #
+  # A bulkhead keeps at least one ticket, so when the share is 0 the thread holds that last
+  # ticket itself, and acquiring fails once the caller's timeout passes, on every process of the
+  # host. The live leases of the fleet never add up to more than +tickets+.
+  #
+  # The source needs two methods, see Semian::RedisTicketSource:
+  #
+  #   lease(name, holder:, tickets:, want:, ttl:) -> granted
+  #     Grants +holder+ up to +want+ of the +tickets+ of +name+ for +ttl+ seconds, replacing
+  #     its previous lease, so that the live leases of all holders add up to at most +tickets+.
+  #     No holder is granted more than its fair share, +tickets+ divided by the live holders
+  #     rounded up, so that a host leasing first can't keep every ticket from the others.
+  #
+  #   release(name, holder:)
+  #     Gives the lease of +holder+ back.
+  #
+  # Until the first lease, and once the last lease expired without being renewed, such as when
+  # the source can't be reached, the host uses +fallback+ tickets (default 1). Other hosts may be
+  # leasing the share of a host that can't reach the source, so the fallback should be small.
+  #
+  # The holder is the host, so every process of the host sharing the resource leases the same
+  # share. The thread runs in the process that registered the resource. Processes forked from it
+  # share the host's tickets, and only need to call #start if the parent may exit before them.
+  class DistributedTickets
+    attr_reader :source, :tickets, :max, :interval, :ttl, :fallback, :holder
+
+    def initialize(resource, source:, tickets:, max: tickets, interval: 1, ttl: interval * 5, fallback: 1,
+                   holder: Socket.gethostname)
+      unless source.respond_to?(:lease) && source.respond_to?(:release)
+        raise ArgumentError, "source must respond to lease and release, got: #{source.inspect}"
+      end
+      unless tickets.is_a?(Integer) && max.is_a?(Integer) && tickets >= 1 && max >= 1 && max <= tickets
+        raise ArgumentError, "tickets and max must be integers with 1 <= max <= tickets, got: " \
+          "#{tickets.inspect}, #{max.inspect}"
+      end
+      unless interval.is_a?(Numeric) && interval > 0 && ttl.is_a?(Numeric) && ttl > interval
+        raise ArgumentError, "interval must be a positive number of seconds under ttl, got: " \
+          "#{interval.inspect}, #{ttl.inspect}"
+      end
+      unless fallback.is_a?(Integer) && fallback >= 0 && fallback <= max
+        raise ArgumentError, "fallback must be an integer between 0 and max, got: #{fallback.inspect}"
+      end
+
+      @resource = resource
+      @source = source
+      @tickets = tickets
+      @max = max
+      @interval = interval
+      @ttl = ttl
+      @fallback = fallback
+      @holder = holder
+      @lock = Mutex.new
+      @thread = nil
+      @pid = nil
+      @leased_until = nil
+      @held = nil
+    end
+
+    # Starts leasing this host's share in the background, without waiting for the source. Does
+    # nothing if the current process is already renewing it.
+    def start
+      @lock.synchronize do
+        return if @pid == Process.pid && @thread&.alive?
+
+        @pid = Process.pid
+        @held = nil
+        @thread = Thread.new do
+          loop do
+            renew
+            sleep(@interval)
+          end
+        end
+      end
+      self
+    end
+
+    # Stops renewing the lease, and gives it back to the source.
+    def stop
+      @lock.synchronize do
+        return unless @pid == Process.pid && @thread
+
+        @thread.kill
+        @thread = nil
+        release_held_ticket
+        @source.release(@resource.name, holder: @holder)
+      end
+    rescue StandardError => error
+      Semian.logger.warn("[#{self.class.name}] Could not release the tickets of #{@resource.name}: #{error.message}")
+    end
+
+    # Renews the lease of this host and resizes the tickets of the resource to it. Returns the
+    # new ticket count, or nil if the lease couldn't be renewed. Once the last lease expired, the
+    # tickets are resized to the fallback instead.
+    def refresh
+      now = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      begin
+        granted = @source.lease(@resource.name, holder: @holder, tickets: @tickets, want: @max, ttl: @ttl)
+        @leased_until = now + @ttl
+      rescue StandardError => error
+        Semian.logger.warn("[#{self.class.name}] Could not lease the tickets of #{@resource.name}: #{error.message}")
+        resize(@fallback) if @leased_until.nil? || now >= @leased_until
+        return
+      end
+      resize(granted.clamp(0, @max))
+    end
+
+    private
+
+    # Refreshes the lease from the background thread, which must keep running whatever it raises
+    def renew
+      refresh
+    rescue StandardError => error
+      Semian.logger.error("[#{self.class.name}] Could not resize the tickets of #{@resource.name}: #{error.message}")
+    end
+
+    def resize(count)
+      release_held_ticket if count > 0
+      tickets = @resource.scale_tickets(0, [count, 1].max, 1, @max)
+      hold_last_ticket if count == 0
+      count == 0 ? 0 : tickets
+    rescue ::Semian::TimeoutError
+      # Free tickets were taken while shrinking, try again next interval
+      nil
+    end
+
+    # Takes the bulkhead's last ticket without waiting, so that no process of the host can use
+    # it. Resizing tries again next interval if it's in use.
+    def hold_last_ticket
+      return if @held
+
+      @held = @resource.lease(timeout: 0)
+    end
+
+    def release_held_ticket
+      @held&.release
+      @held = nil
+    end
+  end
+end
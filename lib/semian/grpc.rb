@@ -89,14 +89,51 @@ module Semian
       acquire_semian_resource(adapter: :grpc, scope: :client_streamer) { super }
     end
 
+    # Without a block, streaming calls return their responses before they are read. The ticket is then
+    # leased and held until the responses have all been read, iterating them stops or raises, such as
+    # when the call is cancelled or its deadline passes, or they are closed. Streams must be drained or
+    # closed: one that is abandoned only gives its ticket back once it's garbage collected.
     def server_streamer(*, **)
       return super if disabled?
-      acquire_semian_resource(adapter: :grpc, scope: :server_streamer) { super }
+      return acquire_semian_resource(adapter: :grpc, scope: :server_streamer) { super } if block_given?
+      lease_semian_resource(adapter: :grpc, scope: :server_streamer) { |lease| hold_lease(lease, super) }
     end
 
     def bidi_streamer(*, **)
       return super if disabled?
-      acquire_semian_resource(adapter: :grpc, scope: :bidi_streamer) { super }
+      return acquire_semian_resource(adapter: :grpc, scope: :bidi_streamer) { super } if block_given?
+      lease_semian_resource(adapter: :grpc, scope: :bidi_streamer) { |lease| hold_lease(lease, super) }
+    end
+
+    private
+
+    def hold_lease(lease, responses)
+      unless responses.is_a?(Enumerator)
+        # An operation to execute later, or a call that returned early
+        lease.release
+        return responses
+      end
+      LeasedResponses.new(lease, responses)
+    end
+
+    # The responses of a streaming call, holding the call's ticket until they have been read
+    class LeasedResponses < Enumerator
+      def initialize(lease, responses)
+        @lease = lease
+        super() do |yielder|
+          begin
+            responses.each { |response| yielder << response }
+          ensure
+            lease.release
+          end
+        end
+      end
+
+      # Gives the ticket back without reading the remaining responses
+      def close
+        @lease.release
+        nil
+      end
     end
   end
 end
@@ -1,22 +1,90 @@
 module Semian
   module Instrumentable
-    def subscribe(name = rand, &block)
-      subscribers[name] = block
+    NO_PAYLOAD = Object.new.freeze
+    private_constant :NO_PAYLOAD
+
+    # Calls its block for every Nth notification it receives, counting the notifications of
+    # every thread together
+    class SampledSubscriber
+      def initialize(every, block)
+        @every = every
+        @block = block
+        @count = 0
+        @mutex = Mutex.new
+      end
+
+      def call(event, resource = nil, scope = nil, adapter = nil, payload = NO_PAYLOAD)
+        return unless sampled?
+
+        if NO_PAYLOAD.equal?(payload)
+          @block.call(event, resource, scope, adapter)
+        else
+          @block.call(event, resource, scope, adapter, payload)
+        end
+      end
+
+      private
+
+      def sampled?
+        @mutex.synchronize do
+          @count += 1
+          next false if @count < @every
+
+          @count = 0
+          true
+        end
+      end
+    end
+    private_constant :SampledSubscriber
+
+    Subscription = Struct.new(:block, :subscriber, :events)
+    private_constant :Subscription
+
+    EMPTY_DISPATCH = [].freeze
+    private_constant :EMPTY_DISPATCH
+
+    # Subscribes a block to notifications.
+    #
+    # +events+: Only notify the block of these events, for example +[:busy, :circuit_open]+.
+    # Notifying an event without subscribers only costs a hash lookup. Default nil, every event.
+    #
+    # +sample+: Only notify the block of every +sample+th notification it would receive, for
+    # example of one in a hundred +:success+ events of a busy adapter. Default nil, every notification.
+    def subscribe(name = rand, events: nil, sample: nil, &block)
+      events = Array(events).freeze unless events.nil?
+      unless sample.nil? || (sample.is_a?(Integer) && sample > 0)
+        raise ArgumentError, "sample must be a positive integer, got: #{sample.inspect}"
+      end
+
+      subscriber = sample.nil? || sample == 1 ? block : SampledSubscriber.new(sample, block)
+      subscribers[name] = Subscription.new(block, subscriber, events)
+      rebuild_dispatch
       name
     end
 
     def unsubscribe(name)
-      subscribers.delete(name)
+      subscription = subscribers.delete(name)
+      rebuild_dispatch
+      subscription&.block
     end
 
     # Args:
     #   event (string)
-    #   resource (Object)
-    #   scope (string)
-    #   adapter (string)
+    #   resource (Object, optional)
+    #   scope (string, optional)
+    #   adapter (string, optional)
     #   payload (optional)
-    def notify(*args)
-      subscribers.values.each { |subscriber| subscriber.call(*args) }
+    #
+    # The arguments aren't splatted, to keep notifying from allocating
+    def notify(event, resource = nil, scope = nil, adapter = nil, payload = NO_PAYLOAD)
+      dispatch = @dispatch_by_event && @dispatch_by_event[event] || @dispatch_all || EMPTY_DISPATCH
+      return if dispatch.empty?
+
+      if NO_PAYLOAD.equal?(payload)
+        dispatch.each { |subscriber| subscriber.call(event, resource, scope, adapter) }
+      else
+        dispatch.each { |subscriber| subscriber.call(event, resource, scope, adapter, payload) }
+      end
     end
 
     private
@@ -24,5 +92,18 @@ module Semian
     def subscribers
       @subscribers ||= {}
     end
+
+    # Precomputes the frozen list of subscribers of every event, in subscription order, so
+    # notify doesn't have to filter subscriptions
+    def rebuild_dispatch
+      subscriptions = subscribers.values
+      events = subscriptions.flat_map { |subscription| subscription.events || [] }.uniq
+
+      @dispatch_all = subscriptions.select { |subscription| subscription.events.nil? }.map(&:subscriber).freeze
+      @dispatch_by_event = events.map do |event|
+        matching = subscriptions.select { |subscription| subscription.events.nil? || subscription.events.include?(event) }
+        [event, matching.map(&:subscriber).freeze]
+      end.to_h.freeze
+    end
   end
 end
@@ -27,12 +27,22 @@ class LRUHash
     end
   end
 
+  # Entries are kept in a circular doubly linked list, from the least to the most recently used,
+  # next to a hash indexing them by key. Looking up an entry only relinks it at the most recently
+  # used end, without rehashing or allocating.
+  Node = Struct.new(:key, :resource, :prev, :next)
+  private_constant :Node
+
   def keys
-    @lock.synchronize { @table.keys }
+    @lock.synchronize { each_node.map(&:key) }
   end
 
   def clear
-    @lock.synchronize { @table.clear }
+    @lock.synchronize do
+      @table.clear
+      @head.prev = @head.next = @head
+      @gc_cursor = nil
+    end
   end
 
   # Create an LRU hash
@@ -40,6 +50,8 @@ class LRUHash
   # Arguments:
   #   +max_size+ The maximum size of the table
   #   +min_time+ The minimum time a resource can live in the cache
+  #   +gc_batch_size+ The maximum number of resources examined by a single garbage collection.
+  #     Collections pick up where the previous one stopped, nil examines as many as needed.
   #
   # Note:
   #   The +min_time+ is a stronger guarantee than +max_size+. That is, if there are
@@ -49,10 +61,15 @@ class LRUHash
   #   circuits to disparate endpoints (or your circuit names are bad).
   #   If the max_size is 0, the garbage collection will be very aggressive and
   #   potentially computationally expensive.
-  def initialize(max_size: Semian.maximum_lru_size, min_time: Semian.minimum_lru_time)
+  def initialize(max_size: Semian.maximum_lru_size, min_time: Semian.minimum_lru_time,
+                 gc_batch_size: Semian.lru_gc_batch_size)
     @max_size = max_size
     @min_time = min_time
+    @gc_batch_size = gc_batch_size
+    @gc_cursor = nil
     @table = {}
+    @head = Node.new
+    @head.prev = @head.next = @head
     @lock =
       if Semian.thread_safe?
         Mutex.new
@@ -65,8 +82,11 @@ class LRUHash
     @lock.synchronize { @table.size }
   end
 
-  def count(&block)
-    @lock.synchronize { @table.count(&block) }
+  def count
+    @lock.synchronize do
+      return @table.size unless block_given?
+      each_node.count { |node| yield [node.key, node.resource] }
+    end
   end
 
   def empty?
@@ -74,37 +94,45 @@ class LRUHash
   end
 
   def values
-    @lock.synchronize { @table.values }
+    @lock.synchronize { each_node.map(&:resource) }
   end
 
   def set(key, resource)
     @lock.synchronize do
-      @table.delete(key)
-      @table[key] = resource
-      resource.updated_at = Time.now
+      node = @table[key]
+      if node
+        unlink(node)
+        node.resource = resource
+      else
+        node = @table[key] = Node.new(key, resource)
+      end
+      link_most_recent(node)
+      resource.updated_at = current_time
     end
     clear_unused_resources if @table.length > @max_size
   end
 
-  # This method uses the property that "Hashes enumerate their values in the
-  # order that the corresponding keys were inserted." Deleting a key and
-  # re-inserting it effectively moves it to the front of the cache.
-  # Update the `updated_at` field so we can use it later do decide if the
-  # resource is "in use".
+  # Move the entry to the most recently used end of the list, and update its
+  # `updated_at` field so we can use it later do decide if the resource is "in use".
   def get(key)
     @lock.synchronize do
-      found = @table.delete(key)
-      if found
-        @table[key] = found
-        found.updated_at = Time.now
-      end
-      found
+      node = @table[key]
+      return unless node
+
+      unlink(node)
+      link_most_recent(node)
+      node.resource.updated_at = current_time
+      node.resource
     end
   end
 
   def delete(key)
     @lock.synchronize do
-      @table.delete(key)
+      node = @table.delete(key)
+      if node
+        unlink(node)
+        node.resource
+      end
     end
   end
 
@@ -118,6 +146,36 @@ class LRUHash
 
   private
 
+  # Monotonic timestamp in milliseconds, an Integer so it doesn't allocate
+  def current_time
+    Process.clock_gettime(Process::CLOCK_MONOTONIC, :millisecond)
+  end
+
+  def each_node
+    return to_enum(:each_node) unless block_given?
+
+    node = @head.next
+    until node.equal?(@head)
+      following = node.next
+      yield node
+      node = following
+    end
+  end
+
+  def link_most_recent(node)
+    node.prev = @head.prev
+    node.next = @head
+    @head.prev.next = node
+    @head.prev = node
+  end
+
+  def unlink(node)
+    @gc_cursor = nil if @gc_cursor.equal?(node)
+    node.prev.next = node.next
+    node.next.prev = node.prev
+    node.prev = node.next = nil
+  end
+
   def clear_unused_resources
     payload = {
         size: @table.size,
@@ -130,22 +188,30 @@ class LRUHash
     ran = try_synchronize do
       # Clears resources that have not been used in the last 5 minutes.
 
-      stop_time = Time.now - @min_time # Don't process resources updated after this time
-      @table.each do |_, resource|
+      stop_time = current_time - @min_time * 1000 # Don't process resources updated after this time
+      node = @gc_cursor || @head.next
+      @gc_cursor = nil
+      until node.equal?(@head)
+        if @gc_batch_size && payload[:examined] >= @gc_batch_size
+          # Out of budget, the next collection resumes from here
+          @gc_cursor = node
+          break
+        end
         payload[:examined] += 1
 
-        # The update times of the resources in the LRU are monotonically increasing,
-        # time, so we can stop looking once we find the first resource with an
+        # The list is ordered by update time, starting with the least recently used
+        # resource, so we can stop looking once we find the first resource with an
         # update time after the stop_time.
-        break if resource.updated_at > stop_time
-
-        next if resource.in_use?
+        break if node.resource.updated_at > stop_time
 
-        resource = @table.delete(resource.name)
-        if resource
+        following = node.next
+        unless node.resource.in_use?
+          @table.delete(node.key)
+          unlink(node)
           payload[:cleared] += 1
-          resource.destroy
+          node.resource.destroy
         end
+        node = following
       end
     end
 
@@ -2,7 +2,8 @@ module Semian
   class ProtectedResource
     extend Forwardable
 
-    def_delegators :@bulkhead, :destroy, :count, :semid, :tickets, :registered_workers
+    def_delegators :@bulkhead, :destroy, :count, :semid, :tickets, :registered_workers, :wait_time_histogram,
+                   :duration_histograms, :dropped_durations
     def_delegators :@circuit_breaker, :reset, :mark_failed, :mark_success, :request_allowed?,
                    :open?, :closed?, :half_open?
 
@@ -13,23 +14,67 @@ module Semian
       @name = name
       @bulkhead = bulkhead
       @circuit_breaker = circuit_breaker
-      @updated_at = Time.now
+      @adaptive_tickets = bulkhead&.adaptive_tickets
+      @circuit_breaker.publish_state_to(bulkhead) if bulkhead && circuit_breaker
+      @updated_at = Process.clock_gettime(Process::CLOCK_MONOTONIC, :millisecond)
     end
 
     def destroy
+      @bulkhead.distributed_tickets&.stop unless @bulkhead.nil?
       @bulkhead.destroy unless @bulkhead.nil?
       @circuit_breaker.destroy unless @circuit_breaker.nil?
     end
 
-    def acquire(timeout: nil, scope: nil, adapter: nil, resource: nil)
+    # +deadline+: The time by which the caller must be done, in seconds of the monotonic clock as returned by
+    # +Process.clock_gettime(Process::CLOCK_MONOTONIC)+. Waiting for a bulkhead ticket stops there.
+    def acquire(timeout: nil, scope: nil, adapter: nil, resource: nil, priority: nil, deadline: nil)
       acquire_circuit_breaker(scope, adapter, resource) do
-        acquire_bulkhead(timeout, scope, adapter) do |_, wait_time|
+        acquire_bulkhead(timeout, priority, scope, deadline, adapter) do |_, wait_time|
           Semian.notify(:success, self, scope, adapter, wait_time)
           yield self
         end
       end
     end
 
+    # Like acquire, but returns false right away instead of waiting when no bulkhead ticket is free.
+    # Calls shed this way are notified as +:busy+, and not counted by the circuit breaker.
+    def try_acquire(scope: nil, adapter: nil, resource: nil, priority: nil)
+      return acquire(scope: scope, adapter: adapter, resource: resource) { yield self } if @bulkhead.nil?
+
+      # Like acquire, an open circuit fails before a ticket is taken
+      unless @circuit_breaker.nil? || @circuit_breaker.request_allowed?
+        acquire_circuit_breaker(scope, adapter, resource) { nil }
+      end
+
+      acquired = false
+      result = try_acquire_bulkhead(priority, scope) do |wait_time|
+        acquired = true
+        acquire_circuit_breaker(scope, adapter, resource) do
+          Semian.notify(:success, self, scope, adapter, wait_time)
+          yield self
+        end
+      end
+      Semian.notify(:busy, self, scope, adapter) unless acquired
+      result
+    end
+
+    # Like acquire, but the bulkhead ticket outlives the block: it's yielded as a Resource::Lease, which
+    # the caller releases once done with the resource, e.g. when a stream is closed. The ticket is given
+    # back right away if the block raises. The circuit breaker only sees the errors raised by the block.
+    def lease(timeout: nil, scope: nil, adapter: nil, resource: nil, priority: nil, deadline: nil)
+      acquire_circuit_breaker(scope, adapter, resource) do
+        lease = lease_bulkhead(timeout, priority, scope, deadline, adapter)
+        begin
+          Semian.notify(:success, self, scope, adapter, lease.wait_time)
+          result = yield lease
+          lease = nil
+          result
+        ensure
+          lease&.release
+        end
+      end
+    end
+
     def in_use?
       circuit_breaker&.in_use? || bulkhead&.in_use?
     end
@@ -49,11 +94,21 @@ module Semian
       raise
     end
 
-    def acquire_bulkhead(timeout, scope, adapter)
+    def acquire_bulkhead(timeout, priority, scope, deadline, adapter)
       if @bulkhead.nil?
         yield self, 0
+      elsif @adaptive_tickets
+        acquire_adaptive_bulkhead(timeout, priority, scope, deadline) do |wait_time|
+          yield self, wait_time
+        end
+      elsif timeout.nil? && priority.nil? && deadline.nil?
+        # Passing keyword arguments to the extension allocates a hash, only do so when they are needed.
+        # The scope is positional, it picks the scope's tickets and duration histogram.
+        @bulkhead.acquire(scope) do |wait_time|
+          yield self, wait_time
+        end
       else
-        @bulkhead.acquire(timeout: timeout) do |wait_time|
+        @bulkhead.acquire(scope, timeout: timeout, priority: priority, deadline: deadline) do |wait_time|
           yield self, wait_time
         end
       end
@@ -61,5 +116,42 @@ module Semian
       Semian.notify(:busy, self, scope, adapter)
       raise
     end
+
+    def lease_bulkhead(timeout, priority, scope, deadline, adapter)
+      if @bulkhead.nil?
+        Resource::Lease.new
+      elsif timeout.nil? && priority.nil? && deadline.nil?
+        @bulkhead.lease(scope)
+      else
+        @bulkhead.lease(scope, timeout: timeout, priority: priority, deadline: deadline)
+      end
+    rescue ::Semian::TimeoutError
+      Semian.notify(:busy, self, scope, adapter)
+      raise
+    end
+
+    def try_acquire_bulkhead(priority, scope, &block)
+      if priority.nil?
+        @bulkhead.try_acquire(scope, &block)
+      else
+        @bulkhead.try_acquire(scope, priority: priority, &block)
+      end
+    end
+
+    def acquire_adaptive_bulkhead(timeout, priority, scope, deadline)
+      options = if timeout.nil? && priority.nil? && deadline.nil?
+        {}
+      else
+        { timeout: timeout, priority: priority, deadline: deadline }
+      end
+      @bulkhead.acquire(scope, **options) do |wait_time|
+        started_at = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        begin
+          yield wait_time
+        ensure
+          @adaptive_tickets.record(started_at, wait_time)
+        end
+      end
+    end
   end
 end
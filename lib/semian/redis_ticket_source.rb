@@ -0,0 +1,68 @@
+require 'semian'
+
+module Semian
+  # Leases the tickets of Semian::DistributedTickets from Redis, to limit a resource across every
+  # host using the same Redis server:
+  #
+  #   source = Semian::RedisTicketSource.new(Redis.new(url: ENV['SEMIAN_REDIS_URL']))
+  #   Semian.register(:mysql_primary, distributed_tickets: { source: source, tickets: 50, max: 4 }, ...)
+  #
+  # The leases of a resource are kept in a single hash, by holder, and each lease is granted by a
+  # script so that holders renewing at the same time can't grant more than the limit together.
+  # A holder is granted at most its fair share of the limit among the live holders, so hosts
+  # joining later get tickets once the others renew and shrink to their share. Leases that weren't
+  # renewed within their ttl, like those of dead hosts, are dropped.
+  class RedisTicketSource
+    # Fields are holders, values are "tickets:expiry" with the expiry in milliseconds of the
+    # server's clock
+    LEASE_SCRIPT = <<~LUA.freeze
+      local now = redis.call('TIME')
+      now = tonumber(now[1]) * 1000 + math.floor(tonumber(now[2]) / 1000)
+      local holder, tickets, want, ttl = ARGV[1], tonumber(ARGV[2]), tonumber(ARGV[3]), tonumber(ARGV[4])
+
+      local leases = redis.call('HGETALL', KEYS[1])
+      local leased, holders = 0, 1
+      for i = 1, #leases, 2 do
+        local count, expiry = string.match(leases[i + 1], '(%d+):(%d+)')
+        if tonumber(expiry) <= now then
+          redis.call('HDEL', KEYS[1], leases[i])
+        elseif leases[i] ~= holder then
+          leased = leased + tonumber(count)
+          holders = holders + 1
+        end
+      end
+
+      local share = math.ceil(tickets / holders)
+      local granted = math.max(0, math.min(want, share, tickets - leased))
+      redis.call('HSET', KEYS[1], holder, granted .. ':' .. (now + ttl))
+      redis.call('PEXPIRE', KEYS[1], ttl)
+      return granted
+    LUA
+
+    attr_reader :redis, :prefix
+
+    def initialize(redis, prefix: 'semian:tickets:')
+      @redis = redis
+      @prefix = prefix
+    end
+
+    def lease(name, holder:, tickets:, want:, ttl:)
+      @redis.eval(LEASE_SCRIPT, keys: [key(name)], argv: [holder, tickets, want, (ttl * 1000).ceil])
+    end
+
+    def release(name, holder:)
+      @redis.hdel(key(name), holder)
+    end
+
+    # Returns the tickets currently leased to each holder, including expired leases not dropped yet
+    def leases(name)
+      @redis.hgetall(key(name)).map { |holder, lease| [holder, lease.to_i] }.to_h
+    end
+
+    private
+
+    def key(name)
+      "#{@prefix}#{Semian.namespace}#{name}"
+    end
+  end
+end
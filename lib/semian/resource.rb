@@ -1,27 +1,121 @@
 module Semian
   class Resource #:nodoc:
-    attr_reader :tickets, :name
+    attr_reader :tickets, :name, :ticket_backend, :resource_pool, :adaptive_tickets, :reserved_tickets, :max_queue,
+                :scope_tickets, :distributed_tickets
+
+    # A ticket taken by #lease and held until it's released. Without the extension there
+    # are no tickets to hold, and every lease is released.
+    class Lease
+      def release
+        false
+      end
+
+      def released?
+        true
+      end
+
+      def wait_time
+        0
+      end
+    end
 
     class << Semian::Resource
       # Ensure that there can only be one resource of a given type
       def instance(name, **kwargs)
         Semian.resources[name] ||= ProtectedResource.new(name, new(name, **kwargs), nil)
       end
+
+      def acquire_all(*)
+        wait_time = 0
+        yield wait_time
+      end
+
+      def stats_snapshot(*)
+        {}
+      end
+
+      def register_workers(*)
+        0
+      end
+
+      def wait_time_unit
+        @wait_time_unit || :milliseconds
+      end
+
+      def wait_time_unit=(unit)
+        unless unit.is_a?(Symbol)
+          raise TypeError, "wait time unit must be a symbol"
+        end
+        unless [:milliseconds, :nanoseconds, :seconds].include?(unit)
+          raise ArgumentError, "wait time unit must be :milliseconds, :nanoseconds or :seconds"
+        end
+        @wait_time_unit = unit
+      end
+
+      def key_hash
+        @key_hash || :sha1
+      end
+
+      def key_hash=(hash)
+        unless [:sha1, :fnv1a].include?(hash)
+          raise ArgumentError, "key hash must be :sha1 or :fnv1a"
+        end
+        @key_hash = hash
+      end
     end
 
-    def initialize(name, tickets: nil, quota: nil, permissions: Semian.default_permissions, timeout: 0)
+    def initialize(name, tickets: nil, quota: nil, permissions: Semian.default_permissions, timeout: 0,
+                   ticket_backend: :sysv, resource_pool: nil, adaptive_tickets: nil, reserved_tickets: nil,
+                   fifo: false, max_queue: nil, scope_tickets: nil, early_fail: false, preload: false,
+                   distributed_tickets: nil)
       unless name.is_a?(String) || name.is_a?(Symbol)
         raise TypeError, "name must be a string or symbol, got: #{name.class}"
       end
 
+      if adaptive_tickets
+        raise ArgumentError, "adaptive_tickets can't be combined with quota" if quota
+        @adaptive_tickets = AdaptiveTickets.new(self, **adaptive_tickets)
+        tickets ||= @adaptive_tickets.max
+      end
+
+      if distributed_tickets
+        if quota || tickets || adaptive_tickets
+          raise ArgumentError, "distributed_tickets can't be combined with tickets, quota or adaptive_tickets"
+        end
+        @distributed_tickets = DistributedTickets.new(self, **distributed_tickets)
+        # Until the first lease is granted, in the background
+        tickets = [@distributed_tickets.fallback, 1].max
+      end
+
       if Semian.semaphores_enabled?
         if respond_to?(:initialize_semaphore)
-          initialize_semaphore("#{Semian.namespace}#{name}", tickets, quota, permissions, timeout)
+          # Tickets sized by scale_tickets keep their count when the resource is registered again
+          scaled = !(@adaptive_tickets || @distributed_tickets).nil?
+          options = { ticket_backend: ticket_backend, adaptive_tickets: scaled }
+          options[:reserved_tickets] = reserved_tickets if reserved_tickets
+          options[:fifo] = true if fifo
+          options[:max_queue] = max_queue if max_queue
+          options[:scope_tickets] = scope_tickets if scope_tickets
+          options[:early_fail] = true if early_fail
+          options[:stats] = true if Semian.stats_enabled
+          options[:preload] = true if preload
+          if resource_pool
+            options[:resource_pool] = "#{Semian.namespace}#{resource_pool}"
+            options[:resource_pool_capacity] = Semian.resource_pool_capacity
+          end
+          initialize_semaphore("#{Semian.namespace}#{name}", tickets, quota, permissions, timeout, options)
         end
       else
         Semian.issue_disabled_semaphores_warning
       end
       @name = name
+      @ticket_backend = ticket_backend
+      @resource_pool = resource_pool
+      @reserved_tickets = reserved_tickets || 0
+      @max_queue = max_queue
+      @scope_tickets = scope_tickets
+      # Only hosts that issue tickets lease a share of them
+      @distributed_tickets.start if @distributed_tickets && Semian.semaphores_enabled? && respond_to?(:initialize_semaphore)
     end
 
     def reset_registered_workers!
@@ -38,6 +132,15 @@ module Semian
       yield wait_time
     end
 
+    def try_acquire(*)
+      wait_time = 0
+      yield wait_time
+    end
+
+    def lease(*)
+      Lease.new
+    end
+
     def count
       0
     end
@@ -46,6 +149,10 @@ module Semian
       0
     end
 
+    def scale_tickets(*)
+      0
+    end
+
     def registered_workers
       0
     end
@@ -61,5 +168,20 @@ module Semian
     def in_use?
       false
     end
+
+    def wait_time_histogram
+      {}
+    end
+
+    def duration_histograms
+      {}
+    end
+
+    def dropped_durations
+      0
+    end
+
+    def circuit_state=(state)
+    end
   end
 end
@@ -5,7 +5,7 @@ module Semian
     class Integer #:nodoc:
       attr_accessor :value
 
-      def initialize
+      def initialize(**)
         reset
       end
 
@@ -24,8 +24,9 @@ module Semian
   end
 
   module ThreadSafe
+    # Replaced by atomic native methods when the extension is loaded
     class Integer < Simple::Integer
-      def initialize(*)
+      def initialize(**)
         super
         @lock = Mutex.new
       end
@@ -35,4 +36,14 @@ module Semian
       end
     end
   end
+
+  module SysV
+    # An integer kept in shared memory, shared by every process on the host that
+    # uses the same name. Updates are atomic.
+    class Integer < Simple::Integer
+      def initialize(name:, permissions: Semian.default_permissions)
+        initialize_shared_memory("#{Semian.namespace}#{name}", permissions)
+      end
+    end
+  end
 end
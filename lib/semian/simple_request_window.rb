@@ -0,0 +1,112 @@
+require 'thread'
+
+module Semian
+  module Simple
+    class RequestWindow #:nodoc:
+      attr_reader :buckets
+
+      # A request window counts the successful and failed requests of the last +buckets+ seconds,
+      # with one bucket per second: if @buckets = 3 and the time is 10.5 seconds, the window holds the
+      # counts of seconds 8, 9 and 10. Requests are recorded in the bucket of their second, which is
+      # reset the first time it's used after the window moved past it.
+      #
+      # Times are integer milliseconds of the monotonic clock. When the C extension is loaded, it
+      # replaces this implementation with a native one.
+
+      def initialize(buckets:, **)
+        raise ArgumentError, 'buckets must be positive' unless buckets > 0
+        @buckets = buckets
+        @seconds = Array.new(buckets)
+        @successes = Array.new(buckets, 0)
+        @errors = Array.new(buckets, 0)
+      end
+
+      def record_success(now)
+        @successes[bucket(now)] += 1
+        self
+      end
+
+      def record_error(now)
+        @errors[bucket(now)] += 1
+        self
+      end
+
+      def requests(now)
+        count(now) { |index| @successes[index] + @errors[index] }
+      end
+
+      def errors(now)
+        count(now) { |index| @errors[index] }
+      end
+
+      def clear
+        @seconds.fill(nil)
+        @successes.fill(0)
+        @errors.fill(0)
+        self
+      end
+      alias_method :destroy, :clear
+
+      private
+
+      def bucket(now)
+        second = now / 1000
+        index = second % @buckets
+        unless @seconds[index] == second
+          @seconds[index] = second
+          @successes[index] = 0
+          @errors[index] = 0
+        end
+        index
+      end
+
+      def count(now)
+        second = now / 1000
+        total = 0
+        @buckets.times do |index|
+          bucket_second = @seconds[index]
+          next if bucket_second.nil? || bucket_second <= second - @buckets || bucket_second > second
+          total += yield index
+        end
+        total
+      end
+    end
+  end
+
+  module ThreadSafe
+    # Replaced by native methods that don't need the lock when the extension is loaded
+    class RequestWindow < Simple::RequestWindow
+      def initialize(**)
+        super
+        @lock = Mutex.new
+      end
+
+      def record_success(*)
+        @lock.synchronize { super }
+      end
+
+      def record_error(*)
+        @lock.synchronize { super }
+      end
+
+      def requests(*)
+        @lock.synchronize { super }
+      end
+
+      def errors(*)
+        @lock.synchronize { super }
+      end
+    end
+  end
+
+  module SysV
+    # A request window kept in shared memory, shared by every process on the host
+    # that uses the same name. All methods are implemented natively, and are safe
+    # to call from multiple threads and processes.
+    class RequestWindow < Simple::RequestWindow
+      def initialize(name:, buckets:, permissions: Semian.default_permissions)
+        initialize_shared_memory("#{Semian.namespace}#{name}", buckets, permissions)
+      end
+    end
+  end
+end
@@ -5,14 +5,17 @@ module Semian
     class SlidingWindow #:nodoc:
       extend Forwardable
 
-      def_delegators :@window, :size, :last
+      def_delegators :@window, :size, :last, :to_a
       attr_reader :max_size
 
       # A sliding window is a structure that stores the most @max_size recent timestamps
       # like this: if @max_size = 4, current time is 10, @window =[5,7,9,10].
       # Another push of (11) at 11 sec would make @window [7,9,10,11], shifting off 5.
+      #
+      # When the C extension is loaded, it replaces this implementation with a fixed-capacity
+      # ring buffer that never reallocates on push.
 
-      def initialize(max_size:)
+      def initialize(max_size:, **)
         @max_size = max_size
         @window = []
       end
@@ -22,7 +25,8 @@ module Semian
       end
 
       def push(value)
-        resize_to(@max_size - 1) # make room
+        return self if @max_size == 0
+        @window.shift if @window.size >= @max_size # make room
         @window << value
         self
       end
@@ -33,16 +37,11 @@ module Semian
         self
       end
       alias_method :destroy, :clear
-
-      private
-
-      def resize_to(size)
-        @window = @window.last(size) if @window.size >= size
-      end
     end
   end
 
   module ThreadSafe
+    # Replaced by native methods that don't need the lock when the extension is loaded
     class SlidingWindow < Simple::SlidingWindow
       def initialize(**)
         super
@@ -65,4 +64,15 @@ module Semian
       end
     end
   end
+
+  module SysV
+    # A sliding window kept in shared memory, shared by every process on the host
+    # that uses the same name. All methods are implemented natively, and are safe
+    # to call from multiple threads and processes.
+    class SlidingWindow < Simple::SlidingWindow
+      def initialize(name:, max_size:, permissions: Semian.default_permissions)
+        initialize_shared_memory("#{Semian.namespace}#{name}", max_size, permissions)
+      end
+    end
+  end
 end
@@ -1,10 +1,16 @@
 module Semian
   module Simple
     class State #:nodoc:
-      def initialize
+      def initialize(**)
         reset
       end
 
+      # Whether the state is shared with other processes, in which case it must
+      # not be reset when a process starts using it.
+      def shared?
+        false
+      end
+
       attr_reader :value
 
       def open?
@@ -47,4 +53,18 @@ module Semian
       # a simple assignment.
     end
   end
+
+  module SysV
+    # A circuit breaker state kept in shared memory, shared by every process on the
+    # host that uses the same name.
+    class State < Simple::State
+      def initialize(name:, permissions: Semian.default_permissions)
+        initialize_shared_memory("#{Semian.namespace}#{name}", permissions)
+      end
+
+      def shared?
+        true
+      end
+    end
+  end
 end
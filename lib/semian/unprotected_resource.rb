@@ -7,7 +7,7 @@ module Semian
 
     def initialize(name)
       @name = name
-      @updated_at = Time.now
+      @updated_at = Process.clock_gettime(Process::CLOCK_MONOTONIC, :millisecond)
     end
 
     def registered_workers
@@ -25,6 +25,14 @@ module Semian
       yield self
     end
 
+    def try_acquire(*)
+      yield self
+    end
+
+    def lease(*)
+      yield Resource::Lease.new
+    end
+
     def count
       0
     end
@@ -69,5 +77,17 @@ module Semian
     def in_use?
       true
     end
+
+    def wait_time_histogram
+      {}
+    end
+
+    def duration_histograms
+      {}
+    end
+
+    def dropped_durations
+      0
+    end
   end
 end
@@ -0,0 +1,90 @@
+require 'test_helper'
+
+class TestAdaptiveTickets < Minitest::Test
+  def setup
+    Semian.destroy(:adaptive_testing)
+  end
+
+  def teardown
+    Semian.destroy(:adaptive_testing)
+    Timecop.return
+  end
+
+  def test_starts_with_max_tickets
+    resource = register_resource(max: 8)
+    assert_equal 8, resource.tickets
+  end
+
+  def test_starts_with_tickets_when_given
+    resource = register_resource(max: 8, tickets: 3)
+    assert_equal 3, resource.tickets
+  end
+
+  def test_backs_off_when_slower_than_target_latency
+    resource = register_resource(max: 10)
+
+    call(resource, duration: 0.5)
+    assert_equal 10, resource.tickets
+
+    Timecop.travel(1)
+    call(resource, duration: 0.5)
+    assert_equal 9, resource.tickets
+  end
+
+  def test_grows_when_callers_wait_for_tickets
+    resource = register_resource(max: 10, tickets: 4)
+    adaptive_tickets = resource.bulkhead.adaptive_tickets
+
+    adaptive_tickets.record(Process.clock_gettime(Process::CLOCK_MONOTONIC), 5)
+    Timecop.travel(1)
+    adaptive_tickets.record(Process.clock_gettime(Process::CLOCK_MONOTONIC), 0)
+    assert_equal 5, resource.tickets
+  end
+
+  def test_keeps_tickets_when_fast_and_not_waiting
+    resource = register_resource(max: 10, tickets: 4)
+
+    call(resource, duration: 0.01)
+    Timecop.travel(1)
+    call(resource, duration: 0.01)
+    assert_equal 4, resource.tickets
+  end
+
+  def test_does_not_back_off_below_min
+    resource = register_resource(max: 10, tickets: 2, min: 2)
+
+    3.times do
+      Timecop.travel(1)
+      call(resource, duration: 0.5)
+    end
+    assert_equal 2, resource.tickets
+  end
+
+  def test_invalid_options_raise
+    assert_raises ArgumentError do
+      register_resource(max: 2, min: 3)
+    end
+    assert_raises ArgumentError do
+      register_resource(max: 2, target_latency: 0)
+    end
+    assert_raises ArgumentError do
+      register_resource(max: 2, backoff_ratio: 1.5)
+    end
+  end
+
+  private
+
+  def register_resource(tickets: nil, target_latency: 0.1, **adaptive_tickets)
+    Semian.register(
+      :adaptive_testing,
+      tickets: tickets,
+      timeout: 1,
+      circuit_breaker: false,
+      adaptive_tickets: { target_latency: target_latency, **adaptive_tickets },
+    )
+  end
+
+  def call(resource, duration:)
+    resource.acquire { Timecop.travel(duration) }
+  end
+end
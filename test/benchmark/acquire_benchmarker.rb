@@ -0,0 +1,65 @@
+# Benchmarks the success path of acquiring a resource, directly and through an adapter.
+# Neither should allocate once the resource is registered.
+$LOAD_PATH.unshift File.expand_path('../../../lib', __FILE__)
+require 'benchmark'
+require 'benchmark/ips'
+require 'benchmark/memory'
+require 'semian'
+require 'semian/adapter'
+
+class AcquireBenchmarker
+  class Adapter
+    include Semian::Adapter
+
+    def semian_identifier
+      :acquire_benchmark
+    end
+
+    def query
+      acquire_semian_resource(scope: :query, adapter: :benchmark) { nil }
+    end
+
+    private
+
+    def raw_semian_options
+      { tickets: 2, timeout: 0.5, error_threshold: 3, error_timeout: 10, success_threshold: 1 }
+    end
+  end
+
+  def initialize
+    @adapter = Adapter.new
+    @resource = @adapter.semian_resource
+    Semian.subscribe(:acquire_benchmark) { |_event, _resource, _scope, _adapter, _wait_time| }
+  end
+
+  def run_ips_benchmark
+    Benchmark.ips do |x|
+      x.report('ProtectedResource#acquire') { @resource.acquire(scope: :query, adapter: :benchmark) { nil } }
+      x.report('Adapter#acquire_semian_resource') { @adapter.query }
+    end
+  end
+
+  def run_memory_benchmark
+    Benchmark.memory do |x|
+      x.report('1000 ProtectedResource#acquire') do
+        1000.times { @resource.acquire(scope: :query, adapter: :benchmark) { nil } }
+      end
+      x.report('1000 Adapter#acquire_semian_resource') do
+        1000.times { @adapter.query }
+      end
+    end
+  end
+
+  def cleanup
+    Semian.unsubscribe(:acquire_benchmark)
+    Semian.destroy(:acquire_benchmark)
+  end
+end
+
+benchmarker = AcquireBenchmarker.new
+begin
+  benchmarker.run_ips_benchmark
+  benchmarker.run_memory_benchmark
+ensure
+  benchmarker.cleanup
+end
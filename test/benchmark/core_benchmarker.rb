@@ -0,0 +1,201 @@
+# Benchmarks the core engine: acquiring a bulkhead alone and contended across processes and
+# threads, acquiring a circuit breaker in each of its states, and registering many resources.
+#
+# Prints one JSON object per measurement, or appends them to the file named by BENCHMARK_OUTPUT,
+# so that runs can be compared by a script. Every measurement reports the time and objects
+# allocated per call. Run with `bundle exec rake benchmark`.
+#
+# Environment:
+#   BENCHMARK_ITERATIONS: Calls per single threaded measurement. Default 100000.
+#   BENCHMARK_DURATION: Seconds every contended measurement runs for. Default 1.
+#   BENCHMARK_RESOURCES: Comma separated numbers of resources to register. Default 1000,10000.
+$LOAD_PATH.unshift File.expand_path('../../../lib', __FILE__)
+require 'json'
+require 'semian'
+
+class CoreBenchmarker
+  ITERATIONS = Integer(ENV.fetch('BENCHMARK_ITERATIONS', 100_000))
+  DURATION = Float(ENV.fetch('BENCHMARK_DURATION', 1))
+  RESOURCE_COUNTS = ENV.fetch('BENCHMARK_RESOURCES', '1000,10000').split(',').map { |count| Integer(count) }
+  PROCESSES = [1, 2, 4].freeze
+  THREADS = [1, 4].freeze
+
+  BenchmarkError = Class.new(StandardError)
+
+  def initialize(output)
+    @output = output
+    # Keeps the circuit breakers' state transitions out of the output
+    Semian.logger = Logger.new(nil)
+  end
+
+  def run
+    benchmark_resource_acquire
+    benchmark_contended_acquire
+    benchmark_circuit_breaker_acquire
+    benchmark_register
+  end
+
+  private
+
+  def benchmark_resource_acquire
+    [:sysv, :shm].each do |backend|
+      resource = Semian::Resource.new(:core_benchmark, tickets: 1, timeout: 1, ticket_backend: backend)
+      measure('resource_acquire', ITERATIONS, ticket_backend: backend) { resource.acquire { nil } }
+      resource.destroy
+    end
+  end
+
+  # Workers only hold their ticket for an increment, and there are half as many tickets as workers
+  def benchmark_contended_acquire
+    [:sysv, :shm].each do |backend|
+      PROCESSES.each do |processes|
+        THREADS.each do |threads|
+          tickets = [processes * threads / 2, 1].max
+          resource = Semian::Resource.new(:core_benchmark, tickets: tickets, timeout: 1, ticket_backend: backend)
+          begin
+            calls, timeouts = run_contended(resource, processes, threads)
+          ensure
+            resource.destroy
+          end
+
+          emit(
+            benchmark: 'contended_acquire',
+            ticket_backend: backend,
+            processes: processes,
+            threads: threads,
+            tickets: tickets,
+            calls: calls,
+            timeouts: timeouts,
+            calls_per_second: (calls / DURATION).round,
+          )
+        end
+      end
+    end
+  end
+
+  def run_contended(resource, processes, threads)
+    pipes = processes.times.map do
+      reader, writer = IO.pipe
+      fork do
+        reader.close
+        writer.write(JSON.dump(contend(resource, threads)))
+        writer.close
+        exit!(0)
+      end
+      writer.close
+      reader
+    end
+
+    results = pipes.map { |reader| JSON.parse(reader.read) }
+    Process.waitall
+    [results.sum { |result| result['calls'] }, results.sum { |result| result['timeouts'] }]
+  end
+
+  def contend(resource, threads)
+    deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + DURATION
+    counts = threads.times.map do
+      Thread.new do
+        calls = 0
+        timeouts = 0
+        while Process.clock_gettime(Process::CLOCK_MONOTONIC) < deadline
+          begin
+            resource.acquire { calls += 1 }
+          rescue Semian::TimeoutError
+            timeouts += 1
+          end
+        end
+        [calls, timeouts]
+      end
+    end.map(&:value)
+
+    { 'calls' => counts.sum(&:first), 'timeouts' => counts.sum(&:last) }
+  end
+
+  def benchmark_circuit_breaker_acquire
+    error = BenchmarkError.new('benchmark')
+
+    circuit_breaker = create_circuit_breaker
+    measure('circuit_breaker_acquire', ITERATIONS, state: :closed) { circuit_breaker.acquire { nil } }
+
+    circuit_breaker = create_circuit_breaker
+    circuit_breaker.mark_failed(error)
+    measure('circuit_breaker_acquire', ITERATIONS, state: :open) do
+      begin
+        circuit_breaker.acquire { nil }
+      rescue Semian::OpenCircuitError
+        nil
+      end
+    end
+
+    # Never reaches the success threshold, so the circuit stays half open
+    circuit_breaker = create_circuit_breaker
+    circuit_breaker.mark_failed(error)
+    circuit_breaker.send(:transition_to_half_open)
+    measure('circuit_breaker_acquire', ITERATIONS, state: :half_open) { circuit_breaker.acquire { nil } }
+  end
+
+  def create_circuit_breaker
+    Semian::CircuitBreaker.new(
+      :core_benchmark,
+      exceptions: [BenchmarkError],
+      success_threshold: ITERATIONS * 2,
+      error_threshold: 1,
+      error_timeout: 3600,
+      implementation: Semian::ThreadSafe,
+    )
+  end
+
+  def benchmark_register
+    previous_lru_size = Semian.maximum_lru_size
+    RESOURCE_COUNTS.each do |count|
+      Semian.reset!
+      Semian.maximum_lru_size = count
+      names = count.times.map { |i| "core_benchmark_#{i}" }
+      index = 0
+
+      begin
+        measure('register', count, warmup: 0) do
+          Semian.register(names[index], tickets: 1, error_threshold: 2, error_timeout: 5, success_threshold: 1)
+          index += 1
+        end
+      ensure
+        names.each { |name| Semian.destroy(name) }
+      end
+    end
+  ensure
+    Semian.maximum_lru_size = previous_lru_size
+    Semian.reset!
+  end
+
+  def measure(benchmark, iterations, warmup: 1000, **labels)
+    warmup.times { yield }
+
+    GC.start
+    allocated = GC.stat(:total_allocated_objects)
+    started_at = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+    iterations.times { yield }
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond) - started_at
+    allocated = GC.stat(:total_allocated_objects) - allocated
+
+    emit(
+      benchmark: benchmark,
+      **labels,
+      iterations: iterations,
+      ns_per_call: (elapsed.to_f / iterations).round(1),
+      calls_per_second: (iterations * 1e9 / elapsed).round,
+      allocations_per_call: (allocated.to_f / iterations).round(3),
+    )
+  end
+
+  def emit(result)
+    @output.puts(JSON.dump(result))
+    @output.flush
+  end
+end
+
+output = ENV['BENCHMARK_OUTPUT'] ? File.open(ENV['BENCHMARK_OUTPUT'], 'a') : $stdout
+begin
+  CoreBenchmarker.new(output).run
+ensure
+  output.close unless output == $stdout
+end
@@ -108,6 +108,18 @@ class TestCircuitBreaker < Minitest::Test
     assert_predicate @resource, :open?
   end
 
+  def test_checking_an_open_circuit_doesnt_allocate
+    open_circuit!
+    circuit_breaker = @resource.circuit_breaker
+    check = -> { 100.times { circuit_breaker.request_allowed? } }
+    2.times { check.call }
+
+    # Reading the counter may allocate too, so compare against measuring nothing
+    count_allocations {}
+    baseline = count_allocations {}
+    assert_equal baseline, count_allocations { check.call }
+  end
+
   def test_open_close_open_cycle
     resource = Semian.register(:open_close, tickets: 1, exceptions: [SomeError], error_threshold: 2, error_timeout: 5, success_threshold: 2)
 
@@ -281,4 +293,127 @@ class TestCircuitBreaker < Minitest::Test
   ensure
     Semian.unsubscribe(:test_notify_state_transition)
   end
+
+  def test_shared_circuit_breaker_state_is_shared_across_processes
+    name = :test_shared_circuit_breaker
+    options = {tickets: 1, exceptions: [SomeError], error_threshold: 2, error_timeout: 5, success_threshold: 1,
+               shared_circuit_breaker: true}
+    resource = Semian.register(name, **options)
+    assert_instance_of Semian::SysV::State, resource.circuit_breaker.state
+
+    pid = fork do
+      open_circuit!(Semian.register(name, **options))
+      exit!(0)
+    end
+    Process.wait(pid)
+
+    assert_circuit_opened(resource)
+    # Registering the resource again must not reset the state of the other processes
+    assert_circuit_opened(Semian.register(name, **options))
+  ensure
+    Semian.destroy(name)
+  end
+
+  def test_half_open_probes_are_limited_across_processes
+    name = :test_half_open_probes
+    resource = Semian.register(name, tickets: 2, exceptions: [SomeError], error_threshold: 2, error_timeout: 5,
+                                     success_threshold: 2, half_open_probes: 1)
+    half_open_cicuit!(resource)
+
+    resource.acquire do
+      assert_raises(Semian::OpenCircuitError) { resource.acquire { nil } }
+
+      pid = fork do
+        begin
+          resource.acquire { nil }
+        rescue Semian::OpenCircuitError
+          exit!(0)
+        end
+        exit!(1)
+      end
+      _, status = Process.wait2(pid)
+      assert_predicate status, :success?, 'Expected the probe of the other process to fail fast'
+    end
+
+    assert_predicate resource.circuit_breaker, :half_open?
+    assert_circuit_closed(resource)
+    assert_predicate resource.circuit_breaker, :closed?
+  ensure
+    Semian.destroy(name)
+  end
+
+  def test_half_open_probes_are_limited_within_the_process_without_semaphores
+    ENV['SEMIAN_SEMAPHORES_DISABLED'] = '1'
+    circuit_breaker = Semian::CircuitBreaker.new(:test_half_open_probes, exceptions: [SomeError], error_threshold: 2,
+                                                 error_timeout: 5, success_threshold: 2, half_open_probes: 1,
+                                                 implementation: Semian::ThreadSafe)
+    half_open_cicuit!(circuit_breaker)
+
+    circuit_breaker.acquire do
+      assert_raises(Semian::OpenCircuitError) { circuit_breaker.acquire { nil } }
+    end
+    assert_circuit_closed(circuit_breaker)
+  ensure
+    ENV.delete('SEMIAN_SEMAPHORES_DISABLED')
+  end
+
+  def test_error_percent_threshold_opens_the_circuit
+    resource = Semian.register(:error_percent, tickets: 1, exceptions: [SomeError], error_percent_threshold: 50,
+                                               minimum_request_volume: 4, error_timeout: 5, success_threshold: 1)
+
+    3.times { resource.acquire { nil } }
+    2.times { trigger_error!(resource) }
+    assert_predicate resource.circuit_breaker, :closed?
+
+    trigger_error!(resource)
+    assert_circuit_opened(resource)
+    assert_match(/error_percent_threshold=50 minimum_request_volume=4/, @strio.string)
+  ensure
+    Semian.destroy(:error_percent)
+  end
+
+  def test_error_percent_threshold_waits_for_the_minimum_request_volume
+    resource = Semian.register(:error_percent, tickets: 1, exceptions: [SomeError], error_percent_threshold: 50,
+                                               minimum_request_volume: 4, error_timeout: 5, success_threshold: 1)
+
+    3.times { trigger_error!(resource) }
+    assert_predicate resource.circuit_breaker, :closed?
+
+    Timecop.travel(6) do
+      # The errors fell out of the window
+      trigger_error!(resource)
+      assert_predicate resource.circuit_breaker, :closed?
+
+      3.times { trigger_error!(resource) }
+      assert_circuit_opened(resource)
+    end
+  ensure
+    Semian.destroy(:error_percent)
+  end
+
+  def test_error_percent_threshold_is_shared_across_processes
+    name = :test_shared_error_percent
+    options = {tickets: 1, exceptions: [SomeError], error_percent_threshold: 50, minimum_request_volume: 4,
+               error_timeout: 5, success_threshold: 1, shared_circuit_breaker: true}
+    resource = Semian.register(name, **options)
+    2.times { resource.acquire { nil } }
+
+    pid = fork do
+      2.times { trigger_error!(Semian.register(name, **options)) }
+      exit!(0)
+    end
+    Process.wait(pid)
+
+    assert_circuit_opened(resource)
+  ensure
+    Semian.destroy(name)
+  end
+
+  def test_invalid_half_open_probes
+    assert_raises(ArgumentError) do
+      Semian::CircuitBreaker.new(:test_half_open_probes, exceptions: [SomeError], error_threshold: 1, error_timeout: 5,
+                                                         success_threshold: 1, half_open_probes: 0,
+                                                         implementation: Semian::ThreadSafe)
+    end
+  end
 end
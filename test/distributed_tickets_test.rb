@@ -0,0 +1,186 @@
+require 'test_helper'
+
+class TestDistributedTickets < Minitest::Test
+  # Grants every holder its share of a limit, like a source shared by several hosts would
+  class FakeSource
+    attr_reader :leases
+    attr_accessor :error, :delay
+
+    def initialize
+      @leases = {}
+    end
+
+    def lease(_name, holder:, tickets:, want:, ttl:)
+      sleep delay if delay
+      raise error if error
+      others = @leases.reject { |other, _| other == holder }
+      share = (tickets.to_f / (others.size + 1)).ceil
+      @leases[holder] = [want, share, tickets - others.values.sum].min.clamp(0, want)
+    end
+
+    def release(_name, holder:)
+      @leases.delete(holder)
+    end
+  end
+
+  def setup
+    Semian.destroy(:distributed_testing)
+    Semian.destroy(:distributed_testing_2)
+    @source = FakeSource.new
+  end
+
+  def teardown
+    Semian.destroy(:distributed_testing)
+    Semian.destroy(:distributed_testing_2)
+  end
+
+  def test_starts_with_the_share_leased_for_the_host
+    resource = register_resource(tickets: 10, max: 4)
+    wait_for_tickets(resource, 4)
+    assert_equal({ 'host-1' => 4 }, @source.leases)
+  end
+
+  def test_hosts_share_the_tickets
+    @source.leases['host-0'] = 8
+    resource = register_resource(tickets: 10, max: 4)
+    wait_for_tickets(resource, 2)
+
+    @source.leases.delete('host-0')
+    resource.bulkhead.distributed_tickets.refresh
+    assert_equal 4, resource.tickets
+  end
+
+  def test_holders_asking_for_every_ticket_share_them
+    # Two hosts, each with its own bulkhead, leasing from the same source
+    first = register_resource(tickets: 10)
+    wait_for_tickets(first, 10)
+    second = register_resource(:distributed_testing_2, holder: 'host-2', tickets: 10)
+    200.times do
+      break if @source.leases.key?('host-2')
+      sleep 0.01
+    end
+    assert_equal 0, @source.leases['host-2'], "every ticket is leased by the first host"
+
+    first.bulkhead.distributed_tickets.refresh
+    second.bulkhead.distributed_tickets.refresh
+    assert_equal 5, first.tickets
+    assert_equal 5, second.tickets
+  end
+
+  def test_keeps_renewing_when_resizing_raises
+    logger = Semian.logger
+    log = StringIO.new
+    Semian.logger = Logger.new(log)
+    resource = register_resource(tickets: 10, max: 4, interval: 0.01)
+    resource.bulkhead.define_singleton_method(:scale_tickets) { |*| raise Semian::SyscallError, 'semop() failed' }
+
+    200.times do
+      break if log.string.scan(/semop\(\) failed/).size >= 2
+      sleep 0.01
+    end
+    assert_operator log.string.scan(/Could not resize the tickets of distributed_testing: semop\(\) failed/).size, :>=, 2
+    assert_predicate resource.bulkhead.distributed_tickets.instance_variable_get(:@thread), :alive?
+  ensure
+    Semian.logger = logger
+  end
+
+  def test_holds_the_last_ticket_when_none_are_granted
+    @source.leases['host-0'] = 10
+    resource = register_resource(tickets: 10, max: 4)
+    200.times do
+      break if resource.count == 0
+      sleep 0.01
+    end
+    assert_equal 0, resource.bulkhead.distributed_tickets.refresh
+    assert_equal 1, resource.tickets
+    assert_equal 0, resource.count
+    assert_raises Semian::TimeoutError do
+      resource.acquire(timeout: 0.01) {}
+    end
+
+    @source.leases['host-0'] = 8
+    assert_equal 2, resource.bulkhead.distributed_tickets.refresh
+    resource.acquire {}
+  end
+
+  def test_keeps_its_tickets_until_the_lease_expires_when_the_source_fails
+    resource = register_resource(tickets: 10, max: 4, interval: 0.2, ttl: 1)
+    wait_for_tickets(resource, 4)
+    @source.error = IOError.new('unreachable')
+    assert_nil resource.bulkhead.distributed_tickets.refresh
+    assert_equal 4, resource.tickets
+
+    # The background thread falls back once the lease expires
+    wait_for_tickets(resource, 1)
+  end
+
+  def test_uses_the_fallback_until_the_first_lease
+    @source.error = IOError.new('unreachable')
+    resource = register_resource(tickets: 10, max: 4, fallback: 2)
+    assert_equal 2, resource.tickets
+    assert_nil resource.bulkhead.distributed_tickets.refresh
+    assert_equal 2, resource.tickets
+  end
+
+  def test_registering_does_not_wait_for_the_source
+    @source.delay = 1
+    started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    resource = register_resource(tickets: 10, max: 4)
+    assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - started, :<, 0.5
+    assert_equal 1, resource.tickets
+  end
+
+  def test_renews_the_lease_in_the_background
+    resource = register_resource(tickets: 10, max: 4, interval: 0.01)
+    @source.leases['host-0'] = 7
+
+    200.times do
+      break if resource.tickets == 3
+      sleep 0.01
+    end
+    assert_equal 3, resource.tickets
+  end
+
+  def test_destroy_gives_the_lease_back
+    register_resource(tickets: 10, max: 4)
+    Semian.destroy(:distributed_testing)
+    assert_empty @source.leases
+  end
+
+  def test_invalid_options_raise
+    assert_raises ArgumentError do
+      register_resource(tickets: 2, max: 3)
+    end
+    assert_raises ArgumentError do
+      register_resource(tickets: 2, interval: 5, ttl: 1)
+    end
+    assert_raises ArgumentError do
+      register_resource(tickets: 4, max: 2, fallback: 3)
+    end
+    assert_raises ArgumentError do
+      Semian::Resource.new(:distributed_testing, distributed_tickets: { source: Object.new, tickets: 2 })
+    end
+    assert_raises ArgumentError do
+      Semian::Resource.new(:distributed_testing, tickets: 2, distributed_tickets: { source: @source, tickets: 2 })
+    end
+  end
+
+  private
+
+  def wait_for_tickets(resource, tickets)
+    200.times do
+      break if resource.tickets == tickets
+      sleep 0.01
+    end
+    assert_equal tickets, resource.tickets
+  end
+
+  def register_resource(name = :distributed_testing, holder: 'host-1', **distributed_tickets)
+    Semian.register(
+      name,
+      timeout: 1,
+      circuit_breaker: false,
+      distributed_tickets: { source: @source, holder: holder, **distributed_tickets },
+    )
+  end
+end
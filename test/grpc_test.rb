@@ -161,6 +161,41 @@ class TestGRPC < Minitest::Test
     end
   end
 
+  def test_server_streamer_holds_a_ticket_until_the_stream_is_read
+    run_services_on_server(@server, services: [EchoService]) do
+      responses = @stub.a_server_streaming_rpc(EchoMsg.new)
+      assert_equal 0, @stub.semian_resource.count
+      assert_raises GRPC::ResourceBusyError do
+        @stub.an_rpc(EchoMsg.new)
+      end
+
+      responses.each {}
+      assert_equal 1, @stub.semian_resource.count
+      @stub.an_rpc(EchoMsg.new)
+    end
+  end
+
+  def test_closing_a_stream_gives_its_ticket_back
+    run_services_on_server(@server, services: [EchoService]) do
+      responses = @stub.a_server_streaming_rpc(EchoMsg.new)
+      assert_equal 0, @stub.semian_resource.count
+
+      responses.next
+      responses.close
+      assert_equal 1, @stub.semian_resource.count
+    end
+  end
+
+  def test_bidi_streamer_holds_a_ticket_until_the_stream_is_read
+    run_services_on_server(@server, services: [EchoService]) do
+      responses = @stub.a_bidi_rpc([EchoMsg.new, EchoMsg.new])
+      assert_equal 0, @stub.semian_resource.count
+
+      responses.each {}
+      assert_equal 1, @stub.semian_resource.count
+    end
+  end
+
   private
 
   def open_circuit!(stub, method, args)
@@ -0,0 +1,11 @@
+module AllocationHelper
+  private
+
+  # Returns the number of objects allocated while running the block. Warm up the code path and count
+  # an empty block first, as the baseline the block is compared against.
+  def count_allocations
+    allocated = GC.stat(:total_allocated_objects)
+    yield
+    GC.stat(:total_allocated_objects) - allocated
+  end
+end
@@ -0,0 +1,57 @@
+# A minimal Fiber scheduler for tests, which only runs fibers that sleep or block
+class FiberScheduler
+  def initialize
+    @ready = []
+    @sleeping = {}
+    @blocked = {}
+  end
+
+  def fiber(&block)
+    fiber = Fiber.new(blocking: false, &block)
+    fiber.resume
+    fiber
+  end
+
+  def kernel_sleep(duration = nil)
+    @sleeping[Fiber.current] = duration ? now + duration : Float::INFINITY
+    Fiber.yield
+  end
+
+  def block(_blocker, timeout = nil)
+    @blocked[Fiber.current] = true
+    kernel_sleep(timeout)
+  ensure
+    @blocked.delete(Fiber.current)
+  end
+
+  def unblock(_blocker, fiber)
+    @ready << fiber
+  end
+
+  def io_wait(_io, _events, timeout = nil)
+    kernel_sleep(timeout || 0)
+  end
+
+  def close
+    run
+  end
+
+  private
+
+  def run
+    until @ready.empty? && @sleeping.empty?
+      @ready.shift.resume until @ready.empty?
+      next if @sleeping.empty?
+
+      fiber, wake_at = @sleeping.min_by { |_, time| time }
+      delay = wake_at - now
+      sleep(delay) if delay > 0 && delay.finite?
+      @sleeping.delete(fiber)
+      fiber.resume
+    end
+  end
+
+  def now
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  end
+end
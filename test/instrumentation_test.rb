@@ -65,6 +65,106 @@ class TestInstrumentation < Minitest::Test
     end
   end
 
+  def test_subscribe_to_events
+    events = []
+    subscription = Semian.subscribe(events: [:busy, :circuit_open]) do |event, _resource|
+      events << event
+    end
+
+    Semian[:testing].acquire do
+      assert_raises Semian::TimeoutError do
+        Semian[:testing].acquire {}
+      end
+    end
+    assert_raises Semian::OpenCircuitError do
+      Semian[:testing].acquire {}
+    end
+
+    assert_equal [:busy, :circuit_open], events
+  ensure
+    Semian.unsubscribe(subscription)
+  end
+
+  def test_subscribe_to_single_event
+    events = []
+    subscription = Semian.subscribe(events: :success) { |event, _resource| events << event }
+    catch_all = Semian.subscribe { |event, _resource| events << :"all_#{event}" }
+
+    Semian[:testing].acquire {}
+
+    assert_equal [:success, :all_success], events
+  ensure
+    Semian.unsubscribe(subscription)
+    Semian.unsubscribe(catch_all)
+  end
+
+  def test_subscribe_sampled
+    count = 0
+    subscription = Semian.subscribe(events: [:success], sample: 3) { |_event, _resource| count += 1 }
+
+    7.times { Semian[:testing].acquire {} }
+
+    assert_equal 2, count
+  ensure
+    Semian.unsubscribe(subscription)
+  end
+
+  def test_subscribe_sampled_across_threads
+    deliveries = Queue.new
+    subscription = Semian.subscribe(events: [:custom], sample: 10) { |event, _resource| deliveries << event }
+
+    8.times.map do
+      Thread.new { 1_000.times { Semian.notify(:custom, :resource, nil, nil) } }
+    end.each(&:join)
+
+    assert_equal 800, deliveries.size
+  ensure
+    Semian.unsubscribe(subscription)
+  end
+
+  def test_subscribe_sampled_keeps_payload
+    payloads = []
+    subscription = Semian.subscribe(events: [:state_change], sample: 1) do |_event, _resource, _scope, _adapter, payload|
+      payloads << payload
+    end
+
+    Semian[:testing].circuit_breaker.reset
+
+    assert_equal [{ state: :closed }], payloads
+  ensure
+    Semian.unsubscribe(subscription)
+  end
+
+  def test_subscribe_invalid_sample
+    assert_raises ArgumentError do
+      Semian.subscribe(sample: 0) {}
+    end
+  end
+
+  def test_notify_with_fewer_arguments
+    notifications = []
+    subscription = Semian.subscribe(events: [:custom]) do |*args|
+      notifications << args
+    end
+
+    Semian.notify(:custom, :resource)
+    Semian.notify(:custom)
+
+    assert_equal [[:custom, :resource, nil, nil], [:custom, nil, nil, nil]], notifications
+  ensure
+    Semian.unsubscribe(subscription)
+  end
+
+  def test_unsubscribe_stops_notifications
+    count = 0
+    subscription = Semian.subscribe(events: [:success]) { |_event, _resource| count += 1 }
+    Semian[:testing].acquire {}
+    Semian.unsubscribe(subscription)
+    Semian[:testing].acquire {}
+
+    assert_equal 1, count
+  end
+
   private
 
   def assert_notify(*expected_events)
@@ -50,6 +50,35 @@ class TestLRUHash < Minitest::Test
     assert_equal @lru_hash.values.first, @lru_hash.get('b')
   end
 
+  def test_set_replaces_item
+    first = create_circuit_breaker('a')
+    second = create_circuit_breaker('a')
+    @lru_hash.set('a', first)
+    @lru_hash.set('b', create_circuit_breaker('b'))
+    @lru_hash.set('a', second)
+
+    assert_equal 2, @lru_hash.size
+    assert_equal %w(b a), @lru_hash.keys
+    assert_equal second, @lru_hash.get('a')
+  end
+
+  def test_delete_returns_item
+    circuit_breaker = create_circuit_breaker('a')
+    @lru_hash.set('a', circuit_breaker)
+
+    assert_equal circuit_breaker, @lru_hash.delete('a')
+    assert_nil @lru_hash.delete('a')
+    assert_equal [], @lru_hash.values
+  end
+
+  def test_count_with_block
+    @lru_hash.set('a', create_circuit_breaker('a'))
+    @lru_hash.set('b', create_circuit_breaker('b'))
+
+    assert_equal 2, @lru_hash.count
+    assert_equal 1, @lru_hash.count { |key, resource| key == 'a' && resource.name == 'a' }
+  end
+
   def test_set_cleans_resources_if_last_error_has_expired
     @lru_hash.set('b', create_circuit_breaker('b', true, false, 1000))
 
@@ -134,7 +163,7 @@ class TestLRUHash < Minitest::Test
   end
 
   def test_monotonically_increasing
-    start_time = Time.now
+    start_time = Process.clock_gettime(Process::CLOCK_MONOTONIC, :millisecond)
 
     notification = 0
     subscriber = Semian.subscribe do |event, _resource, _scope, _adapter, payload|
@@ -156,8 +185,8 @@ class TestLRUHash < Minitest::Test
     assert_monotonic = lambda do
       previous_timestamp = start_time
       @lru_hash.keys.zip(@lru_hash.values).each do |key, val|
-        val = 
-        assert val.updated_at > previous_timestamp, "Timestamp for #{key} was not monotonically increasing"
+        assert val.updated_at >= previous_timestamp, "Timestamp for #{key} was not monotonically increasing"
+        previous_timestamp = val.updated_at
       end
     end
 
@@ -223,6 +252,48 @@ class TestLRUHash < Minitest::Test
     end
   end
 
+  def test_gc_batch_size
+    lru_hash = LRUHash.new(max_size: 0, gc_batch_size: 2)
+    examined = []
+    subscriber = Semian.subscribe do |event, resource, _scope, _adapter, payload|
+      examined << payload[:examined] if event == :lru_hash_gc && resource == lru_hash
+    end
+
+    %w(a b c d).each { |name| lru_hash.set(name, create_circuit_breaker(name, false)) }
+    examined.clear
+
+    Timecop.travel(Semian.minimum_lru_time + 1) do
+      lru_hash.set('e', create_circuit_breaker('e'))
+      assert_equal %w(c d e), lru_hash.keys
+
+      # Resumes from where the previous collection stopped
+      lru_hash.set('f', create_circuit_breaker('f'))
+      assert_equal %w(e f), lru_hash.keys
+
+      lru_hash.set('g', create_circuit_breaker('g'))
+      assert_equal %w(e f g), lru_hash.keys
+    end
+
+    assert_equal [2, 2, 1], examined
+  ensure
+    Semian.unsubscribe(subscriber)
+  end
+
+  def test_gc_batch_size_cursor_survives_deletion
+    lru_hash = LRUHash.new(max_size: 0, gc_batch_size: 1)
+    %w(a b c).each { |name| lru_hash.set(name, create_circuit_breaker(name, false)) }
+
+    Timecop.travel(Semian.minimum_lru_time + 1) do
+      lru_hash.set('d', create_circuit_breaker('d'))
+      assert_equal %w(b c d), lru_hash.keys
+
+      # The next collection would have resumed from b
+      lru_hash.delete('b')
+      lru_hash.set('e', create_circuit_breaker('e'))
+      assert_equal %w(d e), lru_hash.keys
+    end
+  end
+
   private
 
   def create_circuit_breaker(name, exceptions = true, bulkhead = false, error_timeout = 0)
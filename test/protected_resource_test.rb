@@ -60,6 +60,139 @@ class TestProtectedResource < Minitest::Test
     assert_nil @resource.circuit_breaker
   end
 
+  def test_acquire_bulkhead_with_priority
+    Semian.register(
+      :testing,
+      tickets: 1,
+      reserved_tickets: 1,
+      circuit_breaker: false,
+    )
+    @resource = Semian[:testing]
+
+    assert_raises Semian::TimeoutError do
+      @resource.acquire(priority: :low) {}
+    end
+
+    acquired = false
+    @resource.acquire(priority: :high) { acquired = true }
+    assert acquired
+  end
+
+  def test_acquire_bulkhead_with_scope_tickets
+    Semian.register(
+      :testing,
+      tickets: 2,
+      scope_tickets: { connection: 1 },
+      timeout: 0.05,
+      circuit_breaker: false,
+    )
+    @resource = Semian[:testing]
+
+    @resource.acquire(scope: :connection) do
+      assert_raises Semian::TimeoutError do
+        @resource.acquire(scope: :connection) {}
+      end
+
+      acquired = false
+      @resource.acquire(scope: :query) { acquired = true }
+      assert acquired
+    end
+  end
+
+  def test_acquire_bulkhead_with_deadline
+    Semian.register(:testing, tickets: 1, timeout: 5, circuit_breaker: false)
+    @resource = Semian[:testing]
+
+    @resource.acquire do
+      started_at = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      assert_raises Semian::TimeoutError do
+        @resource.acquire(deadline: started_at + 0.05) {}
+      end
+      assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - started_at, :<, 0.5
+    end
+  end
+
+  def test_try_acquire_sheds_without_waiting
+    Semian.register(
+      :testing,
+      tickets: 1,
+      timeout: 1,
+      exceptions: [SomeError],
+      error_threshold: 1,
+      error_timeout: 5,
+      success_threshold: 1,
+    )
+    @resource = Semian[:testing]
+    events = []
+    subscriber = Semian.subscribe { |event, *| events << event }
+
+    result = @resource.try_acquire do
+      refute(@resource.try_acquire { flunk "no ticket should be left" })
+      :result
+    end
+
+    assert_equal :result, result
+    assert_equal [:success, :busy], events.last(2)
+    assert @resource.closed?
+  ensure
+    Semian.unsubscribe(subscriber)
+  end
+
+  def test_try_acquire_checks_the_circuit_before_taking_a_ticket
+    Semian.register(:testing, tickets: 1, timeout: 1, exceptions: [SomeError], error_threshold: 1,
+                              error_timeout: 5, success_threshold: 1)
+    @resource = Semian[:testing]
+    assert_raises SomeError do
+      @resource.acquire { raise SomeError }
+    end
+    assert_predicate @resource, :open?
+    events = []
+    subscriber = Semian.subscribe { |event, *| events << event }
+
+    lease = @resource.bulkhead.lease
+    assert_raises Semian::OpenCircuitError do
+      @resource.try_acquire { flunk "the circuit is open" }
+    end
+    assert_equal [:circuit_open], events
+  ensure
+    lease&.release
+    Semian.unsubscribe(subscriber)
+  end
+
+  def test_acquire_records_durations_by_scope
+    Semian.register(:testing, tickets: 2, exceptions: [SomeError], error_threshold: 2, error_timeout: 5,
+                              success_threshold: 1)
+    @resource = Semian[:testing]
+
+    @resource.acquire(scope: :query, adapter: :testing) { nil }
+    @resource.acquire(scope: :query, timeout: 1) { nil }
+    @resource.try_acquire(scope: :connection) { nil }
+
+    histograms = @resource.duration_histograms
+    assert_equal 2, histograms[:query].values.sum
+    assert_equal 1, histograms[:connection].values.sum
+  end
+
+  def test_lease_holds_the_ticket_past_the_block
+    Semian.register(:testing, tickets: 1, timeout: 0.1, exceptions: [SomeError], error_threshold: 2,
+                              error_timeout: 5, success_threshold: 1)
+    @resource = Semian[:testing]
+
+    lease = @resource.lease(scope: :stream) { |leased| leased }
+    assert_equal 0, @resource.count
+    assert_raises Semian::TimeoutError do
+      @resource.lease { flunk "the ticket should still be leased" }
+    end
+    lease.release
+    assert_equal 1, @resource.count
+
+    assert_raises SomeError do
+      @resource.lease { raise SomeError }
+    end
+    assert_equal 1, @resource.count
+    assert_predicate @resource, :open?
+  end
+
   def test_acquire_bulkhead_with_circuit_breaker
     Semian.register(
       :testing,
@@ -84,6 +217,30 @@ class TestProtectedResource < Minitest::Test
     assert acquired
   end
 
+  def test_acquire_does_not_allocate_on_success
+    Semian.register(
+      :testing,
+      tickets: 2,
+      exceptions: [SomeError],
+      error_threshold: 2,
+      error_timeout: 5,
+      success_threshold: 1,
+    )
+    @resource = Semian[:testing]
+    subscriber = Semian.subscribe { |_event, _resource, _scope, _adapter, _wait_time| }
+
+    acquire = -> { @resource.acquire(scope: :query, adapter: :testing) { nil } }
+    # Warm up method caches, some call sites are only reached from the second acquire on
+    2.times { acquire.call }
+
+    # Reading the counter may allocate too, so compare against measuring nothing
+    count_allocations {}
+    baseline = count_allocations {}
+    assert_equal baseline, count_allocations { 10.times { acquire.call } }
+  ensure
+    Semian.unsubscribe(subscriber)
+  end
+
   def test_register_without_any_resource_fails
     assert_raises ArgumentError do
       Semian.register(
@@ -144,12 +301,15 @@ class TestProtectedResource < Minitest::Test
       Semian.register(name, tickets: 1, **options)
     end
 
-    Process.kill("INT", workers.shift)
+    Process.kill("INT", worker = workers.shift)
+    Process.wait(worker)
 
     Semian.register(name, tickets: 1, **options)
   ensure
     workers.each do |pid|
       Process.kill("INT", pid)
+      # Reap the worker, so its SIGCHLD can't interrupt the semops of the next tests
+      Process.wait(pid)
     end if workers
   end
 end
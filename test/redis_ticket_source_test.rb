@@ -0,0 +1,36 @@
+require 'test_helper'
+require 'semian/redis_ticket_source'
+
+class TestRedisTicketSource < Minitest::Test
+  def setup
+    @redis = Redis.new(host: SemianConfig['redis_host'], port: SemianConfig['redis_port'], db: 1, semian: false)
+    @source = Semian::RedisTicketSource.new(@redis, prefix: 'semian:test_tickets:')
+    @source.release(:testing, holder: 'host-1')
+    @source.release(:testing, holder: 'host-2')
+  end
+
+  def test_grants_up_to_the_wanted_tickets
+    assert_equal 4, @source.lease(:testing, holder: 'host-1', tickets: 10, want: 4, ttl: 5)
+    assert_equal({ 'host-1' => 4 }, @source.leases(:testing))
+  end
+
+  def test_holders_share_the_tickets
+    assert_equal 8, @source.lease(:testing, holder: 'host-1', tickets: 10, want: 8, ttl: 5)
+    assert_equal 2, @source.lease(:testing, holder: 'host-2', tickets: 10, want: 8, ttl: 5)
+    # Renewing shrinks host-1 to its fair share, which host-2 gets once it renews
+    assert_equal 5, @source.lease(:testing, holder: 'host-1', tickets: 10, want: 8, ttl: 5)
+    assert_equal 5, @source.lease(:testing, holder: 'host-2', tickets: 10, want: 8, ttl: 5)
+
+    @source.release(:testing, holder: 'host-1')
+    assert_equal 8, @source.lease(:testing, holder: 'host-2', tickets: 10, want: 8, ttl: 5)
+  end
+
+  def test_expired_leases_are_dropped
+    @source.lease(:testing, holder: 'host-1', tickets: 10, want: 10, ttl: 0.05)
+    assert_equal 0, @source.lease(:testing, holder: 'host-2', tickets: 10, want: 10, ttl: 5)
+
+    sleep 0.1
+    assert_equal 10, @source.lease(:testing, holder: 'host-2', tickets: 10, want: 10, ttl: 5)
+    assert_equal({ 'host-2' => 10 }, @source.leases(:testing))
+  end
+end
@@ -95,6 +95,15 @@ class TestResource < Minitest::Test
     r.destroy
   end
 
+  def test_quota_reconfigures_a_set_without_workers
+    resource = create_resource :testing, tickets: 20
+    resource.unregister_worker
+    assert_equal 0, resource.registered_workers
+
+    resource = create_resource :testing, quota: 0.5
+    assert_equal 1, resource.tickets
+  end
+
   def test_register_with_invalid_quota
     assert_raises ArgumentError do
       create_resource :testing, quota: 2.0
@@ -180,6 +189,24 @@ class TestResource < Minitest::Test
     end
   end
 
+  def test_register_concurrently_in_many_processes
+    reader, writer = IO.pipe
+    pids = Array.new(20) do
+      fork do
+        writer.close
+        reader.read
+        resource = Semian::Resource.new(:testing, tickets: 2, timeout: 0.5)
+        exit! resource.tickets == 2 ? 0 : 1
+      end
+    end
+    reader.close
+    writer.close # Releases every worker at once
+
+    statuses = pids.map { |pid| Process.wait2(pid).last.exitstatus }
+    assert_equal([0] * pids.size, statuses)
+    assert_equal(2, create_resource(:testing, tickets: 2).tickets)
+  end
+
   def test_quota_acquire
     quota = 0.5
     workers = 9
@@ -214,7 +241,10 @@ class TestResource < Minitest::Test
     # Spawn some workers with an initial quota
     fork_workers(count: workers - 1, quota: quota, timeout: 0.5, wait_for_timeout: true)
     resource = create_resource :testing, quota: new_quota, timeout: 0.1
+    # Registering doesn't resize the tickets, acquiring does
+    assert_equal((workers * quota).ceil, resource.tickets)
 
+    resource.acquire {}
     assert_equal((workers * new_quota).ceil, resource.tickets)
   end
 
@@ -228,11 +258,21 @@ class TestResource < Minitest::Test
       sleep 1
     end
 
-    # We need to signal here to be able to enter the critical section
-    signal_workers('TERM')
     resource = create_resource :testing, quota: new_quota, timeout: 0.1
 
-    assert_equal((workers * new_quota).ceil, resource.tickets)
+    # Every ticket is in use, so shrinking takes none of them back instead of waiting for them
+    started_at = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    assert_raises Semian::TimeoutError do
+      resource.acquire {}
+    end
+    assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - started_at, :<, 0.5
+    assert_equal((workers * quota).ceil, resource.tickets)
+
+    # The tickets are taken back by the next resize once the workers released them
+    signal_workers('TERM')
+    Process.waitall
+    resource.acquire {}
+    assert_equal 1, resource.tickets
   end
 
   def test_quota_sets_tickets_from_workers
@@ -274,10 +314,13 @@ class TestResource < Minitest::Test
     signal_workers('KILL')
     Process.waitall
 
-    # Number of tickets should be unchanged until resource is created
+    # Number of tickets should be unchanged until the resource is acquired
     assert_equal((workers * quota).ceil, resource.tickets)
 
     resource = create_resource :testing, quota: quota, timeout: 0.1
+    assert_equal((workers * quota).ceil, resource.tickets)
+
+    resource.acquire {}
     assert_equal 1, resource.tickets
   end
 
@@ -302,6 +345,7 @@ class TestResource < Minitest::Test
     # Create a quota based worker, and ensure it accounts for the static
     # workers that haven't shut down yet
     resource = create_resource :testing, quota: quota, timeout: 0.1
+    resource.acquire {}
     assert_equal((quota * workers).ceil, resource.tickets)
 
     # Let the static workers shut down
@@ -310,6 +354,7 @@ class TestResource < Minitest::Test
     # Create a new resource, and ensure the static workers are no longer
     # accounted for
     resource = create_resource :testing, quota: quota, timeout: 0.1
+    resource.acquire {}
     assert_equal((quota * 2).ceil, resource.tickets)
   end
 
@@ -355,6 +400,51 @@ class TestResource < Minitest::Test
     assert_equal('0x874714f2', resource.key)
   end
 
+  def test_get_resource_key_with_fnv1a_hash
+    Semian::Resource.key_hash = :fnv1a
+    resource = create_resource :testing, tickets: 2
+
+    hash = 'testing_NUM_SEMS_4'.each_byte.reduce(0x811c9dc5) { |h, byte| ((h ^ byte) * 0x01000193) & 0xffffffff }
+    assert_equal(format('0x%08x', hash), resource.key)
+    assert_equal :fnv1a, Semian::Resource.key_hash
+  ensure
+    resource&.destroy
+    Semian::Resource.key_hash = :sha1
+  end
+
+  def test_invalid_key_hash
+    assert_raises ArgumentError do
+      Semian::Resource.key_hash = :md5
+    end
+  end
+
+  def test_register_again_after_destroy
+    resource = create_resource :testing, tickets: 2
+    resource.destroy
+
+    resource = create_resource :testing, tickets: 2
+    acquired = false
+    resource.acquire { acquired = true }
+    assert acquired
+    assert_equal 2, resource.count
+  end
+
+  def test_register_again_after_another_process_removed_the_set
+    resource = create_resource :testing, tickets: 2
+    semid = resource.semid
+    pid = fork do
+      Semian::Resource.new(:testing, tickets: 2).destroy
+      exit!(0)
+    end
+    Process.wait(pid)
+
+    resource = create_resource :testing, tickets: 2
+    refute_equal semid, resource.semid
+    acquired = false
+    resource.acquire { acquired = true }
+    assert acquired
+  end
+
   def test_count
     resource = create_resource :testing, tickets: 2
     acquired = false
@@ -495,6 +585,73 @@ class TestResource < Minitest::Test
     Process.waitall
   end
 
+  def test_scale_tickets
+    resource = create_resource :testing, tickets: 10
+
+    assert_equal 11, resource.scale_tickets(1.0, 1, 1, 20)
+    assert_equal 11, resource.tickets
+    assert_equal 11, resource.count
+
+    assert_equal 9, resource.scale_tickets(0.9, 0, 1, 20)
+    assert_equal 9, resource.tickets
+    assert_equal 9, resource.count
+  end
+
+  def test_scale_tickets_stays_within_bounds
+    resource = create_resource :testing, tickets: 4
+
+    assert_equal 2, resource.scale_tickets(0.1, 0, 2, 5)
+    assert_equal 5, resource.scale_tickets(1.0, 10, 2, 5)
+    assert_equal 5, resource.tickets
+
+    assert_raises ArgumentError do
+      resource.scale_tickets(1.0, 1, 6, 5)
+    end
+    assert_raises ArgumentError do
+      resource.scale_tickets(1.0, 1, 0, 5)
+    end
+  end
+
+  def test_scale_tickets_only_takes_back_free_tickets
+    resource = create_resource :testing, tickets: 4, timeout: 0.1
+
+    resource.acquire do
+      resource.acquire do
+        resource.acquire do
+          assert_equal 3, resource.scale_tickets(0.5, 0, 1, 4)
+          assert_equal 0, resource.count
+        end
+      end
+    end
+
+    assert_equal 3, resource.tickets
+    assert_equal 3, resource.count
+    assert_equal 1, resource.scale_tickets(0.5, 0, 1, 4)
+  end
+
+  def test_adaptive_tickets_are_kept_when_registering_again
+    resource = create_resource :testing, adaptive_tickets: { max: 10, target_latency: 0.1 }
+    assert_equal 10, resource.tickets
+    resource.scale_tickets(0.5, 0, 1, 10)
+
+    create_resource :testing, adaptive_tickets: { max: 10, target_latency: 0.1 }
+    assert_equal 5, resource.tickets
+  end
+
+  def test_adaptive_tickets_reconfigure_a_set_without_workers
+    resource = create_resource :testing, tickets: 1
+    resource.unregister_worker
+
+    resource = create_resource :testing, adaptive_tickets: { max: 10, target_latency: 0.1 }
+    assert_equal 10, resource.tickets
+  end
+
+  def test_adaptive_tickets_with_quota_raises
+    assert_raises ArgumentError do
+      create_resource :testing, quota: 0.5, adaptive_tickets: { max: 10, target_latency: 0.1 }
+    end
+  end
+
   def test_multiple_register_with_fork
     count = 5
     tickets = 5
@@ -510,6 +667,920 @@ class TestResource < Minitest::Test
     assert_equal 0, timeouts
   end
 
+  def test_shm_ticket_backend_acquire
+    resource = create_resource :testing, tickets: 2, ticket_backend: :shm
+    assert_equal :shm, resource.ticket_backend
+    assert_equal 2, resource.count
+
+    resource.acquire do |wait_time|
+      assert_equal 0, wait_time
+      assert_equal 1, resource.count
+      assert_equal 2, resource.tickets
+    end
+
+    assert_equal 2, resource.count
+  end
+
+  def test_shm_ticket_backend_timeout
+    resource = create_resource :testing, tickets: 1, timeout: 0.1, ticket_backend: :shm
+
+    resource.acquire do
+      assert_raises Semian::TimeoutError do
+        resource.acquire {}
+      end
+    end
+
+    assert_equal 1, resource.count
+  end
+
+  def test_shm_ticket_backend_wakes_waiters
+    resource = create_resource :testing, tickets: 1, timeout: 2, ticket_backend: :shm
+    reader, writer = IO.pipe
+
+    pid = fork do
+      resource.acquire do
+        writer.write("\n")
+        sleep 0.2
+      end
+      exit! 0
+    end
+
+    reader.read(1)
+    acquired = false
+    resource.acquire { acquired = true }
+    assert acquired
+    Process.wait(pid)
+  end
+
+  def test_shm_ticket_backend_releases_on_kill
+    resource = create_resource :testing, tickets: 1, timeout: 0.1, ticket_backend: :shm
+    reader, writer = IO.pipe
+
+    pid = fork do
+      resource.acquire do
+        writer.write("\n")
+        sleep 1000
+      end
+    end
+
+    reader.read(1)
+    assert_raises Semian::TimeoutError do
+      resource.acquire {}
+    end
+
+    Process.kill("KILL", pid)
+    Process.wait(pid)
+
+    acquired = false
+    resource.acquire { acquired = true }
+    assert acquired
+    assert_equal 1, resource.count
+  end
+
+  def test_shm_ticket_backend_resize
+    resource = create_resource :testing, tickets: 2, ticket_backend: :shm
+    assert_equal 2, resource.count
+
+    create_resource :testing, tickets: 5, ticket_backend: :shm
+    assert_equal 5, resource.count
+    assert_equal 5, resource.tickets
+
+    resource.acquire do
+      create_resource :testing, tickets: 1, ticket_backend: :shm
+      assert_equal 0, resource.count
+    end
+    assert_equal 1, resource.count
+  end
+
+  def test_shm_ticket_backend_destroy
+    resource = create_resource :testing, tickets: 1, ticket_backend: :shm
+    resource.destroy
+    assert_raises Semian::SyscallError do
+      resource.acquire {}
+    end
+  end
+
+  def test_invalid_ticket_backend
+    assert_raises ArgumentError do
+      create_resource :testing, tickets: 1, ticket_backend: :unknown
+    end
+  end
+
+  def test_low_priority_leaves_reserved_tickets
+    [:sysv, :shm].each do |backend|
+      resource = create_resource :testing, tickets: 3, reserved_tickets: 1, timeout: 0.05, ticket_backend: backend
+
+      resource.acquire(priority: :low) do
+        resource.acquire(priority: :low) do
+          assert_raises Semian::TimeoutError do
+            resource.acquire(priority: :low) {}
+          end
+
+          acquired = false
+          resource.acquire(priority: :high) { acquired = true }
+          assert acquired, "high priority callers may take the reserved ticket with #{backend} tickets"
+        end
+      end
+
+      assert_equal 3, resource.count
+      resource.destroy
+    end
+  end
+
+  def test_low_priority_waits_for_more_than_reserved_tickets
+    [:sysv, :shm].each do |backend|
+      resource = create_resource :testing, tickets: 2, reserved_tickets: 1, timeout: 2, ticket_backend: backend
+
+      acquired = false
+      waiter = nil
+      resource.acquire do
+        waiter = Thread.new { resource.acquire(priority: :low) { acquired = true } }
+        sleep 0.05
+        refute acquired
+      end
+
+      waiter.join
+      assert acquired, "low priority callers are woken up with #{backend} tickets"
+      resource.destroy
+    end
+  end
+
+  def test_try_acquire
+    [:sysv, :shm].each do |backend|
+      resource = create_resource :testing, tickets: 1, timeout: 1, ticket_backend: backend
+
+      result = resource.try_acquire do |wait_time|
+        assert_equal 0, wait_time
+        assert_equal 0, resource.count
+        refute(resource.try_acquire { flunk "no ticket should be left with #{backend} tickets" })
+        :result
+      end
+
+      assert_equal :result, result
+      assert_equal 1, resource.count
+      resource.destroy
+    end
+  end
+
+  def test_try_acquire_with_priority
+    resource = create_resource :testing, tickets: 2, reserved_tickets: 1
+
+    resource.acquire do
+      refute(resource.try_acquire(priority: :low) { flunk "the reserved ticket was taken" })
+      assert(resource.try_acquire(priority: :high) { true })
+    end
+  end
+
+  def test_lease_holds_a_ticket_until_released
+    [:sysv, :shm].each do |backend|
+      resource = create_resource :testing, tickets: 1, timeout: 0.1, ticket_backend: backend
+
+      lease = resource.lease
+      assert_equal 0, lease.wait_time
+      refute_predicate lease, :released?
+      assert_equal 0, resource.count
+      assert_raises Semian::TimeoutError do
+        resource.lease
+      end
+
+      assert lease.release
+      assert_predicate lease, :released?
+      refute lease.release, "a lease is only released once"
+      assert_equal 1, resource.count
+      resource.destroy
+    end
+  end
+
+  def test_collected_lease_gives_its_ticket_back
+    [:sysv, :shm].each do |backend|
+      resource = create_resource :testing, tickets: 1, timeout: 0.1, ticket_backend: backend
+      abandon_leases(resource, 10)
+      assert_equal 1, resource.count, "with #{backend} tickets"
+      resource.destroy
+    end
+  end
+
+  def test_lease_outlives_its_destroyed_resource
+    resource = create_resource :testing, tickets: 1, timeout: 0.1, ticket_backend: :shm
+    lease = resource.lease
+    resource.destroy
+
+    assert lease.release
+    assert_predicate lease, :released?
+  end
+
+  def test_lease_takes_scope_tickets
+    resource = create_resource :testing, tickets: 2, scope_tickets: { streams: 1 }, timeout: 0.1
+
+    lease = resource.lease(:streams)
+    assert_raises Semian::TimeoutError do
+      resource.lease(scope: :streams)
+    end
+    resource.acquire {}
+    lease.release
+
+    resource.lease(:streams).release
+    assert_equal 2, resource.count
+    assert_equal 2, resource.duration_histograms[:streams].values.sum
+  end
+
+  def test_lease_releases_on_kill
+    resource = create_resource :testing, tickets: 1, timeout: 0.1
+    reader, writer = IO.pipe
+
+    pid = fork do
+      resource.lease
+      writer.write("\n")
+      sleep 1000
+    end
+
+    reader.read(1)
+    assert_equal 0, resource.count
+
+    Process.kill("KILL", pid)
+    Process.wait(pid)
+    assert_equal 1, resource.count
+  end
+
+  def test_lease_is_not_released_by_a_forked_child
+    resource = create_resource :testing, tickets: 1, timeout: 0.1
+    lease = resource.lease
+
+    pid = fork do
+      exit!(lease.released? && !lease.release ? 0 : 1)
+    end
+    _, status = Process.wait2(pid)
+
+    assert_predicate status, :success?
+    assert_equal 0, resource.count
+    assert lease.release
+  end
+
+  def test_lease_is_released_when_collected
+    resource = create_resource :testing, tickets: 1, timeout: 0.1
+    1.times { resource.lease }
+    10.times do
+      GC.start(full_mark: true, immediate_sweep: true)
+      break if resource.count == 1
+    end
+    assert_equal 1, resource.count
+  end
+
+  def test_max_queue_fails_fast
+    resource = create_resource :testing, tickets: 1, max_queue: 1, timeout: 2, ticket_backend: :shm
+
+    waiter = nil
+    resource.acquire do
+      waiter = Thread.new { resource.acquire {} }
+      sleep 0.05
+
+      started_at = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      error = assert_raises Semian::TimeoutError do
+        resource.acquire {}
+      end
+      assert_match(/too many callers/, error.message)
+      assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - started_at, :<, 0.5
+    end
+
+    waiter.join
+    assert_equal 1, resource.count
+  end
+
+  def test_fifo_hands_out_tickets_in_arrival_order
+    resource = create_resource :testing, tickets: 1, fifo: true, timeout: 2, ticket_backend: :shm
+    order = []
+
+    waiters = nil
+    resource.acquire do
+      waiters = 5.times.map do |i|
+        waiter = Thread.new { resource.acquire { order << i } }
+        sleep 0.02
+        waiter
+      end
+    end
+
+    waiters.each(&:join)
+    assert_equal [0, 1, 2, 3, 4], order
+    assert_equal 1, resource.count
+  end
+
+  def test_fifo_timed_out_waiters_leave_the_line
+    resource = create_resource :testing, tickets: 1, max_queue: 2, timeout: 0.05, ticket_backend: :shm
+
+    resource.acquire do
+      2.times do
+        assert_raises Semian::TimeoutError do
+          resource.acquire {}
+        end
+      end
+    end
+
+    acquired = false
+    resource.acquire { acquired = true }
+    assert acquired
+  end
+
+  def test_invalid_max_queue
+    assert_raises ArgumentError do
+      create_resource :testing, tickets: 1, max_queue: 0, ticket_backend: :shm
+    end
+  end
+
+  def test_fifo_and_max_queue_require_shm_tickets
+    assert_raises ArgumentError do
+      create_resource :testing, tickets: 1, max_queue: 1
+    end
+    assert_raises ArgumentError do
+      create_resource :testing, tickets: 1, fifo: true, ticket_backend: :sysv
+    end
+  end
+
+  def test_scope_tickets_limit_a_scope
+    resource = create_resource :testing, tickets: 3, scope_tickets: { connection: 1, ping: 1 }, timeout: 0.05
+
+    resource.acquire(scope: :connection) do
+      assert_equal 2, resource.count
+      assert_raises Semian::TimeoutError do
+        resource.acquire(scope: :connection) {}
+      end
+      refute(resource.try_acquire(scope: :connection) { flunk "the connection scope has no ticket left" })
+
+      # Other scopes and callers without one still get the remaining tickets
+      resource.acquire(scope: :ping) do
+        resource.acquire(scope: :query) { assert_equal 0, resource.count }
+      end
+    end
+
+    acquired = false
+    resource.acquire(scope: :connection) { acquired = true }
+    assert acquired
+    assert_equal 3, resource.count
+  end
+
+  def test_scope_tickets_are_released_when_the_block_raises
+    resource = create_resource :testing, tickets: 2, scope_tickets: { connection: 1 }, timeout: 0.05
+
+    assert_raises RuntimeError do
+      resource.acquire(scope: :connection) { raise 'reconnect failed' }
+    end
+
+    acquired = false
+    resource.acquire(scope: :connection) { acquired = true }
+    assert acquired
+  end
+
+  def test_scope_tickets_resize
+    create_resource :testing, tickets: 3, scope_tickets: { connection: 1 }, timeout: 0.05
+    resource = create_resource :testing, tickets: 3, scope_tickets: { connection: 2 }, timeout: 0.05
+
+    resource.acquire(scope: :connection) do
+      acquired = false
+      resource.acquire(scope: :connection) { acquired = true }
+      assert acquired
+    end
+  end
+
+  def test_invalid_scope_tickets
+    assert_raises ArgumentError do
+      create_resource :testing, tickets: 1, scope_tickets: { connection: 0 }
+    end
+    assert_raises ArgumentError do
+      create_resource :testing, tickets: 1, scope_tickets: { connection: 1, ping: 1, query: 1 }
+    end
+    assert_raises TypeError do
+      create_resource :testing, tickets: 1, scope_tickets: { 'connection' => 1 }
+    end
+    assert_raises ArgumentError do
+      create_resource :testing, tickets: 1, scope_tickets: { connection: 1 }, ticket_backend: :shm
+    end
+    assert_raises ArgumentError do
+      create_resource :testing, tickets: 1, scope_tickets: { connection: 1 }, resource_pool: :testing_pool
+    end
+  end
+
+  def test_scope_tickets_use_a_larger_set_of_their_own
+    Semian::Resource.key_hash = :fnv1a
+    scoped = create_resource :testing_scoped, tickets: 2, scope_tickets: { connection: 1 }
+    unscoped = create_resource :testing, tickets: 2
+
+    hash = 'testing_scoped_NUM_SEMS_8'.each_byte.reduce(0x811c9dc5) { |h, byte| ((h ^ byte) * 0x01000193) & 0xffffffff }
+    assert_equal(format('0x%08x', hash), scoped.key)
+    refute_equal scoped.semid, unscoped.semid
+  ensure
+    Semian::Resource.key_hash = :sha1
+  end
+
+  def test_deadline_shortens_the_timeout
+    resource = create_resource :testing, tickets: 1, timeout: 5
+
+    resource.acquire do
+      started_at = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      assert_raises Semian::TimeoutError do
+        resource.acquire(deadline: started_at + 0.05) {}
+      end
+      assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - started_at, :<, 0.5
+
+      assert_raises Semian::TimeoutError do
+        resource.acquire(deadline: started_at - 1) {}
+      end
+    end
+
+    acquired = false
+    resource.acquire(deadline: Process.clock_gettime(Process::CLOCK_MONOTONIC) + 1) { acquired = true }
+    assert acquired
+  end
+
+  def test_early_fail_once_waits_outlast_the_timeout
+    [:sysv, :shm].each do |backend|
+      resource = create_resource :testing, tickets: 1, timeout: 0.05, early_fail: true, ticket_backend: backend
+
+      resource.acquire do
+        # Timed out waits raise the expected wait over the timeout
+        error = nil
+        20.times do
+          started_at = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+          error = assert_raises(Semian::TimeoutError) { resource.acquire {} }
+          break if Process.clock_gettime(Process::CLOCK_MONOTONIC) - started_at < 0.01
+        end
+        assert_match(/isn't expected to free a ticket in time/, error.message, "with #{backend} tickets")
+
+        # Without new waits, a single caller waits again once the estimate is stale
+        sleep 0.2
+        error = assert_raises(Semian::TimeoutError) { resource.acquire {} }
+        assert_match(/timed out waiting/, error.message, "with #{backend} tickets")
+        error = assert_raises(Semian::TimeoutError) { resource.acquire {} }
+        assert_match(/isn't expected to free a ticket in time/, error.message, "with #{backend} tickets")
+      end
+
+      # Free tickets are always taken
+      acquired = false
+      resource.acquire { acquired = true }
+      assert acquired
+      resource.destroy
+    end
+  end
+
+  def test_acquire_under_fiber_scheduler_lets_other_fibers_run
+    [:sysv, :shm].each do |backend|
+      resource = create_resource :testing, tickets: 1, timeout: 1, ticket_backend: backend
+      events = []
+
+      Thread.new do
+        Fiber.set_scheduler(FiberScheduler.new)
+        Fiber.schedule do
+          resource.acquire do
+            events << :first_acquired
+            sleep 0.05
+            events << :first_released
+          end
+        end
+        Fiber.schedule do
+          resource.acquire { events << :second_acquired }
+        end
+        Fiber.schedule do
+          sleep 0.01
+          events << :other_fiber_ran
+        end
+      end.join
+
+      assert_equal [:first_acquired, :other_fiber_ran, :first_released, :second_acquired], events
+      resource.destroy
+    end
+  end
+
+  def test_acquire_under_fiber_scheduler_times_out
+    resource = create_resource :testing, tickets: 1, timeout: 0.05
+    error = nil
+
+    Thread.new do
+      Fiber.set_scheduler(FiberScheduler.new)
+      Fiber.schedule do
+        resource.acquire { sleep 0.2 }
+      end
+      Fiber.schedule do
+        resource.acquire {}
+      rescue Semian::TimeoutError => e
+        error = e
+      end
+    end.join
+
+    assert_kind_of Semian::TimeoutError, error
+  end
+
+  def test_acquire_under_fiber_scheduler_waits_in_line
+    resource = create_resource :testing, tickets: 1, fifo: true, timeout: 2, ticket_backend: :shm
+    order = []
+
+    waiters = nil
+    resource.acquire do
+      waiters = [:first, :fiber, :last].map do |name|
+        waiter = Thread.new do
+          if name == :fiber
+            Fiber.set_scheduler(FiberScheduler.new)
+            Fiber.schedule { resource.acquire { order << name } }
+          else
+            resource.acquire { order << name }
+          end
+        end
+        sleep 0.02
+        waiter
+      end
+    end
+
+    waiters.each(&:join)
+    assert_equal [:first, :fiber, :last], order
+    assert_equal 1, resource.count
+  end
+
+  def test_acquire_under_fiber_scheduler_counts_against_max_queue
+    resource = create_resource :testing, tickets: 1, max_queue: 1, timeout: 2, ticket_backend: :shm
+
+    waiter = nil
+    resource.acquire do
+      waiter = Thread.new do
+        Fiber.set_scheduler(FiberScheduler.new)
+        Fiber.schedule { resource.acquire {} }
+      end
+      sleep 0.05
+
+      error = assert_raises Semian::TimeoutError do
+        resource.acquire {}
+      end
+      assert_match(/too many callers/, error.message)
+    end
+
+    waiter.join
+    assert_equal 1, resource.count
+  end
+
+  def test_invalid_priority
+    resource = create_resource :testing, tickets: 1, reserved_tickets: 1
+    assert_raises ArgumentError do
+      resource.acquire(priority: :medium) {}
+    end
+  end
+
+  def test_acquire_all
+    first = create_resource :testing_acquire_all_1, tickets: 1
+    second = create_resource :testing_acquire_all_2, tickets: 2, ticket_backend: :shm
+
+    acquired = false
+    Semian::Resource.acquire_all([first, second], timeout: 0.1) do |wait_time|
+      acquired = true
+      assert_kind_of Integer, wait_time
+      assert_equal 0, first.count
+      assert_equal 1, second.count
+    end
+    assert acquired
+    assert_equal 1, first.count
+    assert_equal 2, second.count
+  end
+
+  def test_acquire_all_is_all_or_nothing
+    first = create_resource :testing_acquire_all_1, tickets: 1
+    second = create_resource :testing_acquire_all_2, tickets: 1
+
+    second.acquire do
+      assert_raises Semian::TimeoutError do
+        Semian::Resource.acquire_all([first, second], timeout: 0.1) { flunk 'block should not be called' }
+      end
+      assert_equal 1, first.count
+    end
+    assert_equal 1, second.count
+  end
+
+  def test_acquire_all_releases_when_block_raises
+    first = create_resource :testing_acquire_all_1, tickets: 1
+    second = create_resource :testing_acquire_all_2, tickets: 1, ticket_backend: :shm
+
+    assert_raises RuntimeError do
+      Semian::Resource.acquire_all([second, first]) { raise 'boom' }
+    end
+    assert_equal 1, first.count
+    assert_equal 1, second.count
+  end
+
+  def test_acquire_all_takes_one_ticket_per_listed_resource
+    resource = create_resource :testing_acquire_all_1, tickets: 3
+
+    Semian::Resource.acquire_all([resource, resource]) do
+      assert_equal 1, resource.count
+    end
+    assert_equal 3, resource.count
+  end
+
+  def test_acquire_all_releases_on_kill
+    resource = create_resource :testing_acquire_all_1, tickets: 1
+
+    pid = fork do
+      Semian::Resource.acquire_all([Semian::Resource.new(:testing_acquire_all_1, tickets: 1)]) { sleep }
+    end
+    sleep 0.1 until resource.count == 0
+    Process.kill('KILL', pid)
+    Process.wait(pid)
+
+    assert_equal 1, resource.count
+  end
+
+  def test_acquire_all_invalid_args
+    assert_raises ArgumentError do
+      Semian::Resource.acquire_all([])
+    end
+    assert_raises TypeError do
+      Semian::Resource.acquire_all([:testing]) {}
+    end
+  end
+
+  def test_resource_pool_shares_semaphore_set
+    first = create_resource :testing_pool_1, tickets: 2, resource_pool: :testing_pool
+    second = create_resource :testing_pool_2, tickets: 3, resource_pool: :testing_pool
+
+    assert_equal first.semid, second.semid
+    assert_equal first.key, second.key
+    assert_equal 2, first.tickets
+    assert_equal 3, second.tickets
+
+    first.acquire do
+      assert_equal 1, first.count
+      assert_equal 3, second.count
+    end
+    assert_equal 2, first.count
+  end
+
+  def test_resource_pool_reuses_slot_for_name
+    first = create_resource :testing_pool_1, tickets: 2, resource_pool: :testing_pool
+    first.acquire do
+      again = Semian::Resource.new(:testing_pool_1, tickets: 2, resource_pool: :testing_pool)
+      assert_equal 1, again.count
+      assert_equal 2, again.registered_workers
+    end
+  end
+
+  def test_resource_pool_across_processes
+    resource = create_resource :testing_pool_1, tickets: 1, resource_pool: :testing_pool
+
+    pid = fork do
+      Semian::Resource.new(:testing_pool_1, tickets: 1, resource_pool: :testing_pool).acquire { sleep }
+    end
+    sleep 0.1 until resource.count == 0
+    assert_raises Semian::TimeoutError do
+      resource.acquire(timeout: 0.05) {}
+    end
+
+    Process.kill('KILL', pid)
+    Process.wait(pid)
+    assert_equal 1, resource.count
+  end
+
+  def test_resource_pool_destroy_only_resets_its_slot
+    first = create_resource :testing_pool_1, tickets: 2, resource_pool: :testing_pool
+    second = create_resource :testing_pool_2, tickets: 3, resource_pool: :testing_pool
+
+    first.destroy
+    assert_equal 0, first.tickets
+    assert_equal 3, second.tickets
+
+    again = create_resource :testing_pool_1, tickets: 4, resource_pool: :testing_pool
+    assert_equal 4, again.tickets
+    assert_equal second.semid, again.semid
+  end
+
+  def test_resource_pool_destroy_keeps_the_slot_of_other_workers
+    resource = create_resource :testing_pool_1, tickets: 2, resource_pool: :testing_pool
+
+    resource.acquire do
+      pid = fork do
+        Semian::Resource.new(:testing_pool_1, tickets: 2, resource_pool: :testing_pool).destroy
+        exit!(0)
+      end
+      Process.wait(pid)
+
+      assert_equal 2, resource.tickets
+      assert_equal 1, resource.registered_workers
+      resource.acquire(timeout: 0.05) {}
+    end
+    assert_equal 2, resource.count
+  end
+
+  def test_resource_pool_full
+    old_capacity = Semian.resource_pool_capacity
+    Semian.resource_pool_capacity = 2
+    create_resource :testing_pool_1, tickets: 1, resource_pool: :testing_small_pool
+    create_resource :testing_pool_2, tickets: 1, resource_pool: :testing_small_pool
+    assert_raises Semian::InternalError do
+      create_resource :testing_pool_3, tickets: 1, resource_pool: :testing_small_pool
+    end
+  ensure
+    Semian.resource_pool_capacity = old_capacity
+  end
+
+  def test_resource_pool_capacity_fits_in_a_set
+    old_capacity = Semian.resource_pool_capacity
+    semmsl = File.read('/proc/sys/kernel/sem').split.first.to_i
+    Semian.resource_pool_capacity = [semmsl, 65535].min / 4
+    error = assert_raises ArgumentError do
+      create_resource :testing_pool_1, tickets: 1, resource_pool: :testing_large_pool
+    end
+    assert_match(/resource_pool_capacity must be between 1 and #{[semmsl, 65535].min / 4 - 1}/, error.message)
+  ensure
+    Semian.resource_pool_capacity = old_capacity
+  end
+
+  def test_resource_pool_rejects_long_names
+    assert_raises ArgumentError do
+      create_resource 'x' * 200, tickets: 1, resource_pool: :testing_pool
+    end
+  end
+
+  def test_acquire_all_pooled_resources
+    first = create_resource :testing_pool_1, tickets: 1, resource_pool: :testing_pool
+    second = create_resource :testing_pool_2, tickets: 1, resource_pool: :testing_pool
+
+    second.acquire do
+      assert_raises Semian::TimeoutError do
+        Semian::Resource.acquire_all([first, second], timeout: 0.05) {}
+      end
+      assert_equal 1, first.count
+    end
+
+    Semian::Resource.acquire_all([second, first]) do
+      assert_equal 0, first.count
+      assert_equal 0, second.count
+    end
+    assert_equal 1, first.count
+    assert_equal 1, second.count
+  end
+
+  def test_wait_time_histogram
+    resource = create_resource :testing, tickets: 1, timeout: 0.05
+    assert_equal({}, resource.wait_time_histogram)
+
+    3.times { resource.acquire {} }
+    resource.acquire do
+      assert_raises Semian::TimeoutError do
+        resource.acquire {}
+      end
+    end
+
+    histogram = resource.wait_time_histogram
+    assert_equal 4, histogram.values.sum
+    histogram.each_key do |upper_bound|
+      assert upper_bound == Float::INFINITY || (upper_bound & (upper_bound - 1)).zero?
+    end
+  end
+
+  def test_wait_time_histogram_buckets_waits
+    resource = create_resource :testing, tickets: 1, timeout: 1
+
+    reader, writer = IO.pipe
+    pid = fork do
+      reader.close
+      resource.acquire do
+        writer.close # Lets the parent start waiting
+        sleep 0.2
+      end
+    end
+    writer.close
+    reader.read
+    resource.acquire {}
+    Process.wait(pid)
+
+    slowest = resource.wait_time_histogram.keys.max
+    assert_operator slowest, :>, 100_000
+    assert_operator slowest, :<=, 1_000_000
+  end
+
+  def test_wait_time_histogram_shm_ticket_backend
+    resource = create_resource :testing, tickets: 1, ticket_backend: :shm
+    2.times { resource.acquire {} }
+    assert_equal({ 1 => 2 }, resource.wait_time_histogram)
+  end
+
+  def test_wait_time_histogram_acquire_all
+    first = create_resource :testing_1, tickets: 1
+    second = create_resource :testing_2, tickets: 1
+
+    Semian::Resource.acquire_all([first, second]) {}
+    assert_equal 1, first.wait_time_histogram.values.sum
+    assert_equal 1, second.wait_time_histogram.values.sum
+  end
+
+  def test_duration_histograms
+    resource = create_resource :testing, tickets: 1
+    assert_equal({}, resource.duration_histograms)
+
+    resource.acquire(:query) { sleep 0.01 }
+    resource.acquire(scope: :query) {}
+    assert_raises(RuntimeError) { resource.acquire(:connection) { raise 'boom' } }
+    resource.try_acquire {}
+
+    histograms = resource.duration_histograms
+    assert_equal [nil, :query, :connection].sort_by(&:to_s), histograms.keys.sort_by(&:to_s)
+    assert_equal 2, histograms[:query].values.sum
+    assert_operator histograms[:query].keys.max, :>, 8_192
+    assert_equal 1, histograms[:connection].values.sum
+    assert_equal 1, histograms[nil].values.sum
+  end
+
+  def test_duration_histograms_keep_a_bounded_number_of_scopes
+    resource = create_resource :testing, tickets: 1
+    10.times { |i| resource.acquire(:"scope_#{i}") {} }
+    assert_equal 8, resource.duration_histograms.size
+    assert_equal 2, resource.dropped_durations
+
+    resource.acquire(:scope_0) {}
+    resource.acquire(:scope_9) {}
+    resource.acquire('scope_0') {}
+    assert_equal 2, resource.duration_histograms[:scope_0].values.sum
+    assert_equal 4, resource.dropped_durations
+  end
+
+  def test_sub_millisecond_timeout
+    resource = create_resource :testing, tickets: 1, timeout: 0.0005
+
+    resource.acquire do
+      started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      assert_raises Semian::TimeoutError do
+        resource.acquire {}
+      end
+      assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - started, :>=, 0.0005
+
+      started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      assert_raises Semian::TimeoutError do
+        resource.acquire(timeout: 0.0002) {}
+      end
+      assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - started, :>=, 0.0002
+    end
+  end
+
+  def test_wait_time_unit
+    resource = create_resource :testing, tickets: 1
+    assert_equal :milliseconds, Semian.wait_time_unit
+    resource.acquire { |wait_time| assert_kind_of Integer, wait_time }
+
+    Semian.wait_time_unit = :nanoseconds
+    resource.acquire { |wait_time| assert_kind_of Integer, wait_time }
+    Semian::Resource.acquire_all([resource]) { |wait_time| assert_kind_of Integer, wait_time }
+
+    Semian.wait_time_unit = :seconds
+    resource.acquire { |wait_time| assert_kind_of Float, wait_time }
+    Semian::Resource.acquire_all([resource]) { |wait_time| assert_kind_of Float, wait_time }
+  ensure
+    Semian.wait_time_unit = :milliseconds
+  end
+
+  def test_wait_time_unit_nanoseconds_while_waiting
+    Semian.wait_time_unit = :nanoseconds
+    resource = create_resource :testing, tickets: 1, timeout: 1
+
+    reader, writer = IO.pipe
+    pid = fork do
+      reader.close
+      resource.acquire do
+        writer.close
+        sleep 0.1
+      end
+    end
+    writer.close
+    reader.read
+    resource.acquire do |wait_time|
+      assert_operator wait_time, :>, 50_000_000
+      assert_operator wait_time, :<, 1_000_000_000
+    end
+    Process.wait(pid)
+  ensure
+    Semian.wait_time_unit = :milliseconds
+  end
+
+  def test_invalid_wait_time_unit
+    assert_raises ArgumentError do
+      Semian.wait_time_unit = :minutes
+    end
+    assert_raises TypeError do
+      Semian.wait_time_unit = 'seconds'
+    end
+    assert_equal :milliseconds, Semian.wait_time_unit
+  end
+
+  # Each lease waits for the previous one, abandoned holding the only ticket, to be collected
+  # Leases are taken on a thread that exits, so nothing left on this thread's stack keeps them alive
+  def abandon_leases(resource, count)
+    count.times do
+      leased = 100.times.any? do
+        Thread.new do
+          resource.lease
+          nil
+        end.join
+        true
+      rescue Semian::TimeoutError
+        GC.start
+        false
+      end
+      assert leased, "the abandoned lease should have been collected"
+    end
+    GC.start
+  end
+
   def create_resource(name, **kwargs)
     @resources ||= []
     resource = Semian::Resource.new(name, **kwargs)
@@ -519,6 +1590,7 @@ class TestResource < Minitest::Test
 
   def destroy_resources
     return unless @resources
+    pool_keys = @resources.select(&:resource_pool).map(&:key).uniq
     @resources.each do |resource|
       begin
         resource.destroy
@@ -526,6 +1598,8 @@ class TestResource < Minitest::Test
         nil
       end
     end
+    # Destroying a pooled resource keeps the pool's semaphore set, remove it like the ipcrm tool would
+    pool_keys.each { |key| system("ipcrm -S #{key}", out: File::NULL, err: File::NULL) }
     @resources = []
   end
 
@@ -14,6 +14,202 @@ class TestSemian < Minitest::Test
     assert acquired
   end
 
+  def test_acquire_all
+    Semian.register :testing, tickets: 1, circuit_breaker: false
+    Semian.register :testing_2, tickets: 1, circuit_breaker: false
+
+    events = []
+    Semian.subscribe(:test_acquire_all) { |event, resource| events << [event, resource.name] }
+
+    Semian.acquire_all([:testing, :testing_2]) do
+      assert_equal 0, Semian[:testing].count
+      assert_equal 0, Semian[:testing_2].count
+    end
+    assert_equal [[:success, :testing], [:success, :testing_2]], events
+
+    Semian[:testing_2].acquire do
+      events.clear
+      assert_raises Semian::TimeoutError do
+        Semian.acquire_all([:testing, :testing_2], timeout: 0.05) {}
+      end
+    end
+    assert_equal [[:busy, :testing], [:busy, :testing_2]], events
+  ensure
+    Semian.unsubscribe(:test_acquire_all)
+    Semian.destroy(:testing_2)
+  end
+
+  def test_snapshot
+    Semian.stats_enabled = true
+    Semian.register :testing_stats, tickets: 1, timeout: 0.05, error_threshold: 1, error_timeout: 2, success_threshold: 1
+    before = Semian.snapshot.fetch('testing_stats')
+
+    Semian[:testing_stats].acquire do
+      assert_equal before[:in_flight] + 1, Semian.snapshot['testing_stats'][:in_flight]
+      assert_raises Semian::TimeoutError do
+        Semian[:testing_stats].acquire {}
+      end
+    end
+
+    after = Semian.snapshot.fetch('testing_stats')
+    assert_equal before[:acquisitions] + 1, after[:acquisitions]
+    assert_equal before[:timeouts] + 1, after[:timeouts]
+    assert_equal before[:in_flight], after[:in_flight]
+    assert_equal before[:wait_time_histogram].values.sum + 1, after[:wait_time_histogram].values.sum
+    # The timeout opened the circuit
+    assert_equal :open, after[:circuit_state]
+  ensure
+    Semian.stats_enabled = false
+    Semian.destroy(:testing_stats)
+  end
+
+  def test_snapshot_from_another_process
+    Semian.stats_enabled = true
+    Semian.register :testing_stats, tickets: 1, circuit_breaker: false
+    reader, writer = IO.pipe
+
+    Semian[:testing_stats].acquire do
+      pid = fork do
+        reader.close
+        writer.write(Marshal.dump(Semian.snapshot['testing_stats']))
+        writer.close
+        exit!(0)
+      end
+      writer.close
+      stats = Marshal.load(reader.read)
+      Process.wait(pid)
+
+      assert_operator stats[:in_flight], :>=, 1
+    end
+  ensure
+    Semian.stats_enabled = false
+    Semian.destroy(:testing_stats)
+  end
+
+  def test_snapshot_gives_back_the_tickets_of_killed_processes
+    Semian.stats_enabled = true
+    [:sysv, :shm].each do |backend|
+      resource = Semian::Resource.new(:testing_stats, tickets: 1, timeout: 1, ticket_backend: backend)
+      before = Semian.snapshot.fetch('testing_stats')[:in_flight]
+      reader, writer = IO.pipe
+
+      pid = fork do
+        resource.acquire do
+          writer.write("\n")
+          sleep 1000
+        end
+      end
+      reader.read(1)
+      assert_equal before + 1, Semian.snapshot['testing_stats'][:in_flight]
+
+      Process.kill('KILL', pid)
+      Process.wait(pid)
+      # The shared memory backend reaps the ticket of the dead process while waiting for it
+      resource.acquire {}
+      assert_equal before, Semian.snapshot['testing_stats'][:in_flight], "with #{backend} tickets"
+      resource.destroy
+    end
+  ensure
+    Semian.stats_enabled = false
+  end
+
+  def test_stats_slots_of_destroyed_resources_are_reclaimed
+    Semian.stats_enabled = true
+    _, err = capture_io do
+      1034.times do |i|
+        Semian::Resource.new(:"testing_stats_#{i}", tickets: 1).destroy
+      end
+    end
+    refute_match(/stats are full/, err)
+
+    resource = Semian::Resource.new(:testing_stats_last, tickets: 1)
+    assert Semian.snapshot.key?('testing_stats_last')
+    resource.destroy
+  ensure
+    Semian.stats_enabled = false
+  end
+
+  def test_resources_have_no_stats_once_the_stats_are_full
+    Semian.stats_enabled = true
+    resources = []
+    _, err = capture_io do
+      1025.times do |i|
+        resources << Semian::Resource.new(:"testing_stats_#{i}", tickets: 1)
+      end
+    end
+    assert_match(/stats are full/, err)
+    resources.last.acquire {}
+  ensure
+    Semian.stats_enabled = false
+    resources&.each(&:destroy)
+  end
+
+  def test_preload
+    Semian.preload(
+      testing: { tickets: 2, circuit_breaker: false },
+      testing_quota: { quota: 1, circuit_breaker: false },
+    )
+    assert_equal 0, Semian[:testing].registered_workers
+    assert_equal 2, Semian[:testing].tickets
+    assert_equal 0, Semian[:testing_quota].registered_workers
+
+    reader, writer = IO.pipe
+    pid = fork do
+      reader.close
+      registered = [Semian.after_fork, Semian.after_fork]
+      writer.write(Marshal.dump([registered, Semian[:testing].registered_workers, Semian[:testing_quota].tickets]))
+      writer.close
+      exit!(0)
+    end
+    writer.close
+    registered, workers, quota_tickets = Marshal.load(reader.read)
+    Process.wait(pid)
+
+    assert_equal [2, 0], registered
+    assert_equal 1, workers
+    assert_equal 1, quota_tickets
+    # The worker's registration was undone when it exited
+    assert_equal 0, Semian[:testing].registered_workers
+  ensure
+    Semian.destroy(:testing_quota)
+  end
+
+  def test_preload_quota_counts_every_worker
+    Semian.preload(testing: { quota: 1, resource_pool: :testing_pool, circuit_breaker: false })
+    done_reader, done_writer = IO.pipe
+    pipes = 2.times.map do
+      reader, writer = IO.pipe
+      fork do
+        reader.close
+        done_writer.close
+        Semian.after_fork
+        writer.write('registered')
+        writer.close
+        done_reader.read
+        exit!(0)
+      end
+      writer.close
+      reader
+    end
+    done_reader.close
+    pipes.each(&:read)
+
+    assert_equal 2, Semian[:testing].registered_workers
+    # The first worker configured the tickets, acquiring resizes them for the second one
+    assert_equal 1, Semian[:testing].tickets
+    Semian[:testing].acquire {}
+    assert_equal 2, Semian[:testing].tickets
+  ensure
+    done_writer&.close
+    Process.waitall
+  end
+
+  def test_acquire_all_unknown_resource
+    assert_raises ArgumentError do
+      Semian.acquire_all([:unknown]) {}
+    end
+  end
+
   def test_register_with_circuit_breaker_missing_options
     exception = assert_raises ArgumentError do
       Semian.register(
@@ -44,4 +44,12 @@ class TestSimpleInteger < Minitest::Test
   end
 
   include IntegerTestCases
+
+  def test_increment_from_many_threads
+    threads = Array.new(8) do
+      Thread.new { 1000.times { @integer.increment } }
+    end
+    threads.each(&:join)
+    assert_equal(8000, @integer.value)
+  end
 end
@@ -0,0 +1,60 @@
+require 'test_helper'
+
+class TestSimpleRequestWindow < Minitest::Test
+  def setup
+    @request_window = ::Semian::ThreadSafe::RequestWindow.new(buckets: 3)
+  end
+
+  def teardown
+    @request_window.destroy
+  end
+
+  module RequestWindowTestCases
+    def test_counts_requests_and_errors
+      @request_window.record_success(10_000).record_success(10_500).record_error(11_000)
+      assert_equal(3, @request_window.requests(11_000))
+      assert_equal(1, @request_window.errors(11_000))
+      assert_equal(3, @request_window.buckets)
+    end
+
+    def test_buckets_fall_out_of_the_window
+      @request_window.record_error(10_000)
+      @request_window.record_success(11_000)
+      @request_window.record_success(12_999)
+      assert_equal(3, @request_window.requests(12_999))
+
+      assert_equal(2, @request_window.requests(13_000))
+      assert_equal(0, @request_window.errors(13_000))
+      assert_equal(0, @request_window.requests(20_000))
+    end
+
+    def test_reused_bucket_is_reset
+      @request_window.record_error(10_000)
+      @request_window.record_success(13_000)
+      assert_equal(1, @request_window.requests(13_000))
+      assert_equal(0, @request_window.errors(13_000))
+    end
+
+    def test_clear
+      @request_window.record_error(10_000)
+      @request_window.clear
+      assert_equal(0, @request_window.requests(10_000))
+    end
+  end
+
+  include RequestWindowTestCases
+
+  def test_buckets_must_be_positive
+    assert_raises(ArgumentError) { ::Semian::ThreadSafe::RequestWindow.new(buckets: 0) }
+  end
+
+  def test_recording_doesnt_allocate
+    record = -> { 100.times { |i| @request_window.record_error(10_000 + i * 100) } }
+    record.call
+
+    # Reading the counter may allocate too, so compare against measuring nothing
+    count_allocations {}
+    baseline = count_allocations {}
+    assert_equal baseline, count_allocations { record.call }
+  end
+end
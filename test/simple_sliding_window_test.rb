@@ -24,6 +24,61 @@ class TestSimpleSlidingWindow < Minitest::Test
     assert_sliding_window(@sliding_window, [2, 3, 4, 5, 6, 7], 6)
   end
 
+  def test_sliding_window_reject
+    @sliding_window << 0 << 1 << 2 << 3 << 4 << 5 << 6 << 7
+    @sliding_window.reject! { |value| value.odd? }
+    assert_sliding_window(@sliding_window, [2, 4, 6], 6)
+    assert_equal(6, @sliding_window.last)
+    @sliding_window << 8 << 9 << 10 << 11
+    assert_sliding_window(@sliding_window, [4, 6, 8, 9, 10, 11], 6)
+  end
+
+  def test_sliding_window_reject_keeps_unvisited_values_when_block_raises
+    @sliding_window << 1 << 2 << 3 << 4
+    assert_raises RuntimeError do
+      @sliding_window.reject! do |value|
+        raise 'boom' if value == 3
+        value == 1
+      end
+    end
+    assert_sliding_window(@sliding_window, [2, 3, 4], 6)
+  end
+
+  def test_sliding_window_reject_while_other_threads_push
+    pushers = Array.new(4) do |n|
+      Thread.new { 500.times { |i| @sliding_window << (n * 1000 + i) } }
+    end
+    rejecter = Thread.new do
+      200.times do
+        @sliding_window.reject! do |value|
+          Thread.pass
+          value.odd?
+        end
+      end
+    end
+    (pushers + [rejecter]).each(&:join)
+
+    assert_operator(@sliding_window.size, :<=, 6)
+    assert_equal(@sliding_window.size, @sliding_window.to_a.compact.size)
+    @sliding_window.reject! { |value| value.odd? }
+    assert(@sliding_window.to_a.all?(&:even?))
+  end
+
+  def test_simple_sliding_window_clear
+    window = ::Semian::Simple::SlidingWindow.new(max_size: 2)
+    window << 1 << 2 << 3
+    assert_equal([2, 3], window.to_a)
+    window.clear
+    assert_equal(0, window.size)
+    assert_nil(window.last)
+  end
+
+  def test_empty_sliding_window_discards_values
+    window = ::Semian::ThreadSafe::SlidingWindow.new(max_size: 0)
+    window << 1
+    assert_sliding_window(window, [], 0)
+  end
+
   def resize_to_less_than_1_raises
     assert_raises ArgumentError do
       @sliding_window.resize_to 0
@@ -33,9 +88,7 @@ class TestSimpleSlidingWindow < Minitest::Test
   private
 
   def assert_sliding_window(sliding_window, array, max_size)
-    # Get private member, the sliding_window doesn't expose the entire array
-    data = sliding_window.instance_variable_get("@window")
-    assert_equal(array, data)
+    assert_equal(array, sliding_window.to_a)
     assert_equal(max_size, sliding_window.max_size)
   end
 end
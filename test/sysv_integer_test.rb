@@ -0,0 +1,46 @@
+require 'test_helper'
+require 'simple_integer_test'
+
+class TestSysVInteger < Minitest::Test
+  KLASS = ::Semian::SysV::Integer
+
+  def setup
+    @integer = KLASS.new(name: 'TestSysVInteger')
+    @integer.reset
+  end
+
+  def teardown
+    @integer.destroy
+  end
+
+  include TestSimpleInteger::IntegerTestCases
+
+  def test_memory_is_shared
+    integer_2 = KLASS.new(name: 'TestSysVInteger')
+    integer_2.value = 100
+    assert_equal 100, @integer.value
+    @integer.value = 200
+    assert_equal 200, integer_2.value
+  end
+
+  def test_memory_is_shared_across_processes
+    pid = fork do
+      KLASS.new(name: 'TestSysVInteger').increment(10_000)
+      exit!(0)
+    end
+    Process.wait(pid)
+    assert_equal 10_000, @integer.value
+  end
+
+  def test_increment_is_atomic
+    pids = 4.times.map do
+      fork do
+        integer = KLASS.new(name: 'TestSysVInteger')
+        1000.times { integer.increment }
+        exit!(0)
+      end
+    end
+    pids.each { |pid| Process.wait(pid) }
+    assert_equal 4000, @integer.value
+  end
+end
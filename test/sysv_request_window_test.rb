@@ -0,0 +1,29 @@
+require 'test_helper'
+require 'simple_request_window_test'
+
+class TestSysVRequestWindow < Minitest::Test
+  KLASS = ::Semian::SysV::RequestWindow
+
+  def setup
+    @request_window = KLASS.new(name: 'TestSysVRequestWindow', buckets: 3)
+    @request_window.clear
+  end
+
+  def teardown
+    @request_window.destroy
+  end
+
+  include TestSimpleRequestWindow::RequestWindowTestCases
+
+  def test_memory_is_shared_across_processes
+    pids = 4.times.map do
+      fork do
+        request_window = KLASS.new(name: 'TestSysVRequestWindow', buckets: 3)
+        100.times { request_window.record_error(10_000) }
+        exit!(0)
+      end
+    end
+    pids.each { |pid| Process.wait(pid) }
+    assert_equal(400, @request_window.errors(10_000))
+  end
+end
@@ -0,0 +1,72 @@
+require 'test_helper'
+
+class TestSysVSlidingWindow < Minitest::Test
+  KLASS = ::Semian::SysV::SlidingWindow
+
+  def setup
+    @sliding_window = KLASS.new(name: 'TestSysVSlidingWindow', max_size: 6)
+    @sliding_window.clear
+  end
+
+  def teardown
+    @sliding_window.destroy
+  end
+
+  def test_sliding_window_push
+    assert_equal(0, @sliding_window.size)
+    @sliding_window << 1
+    assert_sliding_window(@sliding_window, [1], 6)
+    @sliding_window << 5
+    assert_sliding_window(@sliding_window, [1, 5], 6)
+  end
+
+  def test_sliding_window_edge_falloff
+    assert_equal(0, @sliding_window.size)
+    @sliding_window << 0 << 1 << 2 << 3 << 4 << 5 << 6 << 7
+    assert_sliding_window(@sliding_window, [2, 3, 4, 5, 6, 7], 6)
+    assert_equal(7, @sliding_window.last)
+  end
+
+  def test_sliding_window_reject
+    @sliding_window << 0 << 1 << 2 << 3 << 4 << 5 << 6 << 7
+    @sliding_window.reject! { |value| value.odd? }
+    assert_sliding_window(@sliding_window, [2, 4, 6], 6)
+    @sliding_window << 8 << 9 << 10 << 11
+    assert_sliding_window(@sliding_window, [4, 6, 8, 9, 10, 11], 6)
+  end
+
+  def test_last_of_empty_window
+    assert_nil(@sliding_window.last)
+  end
+
+  def test_max_size_must_not_be_negative
+    assert_raises ArgumentError do
+      KLASS.new(name: 'TestSysVSlidingWindow', max_size: -1)
+    end
+  end
+
+  def test_memory_is_shared_across_processes
+    @sliding_window << 1
+    pid = fork do
+      KLASS.new(name: 'TestSysVSlidingWindow', max_size: 6) << 2 << 3
+      exit!(0)
+    end
+    Process.wait(pid)
+    assert_sliding_window(@sliding_window, [1, 2, 3], 6)
+  end
+
+  def test_windows_of_different_sizes_are_not_shared
+    other = KLASS.new(name: 'TestSysVSlidingWindow', max_size: 3)
+    other << 1
+    assert_equal(0, @sliding_window.size)
+  ensure
+    other&.destroy
+  end
+
+  private
+
+  def assert_sliding_window(sliding_window, array, max_size)
+    assert_equal(array, sliding_window.to_a)
+    assert_equal(max_size, sliding_window.max_size)
+  end
+end
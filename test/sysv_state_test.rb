@@ -0,0 +1,36 @@
+require 'test_helper'
+require 'simple_state_test'
+
+class TestSysVState < Minitest::Test
+  KLASS = ::Semian::SysV::State
+
+  def setup
+    @state = KLASS.new(name: 'TestSysVState')
+    @state.reset
+  end
+
+  def teardown
+    @state.destroy
+  end
+
+  include TestSimpleEnum::StateTestCases
+
+  def test_shared
+    assert @state.shared?
+    refute ::Semian::Simple::State.new.shared?
+  end
+
+  def test_will_keep_state_for_new_instances
+    @state.open!
+    assert KLASS.new(name: 'TestSysVState').open?
+  end
+
+  def test_memory_is_shared_across_processes
+    pid = fork do
+      KLASS.new(name: 'TestSysVState').half_open!
+      exit!(0)
+    end
+    Process.wait(pid)
+    assert @state.half_open?
+  end
+end
@@ -11,11 +11,13 @@ require 'byebug'
 require 'mocha'
 require 'mocha/minitest'
 
+require 'helpers/allocation_helper'
 require 'helpers/background_helper'
 require 'helpers/circuit_breaker_helper'
 require 'helpers/resource_helper'
 require 'helpers/adapter_helper'
 require 'helpers/mock_server.rb'
+require 'helpers/fiber_scheduler'
 
 require 'config/semian_config'
 
@@ -23,6 +25,9 @@ BIND_ADDRESS = '0.0.0.0'
 
 Semian.logger = Logger.new(nil)
 
+# Circuit breakers and LRU hashes keep time with the monotonic clock
+Timecop.mock_process_clock = true
+
 Toxiproxy.host = URI::HTTP.build(
   host: SemianConfig['toxiproxy_upstream_host'],
   port: SemianConfig['toxiproxy_upstream_port'],
@@ -60,5 +65,6 @@ Minitest.after_run do
 end
 
 class Minitest::Test
+  include AllocationHelper
   include BackgroundHelper
 end